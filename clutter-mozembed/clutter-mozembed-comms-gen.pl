@@ -0,0 +1,164 @@
+#!/usr/bin/perl -w
+#
+# ClutterMozembed; a ClutterActor that embeds Mozilla
+# Copyright (c) 2009, Intel Corporation.
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms and conditions of the GNU Lesser General Public License,
+# version 2.1, as published by the Free Software Foundation.
+#
+# This program is distributed in the hope it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+# License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software Foundation,
+# Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+#
+# Generates clutter-mozembed-comms-stubs.h from clutter-mozembed-comms.list
+#
+# Usage: clutter-mozembed-comms-gen.pl clutter-mozembed-comms.list
+
+use strict;
+
+my %ctypes = (
+  INT     => 'gint',
+  UINT    => 'guint',
+  BOOLEAN => 'gboolean',
+  LONG    => 'glong',
+  ULONG   => 'gulong',
+  INT64   => 'gint64',
+  UINT64  => 'guint64',
+  DOUBLE  => 'gdouble',
+);
+
+sub camel
+{
+  my $name = lc shift;
+  $name =~ s/(^|_)(\w)/\u$2/g;
+  return $name;
+}
+
+my $list = shift @ARGV or die "Usage: $0 clutter-mozembed-comms.list\n";
+open (LIST, $list) or die "Can't open $list: $!\n";
+
+print <<EOF;
+/* Generated by clutter-mozembed-comms-gen.pl from clutter-mozembed-comms.list,
+ * do not edit.
+ */
+
+#ifndef _CLUTTER_MOZEMBED_COMMS_STUBS
+#define _CLUTTER_MOZEMBED_COMMS_STUBS
+
+#include <string.h>
+#include "clutter-mozembed-comms.h"
+
+/* What goes on the wire, which leaves out any padding after the body */
+#define CME_MESSAGE_SIZE(message) \\
+  (sizeof (ClutterMozEmbedHeader) + (message)->header.length)
+EOF
+
+my $line_no = 0;
+while (<LIST>)
+  {
+    $line_no ++;
+    s/#.*//;
+    next if /^\s*$/;
+
+    /^\s*(COMMAND|FEEDBACK)\s+(\w+)\s*:\s*(.*?)\s*$/
+      or die "$list:$line_no: Can't parse '$_'\n";
+    my ($kind, $name, $spec) = ($1, $2, $3);
+
+    my @fields;
+    if ($spec ne 'NONE')
+      {
+        foreach my $field (split (/\s*,\s*/, $spec))
+          {
+            $field =~ /^(\w+)\s+(\w+)$/
+              or die "$list:$line_no: Bad field '$field'\n";
+            my $ctype = $ctypes{$1}
+              or die "$list:$line_no: Unsupported type '$1'\n";
+            push (@fields, [ $ctype, $2 ]);
+          }
+      }
+
+    my $enum = "CME_${kind}_${name}";
+    my $type = 'ClutterMozEmbed' . camel ($kind) . camel ($name);
+    my $func = 'clutter_mozembed_' . lc ($kind) . '_' . lc ($name);
+    my @args = map { "$_->[0] $_->[1]" } @fields;
+    my $call = join ('', map { ", $_->[1]" } @fields);
+
+    print "\n/* $enum */\n";
+
+    if (@fields)
+      {
+        print "typedef struct\n{\n";
+        print "  $_->[0] $_->[1];\n" foreach (@fields);
+        print "} $type;\n\n";
+      }
+
+    # The body is kept as bytes, so that it follows the header directly
+    # whatever its alignment. The receiving side reads it from the start of
+    # the payload.
+    print "typedef struct\n{\n";
+    print "  ClutterMozEmbedHeader header;\n";
+    print "  guint8 body[sizeof ($type)];\n" if (@fields);
+    print "} ${type}Message;\n\n";
+
+    print "static inline void\n";
+    print "${func}_pack (" .
+          join (', ', "${type}Message *message", @args) . ")\n{\n";
+    print "  $type body;\n\n" if (@fields);
+    print "  memset (message, 0, sizeof (${type}Message));\n";
+    print "  message->header.id = $enum;\n";
+    if (@fields)
+      {
+        print "  message->header.length = sizeof (${type});\n\n";
+        print "  memset (&body, 0, sizeof (${type}));\n";
+        print "  body.$_->[1] = $_->[1];\n" foreach (@fields);
+        print "  memcpy (message->body, &body, sizeof (${type}));\n";
+      }
+    print "}\n\n";
+
+    print "static inline void\n";
+    print "${func}_send (" . join (', ', 'GIOChannel *channel', @args) .
+          ")\n{\n";
+    print "  ${type}Message message;\n";
+    print "  ${func}_pack (&message$call);\n";
+    print "  clutter_mozembed_comms_send_message (channel, &message, " .
+          "CME_MESSAGE_SIZE (&message));\n";
+    print "}\n\n";
+
+    print "static inline GByteArray *\n";
+    print "${func}_encode (" . (@args ? join (', ', @args) : 'void') .
+          ")\n{\n";
+    print "  ${type}Message message;\n";
+    print "  GByteArray *data;\n";
+    print "  ${func}_pack (&message$call);\n";
+    print "  data = g_byte_array_sized_new (CME_MESSAGE_SIZE (&message));\n";
+    print "  g_byte_array_append (data, (const guint8 *)&message, " .
+          "CME_MESSAGE_SIZE (&message));\n";
+    print "  return data;\n";
+    print "}\n";
+
+    next unless (@fields);
+
+    print "\nstatic inline gboolean\n";
+    print "${func}_receive (ClutterMozEmbedMessage *message, $type *body)\n";
+    print "{\n";
+    print "  if (message->length - message->offset < sizeof ($type))\n";
+    print "    {\n";
+    print "      g_warning (\"Short message for $enum\");\n";
+    print "      memset (body, 0, sizeof ($type));\n";
+    print "      return FALSE;\n";
+    print "    }\n\n";
+    print "  memcpy (body, message->data + message->offset, sizeof ($type));\n";
+    print "  message->offset += sizeof ($type);\n";
+    print "  return TRUE;\n";
+    print "}\n";
+  }
+
+close (LIST);
+
+print "\n#endif /* _CLUTTER_MOZEMBED_COMMS_STUBS */\n";
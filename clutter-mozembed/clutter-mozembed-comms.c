@@ -21,26 +21,29 @@
 #include "clutter-mozembed-comms.h"
 #include <glib-object.h>
 #include <string.h>
-
-void
-clutter_mozembed_comms_sendv (GIOChannel *channel, gint command_id, va_list args)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static GByteArray *
+clutter_mozembed_comms_encode_full (gint          id,
+                                    const guint  *sequence,
+                                    va_list       args)
 {
   GType type;
+  GByteArray *data;
+  ClutterMozEmbedHeader *header;
 
-  /* FIXME: Add error handling */
-  /*g_debug ("Sending command: %d", command_id);*/
-
-  if (!channel)
-    {
-      g_warning ("Trying to send command %d with NULL channel", command_id);
-      return;
-    }
+  /* Messages are serialised into a single buffer with a header that
+   * describes the length of the payload, so that they can be sent with a
+   * single write and received as a whole.
+   */
+  data = g_byte_array_sized_new (64);
+  g_byte_array_set_size (data, sizeof (ClutterMozEmbedHeader));
 
-  g_io_channel_write_chars (channel,
-                            (gchar *)(&command_id),
-                            sizeof (command_id),
-                            NULL,
-                            NULL);
+  if (sequence)
+    g_byte_array_append (data, (const guint8 *)sequence, sizeof (guint));
 
   while ((type = va_arg (args, GType)) != G_TYPE_INVALID)
     {
@@ -87,11 +90,7 @@ clutter_mozembed_comms_sendv (GIOChannel *channel, gint command_id, va_list args
             size = strlen (buffer) + 1;
           else
             size = 0;
-          g_io_channel_write_chars (channel,
-                                    (gchar *)(&size),
-                                    sizeof (size),
-                                    NULL,
-                                    NULL);
+          g_byte_array_append (data, (const guint8 *)(&size), sizeof (size));
           break;
 
         case G_TYPE_NONE:
@@ -100,24 +99,204 @@ clutter_mozembed_comms_sendv (GIOChannel *channel, gint command_id, va_list args
           break;
 
         default:
-          g_warning ("Trying to send unknown type (command %d)", command_id);
+          g_warning ("Trying to send unknown type (command %d)", id);
         }
 
       if (!buffer)
         {
-          g_warning ("No data to send (command %d)", command_id);
+          g_warning ("No data to send (command %d)", id);
           continue;
         }
 
       if (size)
-        g_io_channel_write_chars (channel,
-                                  buffer,
-                                  size,
-                                  NULL,
-                                  NULL);
+        g_byte_array_append (data, (const guint8 *)buffer, size);
+    }
+
+  header = (ClutterMozEmbedHeader *)data->data;
+  header->length = data->len - sizeof (ClutterMozEmbedHeader);
+  header->id = id;
+  header->view = 0;
+
+  return data;
+}
+
+GByteArray *
+clutter_mozembed_comms_encode (gint id, va_list args)
+{
+  return clutter_mozembed_comms_encode_full (id, NULL, args);
+}
+
+GByteArray *
+clutter_mozembed_comms_encode_request (gint id, guint sequence, va_list args)
+{
+  return clutter_mozembed_comms_encode_full (id, &sequence, args);
+}
+
+guint
+clutter_mozembed_comms_next_sequence (void)
+{
+  static guint sequence = 0;
+
+  /* Zero is never used, so it can mean 'no request' */
+  if (++sequence == 0)
+    sequence ++;
+
+  return sequence;
+}
+
+gint
+clutter_mozembed_comms_surface_size (gint size)
+{
+  if (size <= 0)
+    return size;
+
+  return ((size + CME_SURFACE_STEP - 1) / CME_SURFACE_STEP) *
+         CME_SURFACE_STEP;
+}
+
+static gboolean
+clutter_mozembed_comms_wait_cb (GIOChannel   *source,
+                                GIOCondition  condition,
+                                gboolean     *ready)
+{
+  *ready = TRUE;
+  return FALSE;
+}
+
+static gboolean
+clutter_mozembed_comms_wait_timeout_cb (gboolean *timed_out)
+{
+  *timed_out = TRUE;
+  return FALSE;
+}
+
+/* Waits for 'condition' on the channel, or for 'timeout' milliseconds to
+ * pass (-1 for no limit). Returns FALSE if it timed out.
+ */
+static gboolean
+clutter_mozembed_comms_wait (GIOChannel   *channel,
+                             GIOCondition  condition,
+                             gint          timeout)
+{
+  GMainContext *context;
+  GSource *watch, *timer = NULL;
+  gboolean ready = FALSE, timed_out = FALSE;
+
+  /* A watch in a private context works for any kind of channel, including
+   * the shared memory ones, without dispatching anything else.
+   */
+  context = g_main_context_new ();
+
+  watch = g_io_create_watch (channel, condition);
+  g_source_set_callback (watch, (GSourceFunc)clutter_mozembed_comms_wait_cb,
+                         &ready, NULL);
+  g_source_attach (watch, context);
+
+  if (timeout >= 0)
+    {
+      timer = g_timeout_source_new (timeout);
+      g_source_set_callback (timer,
+                             (GSourceFunc)
+                               clutter_mozembed_comms_wait_timeout_cb,
+                             &timed_out, NULL);
+      g_source_attach (timer, context);
+    }
+
+  while (!ready && !timed_out)
+    g_main_context_iteration (context, TRUE);
+
+  g_source_destroy (watch);
+  g_source_unref (watch);
+  if (timer)
+    {
+      g_source_destroy (timer);
+      g_source_unref (timer);
+    }
+  g_main_context_unref (context);
+
+  return ready;
+}
+
+static gboolean
+clutter_mozembed_comms_write (GIOChannel  *channel,
+                              const gchar *data,
+                              gsize        length)
+{
+  while (length)
+    {
+      GIOStatus status;
+      gsize written = 0;
+      GError *error = NULL;
+
+      status = g_io_channel_write_chars (channel,
+                                         data,
+                                         length,
+                                         &written,
+                                         &error);
+
+      if (status == G_IO_STATUS_ERROR)
+        {
+          g_warning ("Error writing to pipe: %s", error->message);
+          g_error_free (error);
+          return FALSE;
+        }
+
+      data += written;
+      length -= written;
+
+      /* The pipe is full, wait for the other side to catch up. If it
+       * doesn't read anything for a while, it's taken to be stuck.
+       */
+      if (length && (status == G_IO_STATUS_AGAIN) &&
+          !clutter_mozembed_comms_wait (channel,
+                                        G_IO_OUT | G_IO_HUP | G_IO_ERR,
+                                        CME_WRITE_TIMEOUT))
+        {
+          g_warning ("Timed out writing to pipe");
+          return FALSE;
+        }
     }
 
-  g_io_channel_flush (channel, NULL);
+  return TRUE;
+}
+
+void
+clutter_mozembed_comms_send_message (GIOChannel    *channel,
+                                     gconstpointer  data,
+                                     gsize          length)
+{
+  if (!channel)
+    {
+      g_warning ("Trying to send command %d with NULL channel",
+                 ((const ClutterMozEmbedHeader *)data)->id);
+      return;
+    }
+
+  clutter_mozembed_comms_write (channel, (const gchar *)data, length);
+}
+
+void
+clutter_mozembed_comms_send_encoded (GIOChannel *channel, GByteArray *data)
+{
+  clutter_mozembed_comms_send_message (channel, data->data, data->len);
+}
+
+void
+clutter_mozembed_comms_sendv (GIOChannel *channel, gint command_id, va_list args)
+{
+  GByteArray *data;
+
+  /*g_debug ("Sending command: %d", command_id);*/
+
+  if (!channel)
+    {
+      g_warning ("Trying to send command %d with NULL channel", command_id);
+      return;
+    }
+
+  data = clutter_mozembed_comms_encode (command_id, args);
+  clutter_mozembed_comms_send_encoded (channel, data);
+  g_byte_array_free (data, TRUE);
 }
 
 void
@@ -132,29 +311,193 @@ clutter_mozembed_comms_send (GIOChannel *channel, gint command_id, ...)
   va_end (args);
 }
 
-gboolean
-clutter_mozembed_comms_receive (GIOChannel *channel, ...)
+GIOStatus
+clutter_mozembed_comms_decoder_feed (ClutterMozEmbedDecoder  *decoder,
+                                     GIOChannel              *channel,
+                                     gboolean                 block,
+                                     GError                 **error)
 {
-  GType type;
-  va_list args;
-
-  gboolean success = TRUE;
+  GIOStatus status;
+  gsize length, read_size;
+  GIOFlags flags = 0;
+  gsize bytes_read = 0;
 
   if (!channel)
     {
       g_warning ("Trying to receive data with NULL channel");
-      return FALSE;
+      return G_IO_STATUS_ERROR;
+    }
+
+  if (!decoder->buffer)
+    decoder->buffer = g_byte_array_sized_new (CME_DECODER_READ_SIZE);
+
+  /* Drop the messages that have already been taken */
+  if (decoder->offset)
+    {
+      g_byte_array_remove_range (decoder->buffer, 0, decoder->offset);
+      decoder->offset = 0;
+    }
+
+  /* If we're part-way through a large message, read the rest in one go */
+  length = decoder->buffer->len;
+  read_size = CME_DECODER_READ_SIZE;
+  if (decoder->have_header)
+    read_size = MAX (read_size, sizeof (ClutterMozEmbedHeader) +
+                                decoder->header.length - length);
+
+  g_byte_array_set_size (decoder->buffer, length + read_size);
+
+  if (block)
+    {
+      flags = g_io_channel_get_flags (channel) & G_IO_FLAG_SET_MASK;
+      g_io_channel_set_flags (channel, flags & ~G_IO_FLAG_NONBLOCK, NULL);
+    }
+
+  status = g_io_channel_read_chars (channel,
+                                    (gchar *)decoder->buffer->data + length,
+                                    read_size,
+                                    &bytes_read,
+                                    error);
+
+  if (block)
+    g_io_channel_set_flags (channel, flags, NULL);
+
+  g_byte_array_set_size (decoder->buffer, length + bytes_read);
+
+  if ((status == G_IO_STATUS_NORMAL) && !bytes_read)
+    return G_IO_STATUS_AGAIN;
+
+  return status;
+}
+
+GIOStatus
+clutter_mozembed_comms_decoder_pop (ClutterMozEmbedDecoder *decoder,
+                                    ClutterMozEmbedMessage *message)
+{
+  gsize available, message_size;
+
+  if (!decoder->buffer)
+    return G_IO_STATUS_AGAIN;
+
+  available = decoder->buffer->len - decoder->offset;
+
+  if (!decoder->have_header)
+    {
+      if (available < sizeof (ClutterMozEmbedHeader))
+        return G_IO_STATUS_AGAIN;
+
+      memcpy (&decoder->header,
+              decoder->buffer->data + decoder->offset,
+              sizeof (ClutterMozEmbedHeader));
+
+      if (decoder->header.length > CME_MAX_MESSAGE_LENGTH)
+        {
+          g_warning ("Message %d is too long (%u bytes)",
+                     decoder->header.id, decoder->header.length);
+          return G_IO_STATUS_ERROR;
+        }
+
+      decoder->have_header = TRUE;
+    }
+
+  message_size = sizeof (ClutterMozEmbedHeader) + decoder->header.length;
+  if (available < message_size)
+    return G_IO_STATUS_AGAIN;
+
+  /* The payload is copied, as the buffer may be refilled (and moved) while
+   * the message is being processed.
+   */
+  message->id = decoder->header.id;
+  message->view = decoder->header.view;
+  message->length = decoder->header.length;
+  message->offset = 0;
+  message->data = message->length ?
+    g_memdup (decoder->buffer->data + decoder->offset +
+              sizeof (ClutterMozEmbedHeader), message->length) : NULL;
+
+  decoder->offset += message_size;
+  decoder->have_header = FALSE;
+
+  /* Once everything has been taken, empty the buffer, and let it go
+   * entirely if a large message made it grow.
+   */
+  if (decoder->offset == decoder->buffer->len)
+    {
+      if (decoder->buffer->len > (4 * CME_DECODER_READ_SIZE))
+        {
+          g_byte_array_free (decoder->buffer, TRUE);
+          decoder->buffer = NULL;
+        }
+      else
+        g_byte_array_set_size (decoder->buffer, 0);
+
+      decoder->offset = 0;
+    }
+
+  return G_IO_STATUS_NORMAL;
+}
+
+void
+clutter_mozembed_comms_decoder_clear (ClutterMozEmbedDecoder *decoder)
+{
+  if (decoder->buffer)
+    {
+      g_byte_array_free (decoder->buffer, TRUE);
+      decoder->buffer = NULL;
     }
 
-  va_start (args, channel);
+  decoder->offset = 0;
+  decoder->have_header = FALSE;
+}
+
+gboolean
+clutter_mozembed_comms_poll (GIOChannel *channel, gint timeout)
+{
+  return clutter_mozembed_comms_wait (channel,
+                                      G_IO_IN | G_IO_PRI | G_IO_HUP | G_IO_ERR,
+                                      timeout);
+}
+
+void
+clutter_mozembed_comms_message_clear (ClutterMozEmbedMessage *message)
+{
+  g_free (message->data);
+  message->data = NULL;
+  message->length = 0;
+  message->offset = 0;
+}
+
+ClutterMozEmbedMessage *
+clutter_mozembed_comms_message_copy (ClutterMozEmbedMessage *message)
+{
+  ClutterMozEmbedMessage *copy = g_memdup (message,
+                                           sizeof (ClutterMozEmbedMessage));
+  copy->data = g_memdup (message->data, message->length);
+  return copy;
+}
+
+void
+clutter_mozembed_comms_message_free (ClutterMozEmbedMessage *message)
+{
+  clutter_mozembed_comms_message_clear (message);
+  g_free (message);
+}
+
+gboolean
+clutter_mozembed_comms_receive (ClutterMozEmbedMessage *message, ...)
+{
+  GType type;
+  va_list args;
+
+  gboolean success = TRUE;
+
+  va_start (args, message);
 
   while ((type = va_arg (args, GType)) != G_TYPE_INVALID)
     {
-      GIOStatus status;
       gsize size;
 
       gchar *buffer = va_arg (args, gpointer);
-      GError *error = NULL;
 
       switch (type)
         {
@@ -194,118 +537,399 @@ clutter_mozembed_comms_receive (GIOChannel *channel, ...)
 
       if (size == -1)
         {
-          do
+          gssize length;
+
+          if (message->offset + sizeof (length) > message->length)
+            {
+              success = FALSE;
+              break;
+            }
+
+          memcpy (&length, message->data + message->offset, sizeof (length));
+          message->offset += sizeof (length);
+
+          if ((length < 0) || (message->offset + length > message->length))
             {
-              status = g_io_channel_read_chars (channel,
-                                                (gchar *)(&size),
-                                                sizeof (size),
-                                                NULL,
-                                                &error);
-            } while (status == G_IO_STATUS_AGAIN);
-
-          if (size)
+              success = FALSE;
+              break;
+            }
+
+          if (length)
             {
-              *((gchar **)buffer) = g_malloc (size);
-
-              do
-                {
-                  status = g_io_channel_read_chars (channel,
-                                                    *((gchar **)buffer),
-                                                    size,
-                                                    NULL,
-                                                    &error);
-                } while (status == G_IO_STATUS_AGAIN);
-            } else
-              *((gchar **)buffer) = NULL;
+              *((gchar **)buffer) = g_malloc (length);
+              memcpy (*((gchar **)buffer),
+                      message->data + message->offset,
+                      length);
+              message->offset += length;
+            }
+          else
+            *((gchar **)buffer) = NULL;
         }
-      else do
+      else
         {
-          status = g_io_channel_read_chars (channel,
-                                            buffer,
-                                            size,
-                                            NULL,
-                                            &error);
-        } while (status == G_IO_STATUS_AGAIN);
-
-      if (status != G_IO_STATUS_NORMAL)
-        {
-          success = FALSE;
-
-          if (error)
+          if (message->offset + size > message->length)
             {
-              g_warning ("Error reading from pipe: %s", error->message);
-              g_error_free (error);
+              success = FALSE;
+              break;
             }
 
-          break;
+          memcpy (buffer, message->data + message->offset, size);
+          message->offset += size;
         }
     }
 
   va_end (args);
 
+  if (!success)
+    g_warning ("Message %d is shorter than expected", message->id);
+
   return success;
 }
 
 gchar *
-clutter_mozembed_comms_receive_string (GIOChannel *channel)
+clutter_mozembed_comms_receive_string (ClutterMozEmbedMessage *message)
 {
   gchar *returnval = NULL;
-  clutter_mozembed_comms_receive (channel, G_TYPE_STRING, &returnval,
+  clutter_mozembed_comms_receive (message, G_TYPE_STRING, &returnval,
                                   G_TYPE_INVALID);
   return returnval;
 }
 
 gboolean
-clutter_mozembed_comms_receive_boolean (GIOChannel *channel)
+clutter_mozembed_comms_receive_boolean (ClutterMozEmbedMessage *message)
 {
   gboolean returnval = FALSE;
-  clutter_mozembed_comms_receive (channel, G_TYPE_BOOLEAN, &returnval,
+  clutter_mozembed_comms_receive (message, G_TYPE_BOOLEAN, &returnval,
                                   G_TYPE_INVALID);
   return returnval;
 }
 
 gint
-clutter_mozembed_comms_receive_int (GIOChannel *channel)
+clutter_mozembed_comms_receive_int (ClutterMozEmbedMessage *message)
 {
   gint returnval = 0;
-  clutter_mozembed_comms_receive (channel, G_TYPE_INT, &returnval,
+  clutter_mozembed_comms_receive (message, G_TYPE_INT, &returnval,
                                   G_TYPE_INVALID);
   return returnval;
 }
 
 guint
-clutter_mozembed_comms_receive_uint (GIOChannel *channel)
+clutter_mozembed_comms_receive_uint (ClutterMozEmbedMessage *message)
 {
   guint returnval = 0;
-  clutter_mozembed_comms_receive (channel, G_TYPE_UINT, &returnval,
+  clutter_mozembed_comms_receive (message, G_TYPE_UINT, &returnval,
                                   G_TYPE_INVALID);
   return returnval;
 }
 
 glong
-clutter_mozembed_comms_receive_long (GIOChannel *channel)
+clutter_mozembed_comms_receive_long (ClutterMozEmbedMessage *message)
 {
   glong returnval = 0;
-  clutter_mozembed_comms_receive (channel, G_TYPE_LONG, &returnval,
+  clutter_mozembed_comms_receive (message, G_TYPE_LONG, &returnval,
                                   G_TYPE_INVALID);
   return returnval;
 }
 
 gulong
-clutter_mozembed_comms_receive_ulong (GIOChannel *channel)
+clutter_mozembed_comms_receive_ulong (ClutterMozEmbedMessage *message)
 {
   gulong returnval = 0;
-  clutter_mozembed_comms_receive (channel, G_TYPE_ULONG, &returnval,
+  clutter_mozembed_comms_receive (message, G_TYPE_ULONG, &returnval,
                                   G_TYPE_INVALID);
   return returnval;
 }
 
 gdouble
-clutter_mozembed_comms_receive_double (GIOChannel *channel)
+clutter_mozembed_comms_receive_double (ClutterMozEmbedMessage *message)
 {
   gdouble returnval = 0.0;
-  clutter_mozembed_comms_receive (channel, G_TYPE_DOUBLE, &returnval,
+  clutter_mozembed_comms_receive (message, G_TYPE_DOUBLE, &returnval,
                                   G_TYPE_INVALID);
   return returnval;
 }
 
+gboolean
+clutter_mozembed_comms_socketpair (gint *local, gint *remote)
+{
+  gint fds[2];
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+    {
+      g_warning ("Error creating socket pair: %s", g_strerror (errno));
+      return FALSE;
+    }
+
+  fcntl (fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl (fds[1], F_SETFD, FD_CLOEXEC);
+
+  *local = fds[0];
+  *remote = fds[1];
+
+  return TRUE;
+}
+
+void
+clutter_mozembed_comms_channels_new (gint         fd,
+                                     GIOChannel **input,
+                                     GIOChannel **output)
+{
+  gint output_fd;
+
+  /* The channels get their own descriptors so that they can be shut down
+   * independently, like the pipes.
+   */
+  fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+  output_fd = dup (fd);
+  fcntl (output_fd, F_SETFD, FD_CLOEXEC);
+
+  *input = g_io_channel_unix_new (fd);
+  g_io_channel_set_encoding (*input, NULL, NULL);
+  g_io_channel_set_buffered (*input, FALSE);
+  g_io_channel_set_close_on_unref (*input, TRUE);
+
+  *output = g_io_channel_unix_new (output_fd);
+  g_io_channel_set_encoding (*output, NULL, NULL);
+  g_io_channel_set_buffered (*output, FALSE);
+  g_io_channel_set_close_on_unref (*output, TRUE);
+}
+
+gboolean
+clutter_mozembed_comms_send_fd (GIOChannel *channel, guint id, gint fd)
+{
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  gchar buffer[CMSG_SPACE (sizeof (gint))];
+
+  memset (&msg, 0, sizeof (msg));
+  memset (buffer, 0, sizeof (buffer));
+
+  iov.iov_base = &id;
+  iov.iov_len = sizeof (id);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = buffer;
+  msg.msg_controllen = sizeof (buffer);
+
+  cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (gint));
+  memcpy (CMSG_DATA (cmsg), &fd, sizeof (gint));
+
+  /* The other end may have gone away, which is reported as an error
+   * rather than with SIGPIPE.
+   */
+  while (sendmsg (g_io_channel_unix_get_fd (channel), &msg,
+                  MSG_NOSIGNAL) == -1)
+    {
+      if (errno == EAGAIN)
+        clutter_mozembed_comms_wait (channel, G_IO_OUT);
+      else if (errno != EINTR)
+        {
+          g_warning ("Error passing descriptor: %s", g_strerror (errno));
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+gint
+clutter_mozembed_comms_receive_fd (GIOChannel *channel, guint *id)
+{
+  gint fd;
+  gssize result;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  gchar buffer[CMSG_SPACE (sizeof (gint))];
+
+  memset (&msg, 0, sizeof (msg));
+
+  iov.iov_base = id;
+  iov.iov_len = sizeof (*id);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = buffer;
+  msg.msg_controllen = sizeof (buffer);
+
+  while ((result = recvmsg (g_io_channel_unix_get_fd (channel), &msg, 0)) ==
+         -1)
+    {
+      if (errno == EAGAIN)
+        clutter_mozembed_comms_wait (channel, G_IO_IN);
+      else if (errno != EINTR)
+        {
+          g_warning ("Error receiving descriptor: %s", g_strerror (errno));
+          return -1;
+        }
+    }
+
+  cmsg = CMSG_FIRSTHDR (&msg);
+  if ((result != sizeof (*id)) || !cmsg ||
+      (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS))
+    {
+      g_warning ("No descriptor received");
+      return -1;
+    }
+
+  memcpy (&fd, CMSG_DATA (cmsg), sizeof (gint));
+  fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+  return fd;
+}
+
+typedef struct
+{
+  GIOChannel  channel;
+  GIOChannel *output;
+  guint       view;
+} ClutterMozEmbedViewChannel;
+
+static GIOStatus
+clutter_mozembed_view_channel_read (GIOChannel  *channel,
+                                    gchar       *buf,
+                                    gsize        count,
+                                    gsize       *bytes_read,
+                                    GError     **error)
+{
+  g_set_error (error, G_IO_CHANNEL_ERROR, G_IO_CHANNEL_ERROR_INVAL,
+               "View channels are write-only");
+  return G_IO_STATUS_ERROR;
+}
+
+static GIOStatus
+clutter_mozembed_view_channel_write (GIOChannel   *channel,
+                                     const gchar  *buf,
+                                     gsize         count,
+                                     gsize        *bytes_written,
+                                     GError      **error)
+{
+  ClutterMozEmbedHeader header;
+  ClutterMozEmbedViewChannel *view_channel =
+    (ClutterMozEmbedViewChannel *)channel;
+
+  *bytes_written = 0;
+
+  /* Messages are always written whole, so each write starts with a header */
+  if (count < sizeof (ClutterMozEmbedHeader))
+    {
+      g_set_error (error, G_IO_CHANNEL_ERROR, G_IO_CHANNEL_ERROR_INVAL,
+                   "Partial message written to view channel");
+      return G_IO_STATUS_ERROR;
+    }
+
+  /* The message may be being sent to other views too, so it's left alone.
+   * Our own copy of the header goes first, followed by the rest of it.
+   */
+  memcpy (&header, buf, sizeof (ClutterMozEmbedHeader));
+  header.view = view_channel->view;
+
+  if (!clutter_mozembed_comms_write (view_channel->output,
+                                     (const gchar *)&header,
+                                     sizeof (ClutterMozEmbedHeader)) ||
+      !clutter_mozembed_comms_write (view_channel->output,
+                                     buf + sizeof (ClutterMozEmbedHeader),
+                                     count - sizeof (ClutterMozEmbedHeader)))
+    {
+      g_set_error (error, G_IO_CHANNEL_ERROR, G_IO_CHANNEL_ERROR_PIPE,
+                   "Error writing to shared connection");
+      return G_IO_STATUS_ERROR;
+    }
+
+  *bytes_written = count;
+
+  return G_IO_STATUS_NORMAL;
+}
+
+static GIOStatus
+clutter_mozembed_view_channel_seek (GIOChannel  *channel,
+                                    gint64       offset,
+                                    GSeekType    type,
+                                    GError     **error)
+{
+  g_set_error (error, G_IO_CHANNEL_ERROR, G_IO_CHANNEL_ERROR_SPIPE,
+               "View channels aren't seekable");
+  return G_IO_STATUS_ERROR;
+}
+
+static GIOStatus
+clutter_mozembed_view_channel_close (GIOChannel  *channel,
+                                     GError     **error)
+{
+  /* The connection belongs to the view that owns it */
+  return G_IO_STATUS_NORMAL;
+}
+
+static GSource *
+clutter_mozembed_view_channel_create_watch (GIOChannel   *channel,
+                                            GIOCondition  condition)
+{
+  ClutterMozEmbedViewChannel *view_channel =
+    (ClutterMozEmbedViewChannel *)channel;
+
+  return g_io_create_watch (view_channel->output, condition);
+}
+
+static void
+clutter_mozembed_view_channel_free (GIOChannel *channel)
+{
+  ClutterMozEmbedViewChannel *view_channel =
+    (ClutterMozEmbedViewChannel *)channel;
+
+  g_io_channel_unref (view_channel->output);
+  g_free (view_channel);
+}
+
+static GIOStatus
+clutter_mozembed_view_channel_set_flags (GIOChannel  *channel,
+                                         GIOFlags     flags,
+                                         GError     **error)
+{
+  return G_IO_STATUS_NORMAL;
+}
+
+static GIOFlags
+clutter_mozembed_view_channel_get_flags (GIOChannel *channel)
+{
+  ClutterMozEmbedViewChannel *view_channel =
+    (ClutterMozEmbedViewChannel *)channel;
+
+  return g_io_channel_get_flags (view_channel->output);
+}
+
+static GIOFuncs view_channel_funcs = {
+  clutter_mozembed_view_channel_read,
+  clutter_mozembed_view_channel_write,
+  clutter_mozembed_view_channel_seek,
+  clutter_mozembed_view_channel_close,
+  clutter_mozembed_view_channel_create_watch,
+  clutter_mozembed_view_channel_free,
+  clutter_mozembed_view_channel_set_flags,
+  clutter_mozembed_view_channel_get_flags
+};
+
+GIOChannel *
+clutter_mozembed_comms_view_channel_new (GIOChannel *output, guint view)
+{
+  ClutterMozEmbedViewChannel *view_channel =
+    g_new0 (ClutterMozEmbedViewChannel, 1);
+  GIOChannel *channel = (GIOChannel *)view_channel;
+
+  g_io_channel_init (channel);
+  channel->funcs = &view_channel_funcs;
+  channel->is_readable = FALSE;
+  channel->is_writeable = TRUE;
+  channel->is_seekable = FALSE;
+
+  view_channel->output = g_io_channel_ref (output);
+  view_channel->view = view;
+
+  g_io_channel_set_encoding (channel, NULL, NULL);
+  g_io_channel_set_buffered (channel, FALSE);
+  g_io_channel_set_close_on_unref (channel, TRUE);
+
+  return channel;
+}
@@ -53,7 +53,10 @@ typedef enum
   CME_FEEDBACK_PLUGIN_ADDED,
   CME_FEEDBACK_PLUGIN_UPDATED,
   CME_FEEDBACK_PLUGIN_VISIBILITY,
-  CME_FEEDBACK_CONTEXT_INFO
+  CME_FEEDBACK_CONTEXT_INFO,
+  CME_FEEDBACK_STATE_CHANGED,
+  CME_FEEDBACK_REPLY,
+  CME_FEEDBACK_SHM_SURFACE
 #ifdef SUPPORT_IM
   ,
   CME_FEEDBACK_IM_RESET,
@@ -99,7 +102,13 @@ typedef enum
   CME_COMMAND_DL_CANCEL,
   CME_COMMAND_SET_SEARCH_STRING,
   CME_COMMAND_FIND_NEXT,
-  CME_COMMAND_FIND_PREV
+  CME_COMMAND_FIND_PREV,
+  CME_COMMAND_SHM_FRAMES,
+  CME_COMMAND_OVERSCAN,
+  CME_COMMAND_RENDER_SCALE,
+  CME_COMMAND_ADD_VIEW,
+  CME_COMMAND_REMOVE_VIEW,
+  CME_COMMAND_REQUEST_TIMEOUT
 #ifdef SUPPORT_IM
   ,
   CME_COMMAND_IM_COMMIT,
@@ -107,18 +116,132 @@ typedef enum
 #endif
 } ClutterMozEmbedCommand;
 
+/* Every message is sent as a header followed by a payload of 'length' bytes,
+ * so that it can be written with a single write and read as a whole. 'view'
+ * says which of the views sharing the connection the message is to or from,
+ * 0 being the view that owns the connection.
+ */
+typedef struct
+{
+  guint32 length;
+  gint32  id;
+  guint32 view;
+} ClutterMozEmbedHeader;
+
+typedef struct
+{
+  gint   id;
+  guint  view;
+  gchar *data;
+  gsize  length;
+  gsize  offset;
+} ClutterMozEmbedMessage;
+
 void clutter_mozembed_comms_sendv (GIOChannel *channel, gint command_id, va_list args);
 void clutter_mozembed_comms_send (GIOChannel *channel, gint command_id, ...);
-gboolean clutter_mozembed_comms_receive (GIOChannel *channel, ...);
+
+/* For sending the same message on several channels, it can be encoded once
+ * and the result sent to each of them.
+ */
+GByteArray *clutter_mozembed_comms_encode (gint command_id, va_list args);
+void clutter_mozembed_comms_send_encoded (GIOChannel *channel, GByteArray *data);
+
+/* Requests that expect a reply start with a sequence number, which the
+ * reply repeats as its first field so that it can be matched up. Waiting
+ * for a reply is bounded by a deadline, in milliseconds, which is this
+ * unless the front-end sets another.
+ */
+#define CME_REQUEST_TIMEOUT (10 * 1000)
+
+guint clutter_mozembed_comms_next_sequence (void);
+GByteArray *clutter_mozembed_comms_encode_request (gint    command_id,
+                                                   guint   sequence,
+                                                   va_list args);
+
+/* Writes give up when the other side makes no room for this long, in
+ * milliseconds, rather than blocking the sender forever.
+ */
+#define CME_WRITE_TIMEOUT (10 * 1000)
+
+/* Waits for the channel to become readable, or for 'timeout' milliseconds
+ * to pass (-1 for no limit). Returns FALSE if it timed out.
+ */
+gboolean clutter_mozembed_comms_poll (GIOChannel *channel, gint timeout);
+
+/* Surface pixmaps are allocated in steps of CME_SURFACE_STEP pixels, so
+ * that resizing within a step can reuse them. Returns the allocated size
+ * for a surface dimension.
+ */
+#define CME_SURFACE_STEP 128
+
+gint clutter_mozembed_comms_surface_size (gint size);
+
+/* Frames can be rendered at a reduced scale, in steps of
+ * CME_RENDER_SCALE_STEP, which is also the smallest scale.
+ */
+#define CME_RENDER_SCALE_STEP 0.125
+
+/* Sends a complete message, header included. Used by the generated stubs in
+ * clutter-mozembed-comms-stubs.h.
+ */
+void clutter_mozembed_comms_send_message (GIOChannel    *channel,
+                                          gconstpointer  data,
+                                          gsize          length);
+
+/* Incoming data is read into a per-channel decoder, which hands out whole
+ * messages once they've arrived. A zero-filled decoder is ready to use.
+ */
+#define CME_DECODER_READ_SIZE  (64 * 1024)
+#define CME_MAX_MESSAGE_LENGTH (64 * 1024 * 1024)
+
+typedef struct
+{
+  GByteArray            *buffer;
+  gsize                  offset;
+  gboolean               have_header;
+  ClutterMozEmbedHeader  header;
+} ClutterMozEmbedDecoder;
+
+GIOStatus clutter_mozembed_comms_decoder_feed (ClutterMozEmbedDecoder  *decoder,
+                                               GIOChannel              *channel,
+                                               gboolean                 block,
+                                               GError                 **error);
+GIOStatus clutter_mozembed_comms_decoder_pop (ClutterMozEmbedDecoder *decoder,
+                                              ClutterMozEmbedMessage *message);
+void clutter_mozembed_comms_decoder_clear (ClutterMozEmbedDecoder *decoder);
+
+void clutter_mozembed_comms_message_clear (ClutterMozEmbedMessage *message);
+ClutterMozEmbedMessage *
+clutter_mozembed_comms_message_copy (ClutterMozEmbedMessage *message);
+void clutter_mozembed_comms_message_free (ClutterMozEmbedMessage *message);
+gboolean clutter_mozembed_comms_receive (ClutterMozEmbedMessage *message, ...);
 
 /* Convenience functions to read out a single variable at a time */
-gchar *clutter_mozembed_comms_receive_string (GIOChannel *channel);
-gboolean clutter_mozembed_comms_receive_boolean (GIOChannel *channel);
-gint clutter_mozembed_comms_receive_int (GIOChannel *channel);
-guint clutter_mozembed_comms_receive_uint (GIOChannel *channel);
-glong clutter_mozembed_comms_receive_long (GIOChannel *channel);
-gulong clutter_mozembed_comms_receive_ulong (GIOChannel *channel);
-gdouble clutter_mozembed_comms_receive_double (GIOChannel *channel);
+gchar *clutter_mozembed_comms_receive_string (ClutterMozEmbedMessage *message);
+gboolean clutter_mozembed_comms_receive_boolean (ClutterMozEmbedMessage *message);
+gint clutter_mozembed_comms_receive_int (ClutterMozEmbedMessage *message);
+guint clutter_mozembed_comms_receive_uint (ClutterMozEmbedMessage *message);
+glong clutter_mozembed_comms_receive_long (ClutterMozEmbedMessage *message);
+gulong clutter_mozembed_comms_receive_ulong (ClutterMozEmbedMessage *message);
+gdouble clutter_mozembed_comms_receive_double (ClutterMozEmbedMessage *message);
+
+/* Connections to the renderer can be sockets, with new connections handed
+ * over a per-process control socket. Each passed descriptor is tagged with
+ * an id, so that the command it belongs to can claim it.
+ */
+gboolean clutter_mozembed_comms_socketpair (gint *local, gint *remote);
+void clutter_mozembed_comms_channels_new (gint         fd,
+                                          GIOChannel **input,
+                                          GIOChannel **output);
+gboolean clutter_mozembed_comms_send_fd (GIOChannel *channel, guint id, gint fd);
+gint clutter_mozembed_comms_receive_fd (GIOChannel *channel, guint *id);
+
+/* Extra views share the connection of the view they were created from. A
+ * view channel is written to like any other output channel, and passes
+ * each message on to the connection with the view's id in its header.
+ */
+GIOChannel *clutter_mozembed_comms_view_channel_new (GIOChannel *output,
+                                                     guint       view);
 
 #endif /* _CLUTTER_MOZEMBED_COMMS */
 
@@ -34,12 +34,27 @@
 #endif
 
 #include "clutter-mozembed.h"
+#include "clutter-mozembed-comms.h"
 #include "clutter-mozembed-download.h"
+#include "clutter-mozembed-state.h"
+#include "clutter-mozembed-tiles.h"
 
 #ifdef SUPPORT_IM
 #include "clutter-imcontext/clutter-immulticontext.h"
 #endif
 
+/* What a window was showing when its renderer went away, that feedback
+ * from the new renderer would otherwise overwrite before it's restored.
+ * The rest of the window's state (size, transparency, chrome and private
+ * mode) is kept anyway, and is just sent again.
+ */
+typedef struct
+{
+  gchar *location;
+  gint   scroll_x;
+  gint   scroll_y;
+} ClutterMozEmbedJournal;
+
 struct _ClutterMozEmbedPrivate
 {
   GFileMonitor    *monitor;
@@ -47,6 +62,42 @@ struct _ClutterMozEmbedPrivate
   GIOChannel      *output;
   guint            watch_id;
   GPid             child_pid;
+  ClutterMozEmbedDecoder decoder;
+
+  /* Control socket of the renderer, for handing over new connections */
+  GIOChannel      *control;
+  /* The renderer's end of our connection, until it's handed over */
+  gint             remote_fd;
+  gboolean         socket;
+
+  /* Renderer process shared with other windows, and the site that decides
+   * which one under the per-site policy.
+   */
+  struct _ClutterMozEmbedProcess *process;
+  gchar           *site;
+
+  /* Views created from a window share its connection, and are fed the
+   * feedback that's tagged with their id. 'carrier' is the actor that owns
+   * the connection a view shares, and 'views' lists the views sharing ours.
+   */
+  gboolean         multiplexed;
+  ClutterMozEmbed *carrier;
+  guint            view_id;
+  guint            last_view_id;
+  GList           *views;
+
+  /* Whether to bring the window back in a new renderer when its renderer
+   * goes away, rather than just reporting the crash, and when that was
+   * last done. 'closed' is set when the window closes itself, so that its
+   * renderer going away isn't taken for a crash.
+   */
+  gboolean         auto_recover;
+  gboolean         closed;
+  GTimer          *recover_timer;
+  ClutterMozEmbedJournal *journal;
+
+  /* Chrome mask the window was opened with, if it was a new window */
+  guint            chrome;
 
   gchar           *input_file;
   gchar           *output_file;
@@ -58,6 +109,22 @@ struct _ClutterMozEmbedPrivate
   gint             width;
   gint             height;
 
+  /* Area of the pixmap in use, which can be smaller than the pixmap */
+  gint             surface_width;
+  gint             surface_height;
+
+  /* Size of the frame in the pixmap, which is smaller than the surface
+   * when the back-end renders at a reduced scale.
+   */
+  gint             frame_width;
+  gint             frame_height;
+
+  /* Part of the surface that's in view, the rest is overscan */
+  gint             viewport_x;
+  gint             viewport_y;
+  gint             viewport_width;
+  gint             viewport_height;
+
   gboolean         read_only;
 
   /* Variables for throttling motion events */
@@ -73,8 +140,9 @@ struct _ClutterMozEmbedPrivate
   gint                pending_scroll_x;
   gint                pending_scroll_y;
 
-  /* Variables for synchronous calls */
-  ClutterMozEmbedFeedback sync_call;
+  /* Requests that are waiting for a reply */
+  GList           *requests;
+  gint             request_timeout;
 
   /* Locally cached properties */
   gchar           *location;
@@ -89,15 +157,49 @@ struct _ClutterMozEmbedPrivate
   gdouble          progress;
   gboolean         can_go_back;
   gboolean         can_go_forward;
+  /* Page the back-end publishes the above simple properties in */
+  ClutterMozEmbedStatePage *state_page;
   GHashTable      *downloads;
   gboolean         scrollbars;
   gboolean         private;
+  gboolean         shm_comms;
+
+  /* Front buffers shared with us by the back-end, by pixmap, and the
+   * texture frames from them are uploaded to.
+   */
+  gboolean         shm_frames;
+  GHashTable      *shm_surfaces;
+  CoglHandle       shm_texture;
 
   /* Offsets for async scrolling mode */
   gint             offset_x;
   gint             offset_y;
   gboolean         async_scroll;
 
+  /* Whether the back-end has been told we're on screen */
+  gboolean         visible;
+  guint            visibility_source;
+
+  /* Scale the back-end renders at, and the smaller one it'll be asked to
+   * once we've been painted at it for long enough.
+   */
+  gdouble          render_scale;
+  gdouble          wanted_scale;
+  guint            render_scale_source;
+
+  /* Largest overscan margin, and the one in use, which follows the
+   * scrolling speed.
+   */
+  gint             overscan;
+  gint             overscan_margin;
+  guint            overscan_source;
+  GTimer          *scroll_timer;
+  gdouble          scroll_speed;
+
+  /* Content seen so far, shown where async scrolling reveals it */
+  ClutterMozEmbedTiles *tiles;
+  gboolean         transparent;
+
   /* Connection timeout variables */
   guint            poll_source;
   guint            poll_timeout;
@@ -142,5 +244,29 @@ void clutter_mozembed_download_set_complete (ClutterMozEmbedDownload *download,
 
 void clutter_mozembed_download_set_cancelled (ClutterMozEmbedDownload *download);
 
+/* Requests to the back-end that are answered with CME_FEEDBACK_REPLY. The
+ * fields after 'timeout' or 'error' are sent after the sequence number, and
+ * the reply is returned positioned after it, to be freed with
+ * clutter_mozembed_comms_message_free(). A negative timeout means the
+ * "request-timeout" property.
+ */
+void clutter_mozembed_request_async (ClutterMozEmbed        *mozembed,
+                                     ClutterMozEmbedCommand  command,
+                                     gint                    timeout,
+                                     GCancellable           *cancellable,
+                                     GAsyncReadyCallback     callback,
+                                     gpointer                user_data,
+                                     ...);
+ClutterMozEmbedMessage *
+clutter_mozembed_request_finish (ClutterMozEmbed  *mozembed,
+                                 GAsyncResult     *result,
+                                 GError          **error);
+ClutterMozEmbedMessage *
+clutter_mozembed_request_sync (ClutterMozEmbed         *mozembed,
+                               ClutterMozEmbedCommand   command,
+                               gint                     timeout,
+                               GError                 **error,
+                               ...);
+
 #endif /* _CLUTTER_MOZEMBED_PRIVATE */
 
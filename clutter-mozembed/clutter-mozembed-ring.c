@@ -0,0 +1,663 @@
+/*
+ * ClutterMozembed; a ClutterActor that embeds Mozilla
+ * Copyright (c) 2009, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Authored by Chris Lord <chris@linux.intel.com>
+ */
+
+#include "clutter-mozembed-ring.h"
+#include "clutter-mozembed-comms.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+/* Size of each ring buffer, this must be a power of two */
+#define RING_SIZE (512 * 1024)
+#define RING_CACHE_LINE 64
+
+#define SEGMENT_HEADER_SIZE 4096
+#define SEGMENT_SIZE (SEGMENT_HEADER_SIZE + (2 * RING_SIZE))
+
+/* The indices only ever increase, and wrap around naturally, so the amount
+ * of used space is always head - tail. The producer and consumer indices
+ * are kept on separate cache lines so the two processes don't fight over
+ * them.
+ */
+typedef struct
+{
+  volatile gint head;
+  gchar         pad1[RING_CACHE_LINE - sizeof (gint)];
+  volatile gint tail;
+  gchar         pad2[RING_CACHE_LINE - sizeof (gint)];
+  volatile gint consumer_waiting;
+  volatile gint producer_waiting;
+  gchar         pad3[RING_CACHE_LINE - (2 * sizeof (gint))];
+} ClutterMozEmbedRingControl;
+
+typedef struct
+{
+  gint      ref_count;
+  gpointer  map;
+  gint      wake_fd;
+  gint      peer_wake_fd;
+  gint      hup_fd;
+} ClutterMozEmbedRingSegment;
+
+typedef struct
+{
+  GIOChannel                  channel;
+  ClutterMozEmbedRingSegment *segment;
+  ClutterMozEmbedRingControl *control;
+  gchar                      *data;
+  gboolean                    nonblock;
+} ClutterMozEmbedRingChannel;
+
+typedef struct
+{
+  GSource       source;
+  GPollFD       wake;
+  GPollFD       hup;
+  GIOChannel   *channel;
+  GIOCondition  condition;
+} ClutterMozEmbedRingWatch;
+
+/* Full barrier; needed when publishing an index and then checking whether
+ * the other side is asleep, which a plain atomic store doesn't guarantee.
+ */
+#define ring_barrier() __sync_synchronize ()
+
+static guint
+ring_used (ClutterMozEmbedRingControl *control)
+{
+  guint used;
+
+  used = (guint)g_atomic_int_get (&control->head) -
+         (guint)g_atomic_int_get (&control->tail);
+  ring_barrier ();
+
+  return used;
+}
+
+static void
+ring_signal (gint fd)
+{
+  eventfd_t value = 1;
+  while ((write (fd, &value, sizeof (value)) < 0) && (errno == EINTR));
+}
+
+static void
+ring_clear (gint fd)
+{
+  eventfd_t value;
+  while ((read (fd, &value, sizeof (value)) < 0) && (errno == EINTR));
+}
+
+/* Block until the other side signals us, or for 'timeout' milliseconds
+ * (-1 for no limit). Returns G_IO_STATUS_EOF if it's gone away and
+ * G_IO_STATUS_AGAIN if it timed out.
+ */
+static GIOStatus
+ring_wait (ClutterMozEmbedRingSegment *segment, gint timeout)
+{
+  gint result;
+  struct pollfd fds[2];
+
+  fds[0].fd = segment->wake_fd;
+  fds[0].events = POLLIN;
+  fds[0].revents = 0;
+  fds[1].fd = segment->hup_fd;
+  fds[1].events = 0;
+  fds[1].revents = 0;
+
+  result = poll (fds, 2, timeout);
+  if (result < 0)
+    return (errno == EINTR) ? G_IO_STATUS_NORMAL : G_IO_STATUS_EOF;
+  if (result == 0)
+    return G_IO_STATUS_AGAIN;
+
+  if (fds[1].revents & (POLLHUP | POLLERR | POLLNVAL))
+    return G_IO_STATUS_EOF;
+
+  if (fds[0].revents & POLLIN)
+    ring_clear (segment->wake_fd);
+
+  return G_IO_STATUS_NORMAL;
+}
+
+/* Returns TRUE if there's data waiting. If there isn't, flag that we're
+ * going to sleep so that the producer knows to wake us up.
+ */
+static gboolean
+ring_consumer_poll (ClutterMozEmbedRingControl *control)
+{
+  if (ring_used (control))
+    return TRUE;
+
+  g_atomic_int_set (&control->consumer_waiting, TRUE);
+  ring_barrier ();
+
+  if (ring_used (control))
+    {
+      g_atomic_int_set (&control->consumer_waiting, FALSE);
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+ring_producer_poll (ClutterMozEmbedRingControl *control)
+{
+  if (ring_used (control) < RING_SIZE)
+    return TRUE;
+
+  g_atomic_int_set (&control->producer_waiting, TRUE);
+  ring_barrier ();
+
+  if (ring_used (control) < RING_SIZE)
+    {
+      g_atomic_int_set (&control->producer_waiting, FALSE);
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+ring_segment_unref (ClutterMozEmbedRingSegment *segment)
+{
+  if (--segment->ref_count)
+    return;
+
+  munmap (segment->map, SEGMENT_SIZE);
+  close (segment->wake_fd);
+  close (segment->peer_wake_fd);
+  close (segment->hup_fd);
+  g_free (segment);
+}
+
+static GIOStatus
+clutter_mozembed_ring_read (GIOChannel  *channel,
+                            gchar       *buf,
+                            gsize        count,
+                            gsize       *bytes_read,
+                            GError     **error)
+{
+  guint tail, used, offset, chunk;
+
+  ClutterMozEmbedRingChannel *ring = (ClutterMozEmbedRingChannel *)channel;
+  ClutterMozEmbedRingControl *control = ring->control;
+
+  *bytes_read = 0;
+
+  while (!ring_consumer_poll (control))
+    {
+      if (ring->nonblock)
+        return G_IO_STATUS_AGAIN;
+
+      if (ring_wait (ring->segment, -1) == G_IO_STATUS_EOF)
+        return G_IO_STATUS_EOF;
+    }
+
+  tail = (guint)g_atomic_int_get (&control->tail);
+  used = ring_used (control);
+
+  count = MIN (count, used);
+  offset = tail & (RING_SIZE - 1);
+  chunk = MIN (count, RING_SIZE - offset);
+
+  memcpy (buf, ring->data + offset, chunk);
+  memcpy (buf + chunk, ring->data, count - chunk);
+
+  /* Release the space, and wake the producer if it's waiting for it */
+  ring_barrier ();
+  g_atomic_int_set (&control->tail, (gint)(tail + count));
+  ring_barrier ();
+
+  if (g_atomic_int_get (&control->producer_waiting))
+    {
+      g_atomic_int_set (&control->producer_waiting, FALSE);
+      ring_signal (ring->segment->peer_wake_fd);
+    }
+
+  *bytes_read = count;
+
+  return G_IO_STATUS_NORMAL;
+}
+
+static GIOStatus
+clutter_mozembed_ring_write (GIOChannel   *channel,
+                             const gchar  *buf,
+                             gsize         count,
+                             gsize        *bytes_written,
+                             GError      **error)
+{
+  ClutterMozEmbedRingChannel *ring = (ClutterMozEmbedRingChannel *)channel;
+  ClutterMozEmbedRingControl *control = ring->control;
+
+  *bytes_written = 0;
+
+  /* Writes always complete, as a message can't be left half-written. If
+   * the ring is full, we wait for the consumer to make some space, but not
+   * forever.
+   */
+  while (count)
+    {
+      guint head, space, offset, chunk, length;
+
+      if (!ring_producer_poll (control))
+        {
+          switch (ring_wait (ring->segment, CME_WRITE_TIMEOUT))
+            {
+            case G_IO_STATUS_EOF :
+              g_set_error (error, G_IO_CHANNEL_ERROR, G_IO_CHANNEL_ERROR_PIPE,
+                           "Shared memory peer hung up");
+              return G_IO_STATUS_ERROR;
+
+            case G_IO_STATUS_AGAIN :
+              g_atomic_int_set (&control->producer_waiting, FALSE);
+              g_set_error (error, G_IO_CHANNEL_ERROR, G_IO_CHANNEL_ERROR_PIPE,
+                           "Timed out waiting for shared memory peer");
+              return G_IO_STATUS_ERROR;
+
+            default :
+              break;
+            }
+          continue;
+        }
+
+      head = (guint)g_atomic_int_get (&control->head);
+      space = RING_SIZE - ring_used (control);
+
+      length = MIN (count, space);
+      offset = head & (RING_SIZE - 1);
+      chunk = MIN (length, RING_SIZE - offset);
+
+      memcpy (ring->data + offset, buf, chunk);
+      memcpy (ring->data, buf + chunk, length - chunk);
+
+      /* Publish the data, and wake the consumer if it's asleep */
+      ring_barrier ();
+      g_atomic_int_set (&control->head, (gint)(head + length));
+      ring_barrier ();
+
+      if (g_atomic_int_get (&control->consumer_waiting))
+        {
+          g_atomic_int_set (&control->consumer_waiting, FALSE);
+          ring_signal (ring->segment->peer_wake_fd);
+        }
+
+      buf += length;
+      count -= length;
+      *bytes_written += length;
+    }
+
+  return G_IO_STATUS_NORMAL;
+}
+
+static GIOStatus
+clutter_mozembed_ring_seek (GIOChannel  *channel,
+                            gint64       offset,
+                            GSeekType    type,
+                            GError     **error)
+{
+  g_set_error (error, G_IO_CHANNEL_ERROR, G_IO_CHANNEL_ERROR_SPIPE,
+               "Shared memory channels aren't seekable");
+  return G_IO_STATUS_ERROR;
+}
+
+static GIOStatus
+clutter_mozembed_ring_close (GIOChannel  *channel,
+                             GError     **error)
+{
+  /* The segment is released when the channel is freed */
+  return G_IO_STATUS_NORMAL;
+}
+
+static void
+clutter_mozembed_ring_free (GIOChannel *channel)
+{
+  ClutterMozEmbedRingChannel *ring = (ClutterMozEmbedRingChannel *)channel;
+
+  ring_segment_unref (ring->segment);
+  g_free (ring);
+}
+
+static GIOStatus
+clutter_mozembed_ring_set_flags (GIOChannel  *channel,
+                                 GIOFlags     flags,
+                                 GError     **error)
+{
+  ClutterMozEmbedRingChannel *ring = (ClutterMozEmbedRingChannel *)channel;
+
+  ring->nonblock = (flags & G_IO_FLAG_NONBLOCK) ? TRUE : FALSE;
+
+  return G_IO_STATUS_NORMAL;
+}
+
+static GIOFlags
+clutter_mozembed_ring_get_flags (GIOChannel *channel)
+{
+  ClutterMozEmbedRingChannel *ring = (ClutterMozEmbedRingChannel *)channel;
+
+  return ring->nonblock ? G_IO_FLAG_NONBLOCK : 0;
+}
+
+static GIOCondition
+ring_watch_get_condition (ClutterMozEmbedRingWatch *watch)
+{
+  GIOCondition condition = 0;
+  ClutterMozEmbedRingChannel *ring =
+    (ClutterMozEmbedRingChannel *)watch->channel;
+
+  if (watch->channel->is_readable)
+    {
+      if (ring_consumer_poll (ring->control))
+        condition |= G_IO_IN;
+    }
+  else if (ring_producer_poll (ring->control))
+    condition |= G_IO_OUT;
+
+  /* Like a pipe, only report the hang-up once everything that was sent
+   * before it has been read.
+   */
+  if ((watch->hup.revents & (G_IO_HUP | G_IO_ERR | G_IO_NVAL)) &&
+      !(condition & G_IO_IN))
+    condition |= G_IO_HUP;
+
+  return condition;
+}
+
+static gboolean
+ring_watch_prepare (GSource *source,
+                    gint    *timeout)
+{
+  ClutterMozEmbedRingWatch *watch = (ClutterMozEmbedRingWatch *)source;
+
+  *timeout = -1;
+
+  return (ring_watch_get_condition (watch) & watch->condition) ? TRUE : FALSE;
+}
+
+static gboolean
+ring_watch_check (GSource *source)
+{
+  ClutterMozEmbedRingWatch *watch = (ClutterMozEmbedRingWatch *)source;
+
+  if (watch->wake.revents & G_IO_IN)
+    {
+      ring_clear (watch->wake.fd);
+      watch->wake.revents = 0;
+    }
+
+  return (ring_watch_get_condition (watch) & watch->condition) ? TRUE : FALSE;
+}
+
+static gboolean
+ring_watch_dispatch (GSource     *source,
+                     GSourceFunc  callback,
+                     gpointer     user_data)
+{
+  GIOFunc func = (GIOFunc)callback;
+  ClutterMozEmbedRingWatch *watch = (ClutterMozEmbedRingWatch *)source;
+
+  if (!func)
+    {
+      g_warning ("Shared memory watch dispatched without callback");
+      return FALSE;
+    }
+
+  return (*func) (watch->channel,
+                  ring_watch_get_condition (watch) & watch->condition,
+                  user_data);
+}
+
+static void
+ring_watch_finalize (GSource *source)
+{
+  ClutterMozEmbedRingWatch *watch = (ClutterMozEmbedRingWatch *)source;
+  g_io_channel_unref (watch->channel);
+}
+
+static GSourceFuncs ring_watch_funcs = {
+  ring_watch_prepare,
+  ring_watch_check,
+  ring_watch_dispatch,
+  ring_watch_finalize
+};
+
+static GSource *
+clutter_mozembed_ring_create_watch (GIOChannel   *channel,
+                                    GIOCondition  condition)
+{
+  GSource *source;
+  ClutterMozEmbedRingWatch *watch;
+  ClutterMozEmbedRingChannel *ring = (ClutterMozEmbedRingChannel *)channel;
+
+  source = g_source_new (&ring_watch_funcs, sizeof (ClutterMozEmbedRingWatch));
+  watch = (ClutterMozEmbedRingWatch *)source;
+
+  watch->channel = g_io_channel_ref (channel);
+  watch->condition = condition;
+
+  watch->wake.fd = ring->segment->wake_fd;
+  watch->wake.events = G_IO_IN;
+  g_source_add_poll (source, &watch->wake);
+
+  watch->hup.fd = ring->segment->hup_fd;
+  watch->hup.events = G_IO_HUP | G_IO_ERR;
+  g_source_add_poll (source, &watch->hup);
+
+  return source;
+}
+
+static GIOFuncs ring_funcs = {
+  clutter_mozembed_ring_read,
+  clutter_mozembed_ring_write,
+  clutter_mozembed_ring_seek,
+  clutter_mozembed_ring_close,
+  clutter_mozembed_ring_create_watch,
+  clutter_mozembed_ring_free,
+  clutter_mozembed_ring_set_flags,
+  clutter_mozembed_ring_get_flags
+};
+
+static GIOChannel *
+clutter_mozembed_ring_channel_new (ClutterMozEmbedRingSegment *segment,
+                                   gint                        index,
+                                   gboolean                    readable)
+{
+  ClutterMozEmbedRingChannel *ring = g_new0 (ClutterMozEmbedRingChannel, 1);
+  GIOChannel *channel = (GIOChannel *)ring;
+
+  g_io_channel_init (channel);
+  channel->funcs = &ring_funcs;
+  channel->is_readable = readable;
+  channel->is_writeable = !readable;
+  channel->is_seekable = FALSE;
+
+  segment->ref_count ++;
+  ring->segment = segment;
+  ring->control = ((ClutterMozEmbedRingControl *)segment->map) + index;
+  ring->data = ((gchar *)segment->map) + SEGMENT_HEADER_SIZE +
+               (index * RING_SIZE);
+  ring->nonblock = TRUE;
+
+  g_io_channel_set_encoding (channel, NULL, NULL);
+  g_io_channel_set_buffered (channel, FALSE);
+  g_io_channel_set_close_on_unref (channel, TRUE);
+
+  return channel;
+}
+
+static void
+set_cloexec (gint fd, gboolean cloexec)
+{
+  fcntl (fd, F_SETFD, cloexec ? FD_CLOEXEC : 0);
+}
+
+gboolean
+clutter_mozembed_ring_create (ClutterMozEmbedRingFds  *local,
+                              ClutterMozEmbedRingFds  *remote,
+                              GError                 **error)
+{
+  static gint rings = 0;
+  gint shm_fd, wake_fds[2], hup_fds[2];
+  gchar *name;
+
+  /* The segment is passed to the other side by descriptor, so it can be
+   * unlinked straight away.
+   */
+  name = g_strdup_printf ("/clutter-mozembed-%d-%d", getpid (), rings++);
+  shm_fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+  if (shm_fd != -1)
+    shm_unlink (name);
+  g_free (name);
+
+  if (shm_fd == -1)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Error creating shared memory: %s", g_strerror (errno));
+      return FALSE;
+    }
+
+  if (ftruncate (shm_fd, SEGMENT_SIZE) == -1)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Error sizing shared memory: %s", g_strerror (errno));
+      close (shm_fd);
+      return FALSE;
+    }
+
+  wake_fds[0] = eventfd (0, EFD_NONBLOCK);
+  wake_fds[1] = eventfd (0, EFD_NONBLOCK);
+  if ((wake_fds[0] == -1) || (wake_fds[1] == -1) ||
+      (socketpair (AF_UNIX, SOCK_STREAM, 0, hup_fds) == -1))
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Error creating descriptors: %s", g_strerror (errno));
+      close (shm_fd);
+      if (wake_fds[0] != -1)
+        close (wake_fds[0]);
+      if (wake_fds[1] != -1)
+        close (wake_fds[1]);
+      return FALSE;
+    }
+
+  set_cloexec (shm_fd, TRUE);
+  set_cloexec (wake_fds[0], TRUE);
+  set_cloexec (wake_fds[1], TRUE);
+  set_cloexec (hup_fds[0], TRUE);
+  set_cloexec (hup_fds[1], TRUE);
+
+  local->shm_fd = remote->shm_fd = shm_fd;
+  local->wake_fd = remote->peer_wake_fd = wake_fds[0];
+  local->peer_wake_fd = remote->wake_fd = wake_fds[1];
+  local->hup_fd = hup_fds[0];
+  remote->hup_fd = hup_fds[1];
+
+  return TRUE;
+}
+
+void
+clutter_mozembed_ring_close_fds (ClutterMozEmbedRingFds *fds)
+{
+  close (fds->shm_fd);
+  close (fds->wake_fd);
+  close (fds->peer_wake_fd);
+  close (fds->hup_fd);
+}
+
+void
+clutter_mozembed_ring_child_setup (gpointer remote_fds)
+{
+  ClutterMozEmbedRingFds *fds = remote_fds;
+
+  /* Called between fork and exec, so the descriptors survive the exec */
+  set_cloexec (fds->shm_fd, FALSE);
+  set_cloexec (fds->wake_fd, FALSE);
+  set_cloexec (fds->peer_wake_fd, FALSE);
+  set_cloexec (fds->hup_fd, FALSE);
+}
+
+gchar *
+clutter_mozembed_ring_fds_to_string (ClutterMozEmbedRingFds *fds)
+{
+  return g_strdup_printf ("%d,%d,%d,%d",
+                          fds->shm_fd,
+                          fds->wake_fd,
+                          fds->peer_wake_fd,
+                          fds->hup_fd);
+}
+
+gboolean
+clutter_mozembed_ring_fds_from_string (const gchar            *string,
+                                       ClutterMozEmbedRingFds *fds)
+{
+  return (sscanf (string, "%d,%d,%d,%d",
+                  &fds->shm_fd,
+                  &fds->wake_fd,
+                  &fds->peer_wake_fd,
+                  &fds->hup_fd) == 4);
+}
+
+gboolean
+clutter_mozembed_ring_open (ClutterMozEmbedRingFds  *fds,
+                            gboolean                 creator,
+                            GIOChannel             **input,
+                            GIOChannel             **output,
+                            GError                 **error)
+{
+  gpointer map;
+  ClutterMozEmbedRingSegment *segment;
+
+  map = mmap (NULL, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+              fds->shm_fd, 0);
+  close (fds->shm_fd);
+
+  if (map == MAP_FAILED)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Error mapping shared memory: %s", g_strerror (errno));
+      close (fds->wake_fd);
+      close (fds->peer_wake_fd);
+      close (fds->hup_fd);
+      return FALSE;
+    }
+
+  set_cloexec (fds->wake_fd, TRUE);
+  set_cloexec (fds->peer_wake_fd, TRUE);
+  set_cloexec (fds->hup_fd, TRUE);
+
+  segment = g_new0 (ClutterMozEmbedRingSegment, 1);
+  segment->map = map;
+  segment->wake_fd = fds->wake_fd;
+  segment->peer_wake_fd = fds->peer_wake_fd;
+  segment->hup_fd = fds->hup_fd;
+
+  /* The creator sends on the first ring and receives on the second */
+  *output = clutter_mozembed_ring_channel_new (segment, creator ? 0 : 1, FALSE);
+  *input = clutter_mozembed_ring_channel_new (segment, creator ? 1 : 0, TRUE);
+
+  return TRUE;
+}
@@ -0,0 +1,60 @@
+/*
+ * ClutterMozembed; a ClutterActor that embeds Mozilla
+ * Copyright (c) 2009, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Authored by Chris Lord <chris@linux.intel.com>
+ */
+
+#ifndef _CLUTTER_MOZEMBED_RING
+#define _CLUTTER_MOZEMBED_RING
+
+#include <glib.h>
+
+/* A shared-memory transport for the comms channels. A single segment holds
+ * a single-producer/single-consumer ring buffer for each direction, and
+ * each side has an eventfd that the other side signals when it's waiting
+ * for data or space. The hup descriptor is one end of a socket pair, so
+ * that each side notices when the other goes away.
+ */
+typedef struct
+{
+  gint shm_fd;
+  gint wake_fd;
+  gint peer_wake_fd;
+  gint hup_fd;
+} ClutterMozEmbedRingFds;
+
+gboolean clutter_mozembed_ring_create (ClutterMozEmbedRingFds  *local,
+                                       ClutterMozEmbedRingFds  *remote,
+                                       GError                 **error);
+void clutter_mozembed_ring_close_fds (ClutterMozEmbedRingFds *fds);
+
+/* For passing the remote descriptors across to a spawned process */
+void clutter_mozembed_ring_child_setup (gpointer remote_fds);
+gchar *clutter_mozembed_ring_fds_to_string (ClutterMozEmbedRingFds *fds);
+gboolean clutter_mozembed_ring_fds_from_string (const gchar            *string,
+                                                ClutterMozEmbedRingFds *fds);
+
+/* Takes ownership of the descriptors. 'creator' should be TRUE on the side
+ * that called clutter_mozembed_ring_create().
+ */
+gboolean clutter_mozembed_ring_open (ClutterMozEmbedRingFds  *fds,
+                                     gboolean                 creator,
+                                     GIOChannel             **input,
+                                     GIOChannel             **output,
+                                     GError                 **error);
+
+#endif /* _CLUTTER_MOZEMBED_RING */
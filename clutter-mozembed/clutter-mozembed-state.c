@@ -0,0 +1,161 @@
+/*
+ * ClutterMozembed; a ClutterActor that embeds Mozilla
+ * Copyright (c) 2009, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Authored by Chris Lord <chris@linux.intel.com>
+ */
+
+#include "clutter-mozembed-state.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* The sequence number is odd while the page is being written */
+struct _ClutterMozEmbedStatePage
+{
+  volatile guint32     sequence;
+  guint32              pad;
+  ClutterMozEmbedState state;
+};
+
+#define state_barrier() __sync_synchronize ()
+
+/* Times a reader looks for a consistent copy of the page before giving up.
+ * A write only takes a moment, so running out of tries means the back-end
+ * stopped part-way through one.
+ */
+#define CME_STATE_READ_TRIES 1000
+
+static ClutterMozEmbedStatePage *
+clutter_mozembed_state_map (gint fd, gboolean writable, GError **error)
+{
+  gpointer map = mmap (NULL, sizeof (ClutterMozEmbedStatePage),
+                       writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                       MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (map == MAP_FAILED)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Error mapping shared memory: %s", g_strerror (errno));
+      return NULL;
+    }
+
+  return (ClutterMozEmbedStatePage *)map;
+}
+
+ClutterMozEmbedStatePage *
+clutter_mozembed_state_create (gchar **name, GError **error)
+{
+  static gint pages = 0;
+  gint fd;
+
+  *name = g_strdup_printf ("/clutter-mozembed-state-%d-%d",
+                           getpid (), pages++);
+  fd = shm_open (*name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+  if (fd == -1)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Error creating shared memory: %s", g_strerror (errno));
+      g_free (*name);
+      *name = NULL;
+      return NULL;
+    }
+
+  /* A new object is zero-filled, so the page starts out consistent */
+  if (ftruncate (fd, sizeof (ClutterMozEmbedStatePage)) == -1)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Error sizing shared memory: %s", g_strerror (errno));
+      close (fd);
+      shm_unlink (*name);
+      g_free (*name);
+      *name = NULL;
+      return NULL;
+    }
+
+  fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+  return clutter_mozembed_state_map (fd, TRUE, error);
+}
+
+void
+clutter_mozembed_state_write (ClutterMozEmbedStatePage   *page,
+                              const ClutterMozEmbedState *state)
+{
+  page->sequence ++;
+  state_barrier ();
+  memcpy (&page->state, state, sizeof (ClutterMozEmbedState));
+  state_barrier ();
+  page->sequence ++;
+}
+
+ClutterMozEmbedStatePage *
+clutter_mozembed_state_open (const gchar *name, GError **error)
+{
+  gint fd = shm_open (name, O_RDONLY, 0);
+
+  if (fd == -1)
+    {
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                   "Error opening shared memory: %s", g_strerror (errno));
+      return NULL;
+    }
+
+  /* Nothing else opens the page by name, so it's removed straight away.
+   * It goes once both sides have unmapped it, even if the back-end dies.
+   */
+  shm_unlink (name);
+
+  fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+  return clutter_mozembed_state_map (fd, FALSE, error);
+}
+
+gboolean
+clutter_mozembed_state_read (ClutterMozEmbedStatePage *page,
+                             ClutterMozEmbedState     *state)
+{
+  gint tries;
+  guint32 sequence;
+
+  for (tries = 0; tries < CME_STATE_READ_TRIES; tries++)
+    {
+      if ((sequence = page->sequence) & 1)
+        continue;
+
+      state_barrier ();
+      memcpy (state, &page->state, sizeof (ClutterMozEmbedState));
+      state_barrier ();
+
+      if (sequence == page->sequence)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+void
+clutter_mozembed_state_close (ClutterMozEmbedStatePage *page,
+                              const gchar              *name)
+{
+  munmap (page, sizeof (ClutterMozEmbedStatePage));
+  if (name)
+    shm_unlink (name);
+}
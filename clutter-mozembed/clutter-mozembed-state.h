@@ -0,0 +1,62 @@
+/*
+ * ClutterMozembed; a ClutterActor that embeds Mozilla
+ * Copyright (c) 2009, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Authored by Chris Lord <chris@linux.intel.com>
+ */
+
+#ifndef _CLUTTER_MOZEMBED_STATE
+#define _CLUTTER_MOZEMBED_STATE
+
+#include <glib.h>
+
+/* Page properties that the back-end publishes in shared memory, so that
+ * views can read them whenever they like. Only the back-end writes to the
+ * page; readers retry if they see the sequence number change under them.
+ */
+typedef struct
+{
+  gdouble progress;
+  guint32 security;
+  gint32  can_go_back;
+  gint32  can_go_forward;
+} ClutterMozEmbedState;
+
+typedef struct _ClutterMozEmbedStatePage ClutterMozEmbedStatePage;
+
+/* Back-end side. The returned name is passed to a single view with
+ * CME_FEEDBACK_SHM_NAME, as opening it removes the name.
+ */
+ClutterMozEmbedStatePage *clutter_mozembed_state_create (gchar  **name,
+                                                         GError **error);
+void clutter_mozembed_state_write (ClutterMozEmbedStatePage   *page,
+                                   const ClutterMozEmbedState *state);
+
+/* View side. Reading returns FALSE, leaving 'state' undefined, if no
+ * consistent copy of the page could be had.
+ */
+ClutterMozEmbedStatePage *clutter_mozembed_state_open (const gchar  *name,
+                                                       GError      **error);
+gboolean clutter_mozembed_state_read (ClutterMozEmbedStatePage *page,
+                                      ClutterMozEmbedState     *state);
+
+/* Unmaps the page. The back-end passes the name, to remove it as well if
+ * the view never opened it.
+ */
+void clutter_mozembed_state_close (ClutterMozEmbedStatePage *page,
+                                   const gchar              *name);
+
+#endif /* _CLUTTER_MOZEMBED_STATE */
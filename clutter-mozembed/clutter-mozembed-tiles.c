@@ -0,0 +1,256 @@
+/*
+ * ClutterMozembed; a ClutterActor that embeds Mozilla
+ * Copyright (c) 2009, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Authored by Chris Lord <chris@linux.intel.com>
+ */
+
+
+#include "clutter-mozembed-tiles.h"
+
+/* Tiles are looked up by column and row, which document coordinates are
+ * never large enough to overflow.
+ */
+#define TILE_KEY(column, row) \
+  GUINT_TO_POINTER (((guint)(column) << 16) | ((guint)(row) & 0xffff))
+
+typedef struct
+{
+  gint        column;
+  gint        row;
+  CoglHandle  texture;
+  CoglHandle  offscreen;
+  GList      *link;
+} ClutterMozEmbedTile;
+
+struct _ClutterMozEmbedTiles
+{
+  guint       max_tiles;
+  GHashTable *tiles;
+  GQueue      lru;       /* Most recently used first */
+  CoglHandle  material;
+
+  /* Document area that changed since the last flush */
+  gboolean    damaged;
+  gint        damage_x1;
+  gint        damage_y1;
+  gint        damage_x2;
+  gint        damage_y2;
+};
+
+static void
+tile_free (ClutterMozEmbedTile *tile)
+{
+  cogl_handle_unref (tile->offscreen);
+  cogl_handle_unref (tile->texture);
+  g_slice_free (ClutterMozEmbedTile, tile);
+}
+
+ClutterMozEmbedTiles *
+clutter_mozembed_tiles_new (guint max_tiles)
+{
+  ClutterMozEmbedTiles *tiles;
+
+  if (!cogl_features_available (COGL_FEATURE_OFFSCREEN))
+    return NULL;
+
+  tiles = g_slice_new0 (ClutterMozEmbedTiles);
+  tiles->max_tiles = max_tiles;
+  tiles->tiles = g_hash_table_new_full (NULL, NULL, NULL,
+                                        (GDestroyNotify)tile_free);
+  g_queue_init (&tiles->lru);
+  tiles->material = cogl_material_new ();
+
+  return tiles;
+}
+
+void
+clutter_mozembed_tiles_free (ClutterMozEmbedTiles *tiles)
+{
+  clutter_mozembed_tiles_clear (tiles);
+  g_hash_table_destroy (tiles->tiles);
+  cogl_handle_unref (tiles->material);
+  g_slice_free (ClutterMozEmbedTiles, tiles);
+}
+
+void
+clutter_mozembed_tiles_clear (ClutterMozEmbedTiles *tiles)
+{
+  g_queue_clear (&tiles->lru);
+  g_hash_table_remove_all (tiles->tiles);
+  tiles->damaged = FALSE;
+}
+
+void
+clutter_mozembed_tiles_damage (ClutterMozEmbedTiles *tiles,
+                               gint                  x,
+                               gint                  y,
+                               gint                  width,
+                               gint                  height)
+{
+  if ((width <= 0) || (height <= 0))
+    return;
+
+  if (!tiles->damaged)
+    {
+      tiles->damage_x1 = x;
+      tiles->damage_y1 = y;
+      tiles->damage_x2 = x + width;
+      tiles->damage_y2 = y + height;
+      tiles->damaged = TRUE;
+    }
+  else
+    {
+      tiles->damage_x1 = MIN (tiles->damage_x1, x);
+      tiles->damage_y1 = MIN (tiles->damage_y1, y);
+      tiles->damage_x2 = MAX (tiles->damage_x2, x + width);
+      tiles->damage_y2 = MAX (tiles->damage_y2, y + height);
+    }
+}
+
+/* Finds or makes the tile at a column and row, and marks it as used */
+static ClutterMozEmbedTile *
+get_tile (ClutterMozEmbedTiles *tiles, gint column, gint row)
+{
+  CoglColor transparent;
+  ClutterMozEmbedTile *tile =
+    g_hash_table_lookup (tiles->tiles, TILE_KEY (column, row));
+
+  if (tile)
+    {
+      g_queue_unlink (&tiles->lru, tile->link);
+      g_queue_push_head_link (&tiles->lru, tile->link);
+      return tile;
+    }
+
+  if (g_hash_table_size (tiles->tiles) >= tiles->max_tiles)
+    {
+      ClutterMozEmbedTile *old = g_queue_pop_tail (&tiles->lru);
+      g_hash_table_remove (tiles->tiles, TILE_KEY (old->column, old->row));
+    }
+
+  tile = g_slice_new (ClutterMozEmbedTile);
+  tile->column = column;
+  tile->row = row;
+  tile->texture = cogl_texture_new_with_size (CME_TILE_SIZE,
+                                              CME_TILE_SIZE,
+                                              COGL_TEXTURE_NO_SLICING,
+                                              COGL_PIXEL_FORMAT_RGBA_8888);
+  tile->offscreen = cogl_offscreen_new_to_texture (tile->texture);
+
+  /* Parts that haven't been seen yet stay blank */
+  cogl_color_set_from_4ub (&transparent, 0, 0, 0, 0);
+  cogl_set_draw_buffer (COGL_OFFSCREEN_BUFFER, tile->offscreen);
+  cogl_clear (&transparent, COGL_BUFFER_BIT_COLOR);
+
+  g_queue_push_head (&tiles->lru, tile);
+  tile->link = tiles->lru.head;
+  g_hash_table_insert (tiles->tiles, TILE_KEY (column, row), tile);
+
+  return tile;
+}
+
+void
+clutter_mozembed_tiles_flush (ClutterMozEmbedTiles *tiles,
+                              CoglHandle            texture,
+                              gint                  x,
+                              gint                  y,
+                              gint                  width,
+                              gint                  height)
+{
+  gint x1, y1, x2, y2, column, row;
+  gfloat tex_width, tex_height;
+
+  if (!tiles->damaged)
+    return;
+  tiles->damaged = FALSE;
+
+  /* Only what the frame shows can be copied */
+  x1 = MAX (tiles->damage_x1, x);
+  y1 = MAX (tiles->damage_y1, y);
+  x2 = MIN (tiles->damage_x2, x + width);
+  y2 = MIN (tiles->damage_y2, y + height);
+  if ((x1 >= x2) || (y1 >= y2) || (x1 < 0) || (y1 < 0))
+    return;
+
+  tex_width = cogl_texture_get_width (texture);
+  tex_height = cogl_texture_get_height (texture);
+
+  cogl_push_draw_buffer ();
+  for (row = y1 / CME_TILE_SIZE; row <= (y2 - 1) / CME_TILE_SIZE; row++)
+    for (column = x1 / CME_TILE_SIZE;
+         column <= (x2 - 1) / CME_TILE_SIZE; column++)
+      {
+        ClutterMozEmbedTile *tile = get_tile (tiles, column, row);
+        gint tile_x = column * CME_TILE_SIZE;
+        gint tile_y = row * CME_TILE_SIZE;
+        gint cx1 = MAX (x1, tile_x);
+        gint cy1 = MAX (y1, tile_y);
+        gint cx2 = MIN (x2, tile_x + CME_TILE_SIZE);
+        gint cy2 = MIN (y2, tile_y + CME_TILE_SIZE);
+
+        cogl_set_draw_buffer (COGL_OFFSCREEN_BUFFER, tile->offscreen);
+        cogl_set_source_texture (texture);
+        cogl_rectangle_with_texture_coords (cx1 - tile_x, cy1 - tile_y,
+                                            cx2 - tile_x, cy2 - tile_y,
+                                            (cx1 - x) / tex_width,
+                                            (cy1 - y) / tex_height,
+                                            (cx2 - x) / tex_width,
+                                            (cy2 - y) / tex_height);
+      }
+  cogl_pop_draw_buffer ();
+}
+
+void
+clutter_mozembed_tiles_paint (ClutterMozEmbedTiles *tiles,
+                              gint                  x,
+                              gint                  y,
+                              gint                  width,
+                              gint                  height,
+                              guint8                opacity)
+{
+  gint column, row;
+  gint x2 = x + width;
+  gint y2 = y + height;
+
+  x = MAX (x, 0);
+  y = MAX (y, 0);
+  if ((x >= x2) || (y >= y2))
+    return;
+
+  cogl_material_set_color4ub (tiles->material,
+                              opacity, opacity, opacity, opacity);
+
+  for (row = y / CME_TILE_SIZE; row <= (y2 - 1) / CME_TILE_SIZE; row++)
+    for (column = x / CME_TILE_SIZE;
+         column <= (x2 - 1) / CME_TILE_SIZE; column++)
+      {
+        gint tile_x, tile_y;
+        ClutterMozEmbedTile *tile =
+          g_hash_table_lookup (tiles->tiles, TILE_KEY (column, row));
+
+        if (!tile)
+          continue;
+
+        tile_x = column * CME_TILE_SIZE;
+        tile_y = row * CME_TILE_SIZE;
+
+        cogl_material_set_layer (tiles->material, 0, tile->texture);
+        cogl_set_source (tiles->material);
+        cogl_rectangle (tile_x, tile_y,
+                        tile_x + CME_TILE_SIZE, tile_y + CME_TILE_SIZE);
+      }
+}
@@ -0,0 +1,70 @@
+/*
+ * ClutterMozembed; a ClutterActor that embeds Mozilla
+ * Copyright (c) 2009, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Authored by Chris Lord <chris@linux.intel.com>
+ */
+
+
+#ifndef _CLUTTER_MOZEMBED_TILES
+#define _CLUTTER_MOZEMBED_TILES
+
+#include <glib.h>
+#include <cogl/cogl.h>
+
+#define CME_TILE_SIZE 256
+
+/* A cache of what has been shown of the document, in fixed-size tiles at
+ * document coordinates. Views paint it under the latest frame so that
+ * asynchronous scrolling doesn't reveal blank areas that have been seen
+ * before. The least recently used tiles are dropped past 'max_tiles'.
+ */
+typedef struct _ClutterMozEmbedTiles ClutterMozEmbedTiles;
+
+/* Returns NULL if offscreen drawing isn't supported */
+ClutterMozEmbedTiles *clutter_mozembed_tiles_new (guint max_tiles);
+void clutter_mozembed_tiles_free (ClutterMozEmbedTiles *tiles);
+void clutter_mozembed_tiles_clear (ClutterMozEmbedTiles *tiles);
+
+/* Marks an area of the document as having changed in the frame */
+void clutter_mozembed_tiles_damage (ClutterMozEmbedTiles *tiles,
+                                    gint                  x,
+                                    gint                  y,
+                                    gint                  width,
+                                    gint                  height);
+
+/* Copies the damaged area of a frame into the tiles. The frame is the
+ * 'width' x 'height' area at the top-left of 'texture', showing the
+ * document from (x, y). Must be called while painting.
+ */
+void clutter_mozembed_tiles_flush (ClutterMozEmbedTiles *tiles,
+                                   CoglHandle            texture,
+                                   gint                  x,
+                                   gint                  y,
+                                   gint                  width,
+                                   gint                  height);
+
+/* Paints the tiles that cover an area of the document, in document
+ * coordinates.
+ */
+void clutter_mozembed_tiles_paint (ClutterMozEmbedTiles *tiles,
+                                   gint                  x,
+                                   gint                  y,
+                                   gint                  width,
+                                   gint                  height,
+                                   guint8                opacity);
+
+#endif /* _CLUTTER_MOZEMBED_TILES */
@@ -21,6 +21,8 @@
 
 #include "clutter-mozembed.h"
 #include "clutter-mozembed-comms.h"
+#include "clutter-mozembed-comms-stubs.h"
+#include "clutter-mozembed-ring.h"
 #include "clutter-mozembed-private.h"
 #include "clutter-mozembed-marshal.h"
 #include <moz-headless.h>
@@ -30,11 +32,83 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <fcntl.h>
+#include <errno.h>
 
 
 G_DEFINE_TYPE (ClutterMozEmbed, clutter_mozembed, CLUTTER_GLX_TYPE_TEXTURE_PIXMAP)
 
+/* Number of tiles kept for async scrolling, 16MB worth */
+#define CME_TILE_CACHE_SIZE 64
+
+/* Overscan margins are rounded to this, so the surface changes size in
+ * the same steps as its pixmaps.
+ */
+#define CME_OVERSCAN_STEP (CME_SURFACE_STEP / 2)
+
+/* Milliseconds the scale we're painted at has to stay down for before the
+ * back-end is asked to render at it.
+ */
+#define CME_RENDER_SCALE_DELAY 500
+
+/* Seconds a recovered window has to stay up for before it's recovered
+ * again, so a page that crashes the renderer straight away isn't reloaded
+ * forever.
+ */
+#define CME_RECOVER_INTERVAL 10.0
+
+/* A renderer that was spawned ahead of time and is waiting for its first
+ * window, which it's passed the connection to over its control socket.
+ */
+typedef struct
+{
+  GPid        pid;
+  GIOChannel *control;
+} ClutterMozEmbedRenderer;
+
+/* There's a pool of waiting renderers each for normal and private
+ * browsing, which is kept topped up to 'size' renderers.
+ */
+typedef struct
+{
+  GQueue renderers;
+  guint  size;
+  guint  hits;
+  guint  misses;
+} ClutterMozEmbedPool;
+
+static ClutterMozEmbedPool pools[2];
+static guint pool_source = 0;
+
+/* Renderer that's asked to fork new renderers, when that's enabled */
+static gboolean use_zygote = FALSE;
+static GIOChannel *zygote = NULL;
+
+/* Counts windows and renderers, to give their pipes unique names */
+static gint spawned_windows = 0;
+
+/* A renderer shared by several windows. Windows join it by having one of
+ * its other windows ask it to open a new window on a connection that's
+ * passed over its control socket.
+ */
+typedef struct _ClutterMozEmbedProcess
+{
+  GIOChannel *control;
+  gboolean    private;
+  gchar      *site;
+  GList      *windows;
+} ClutterMozEmbedProcess;
+
+static ClutterMozEmbedProcessPolicy process_policy =
+  CLUTTER_MOZEMBED_PROCESS_PER_WINDOW;
+static guint max_processes = 1;
+static GList *processes = NULL;
+
+/* Ids that connections are passed over control sockets with */
+static guint connection_id = 0;
+
 #define MOZEMBED_PRIVATE(o) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((o), CLUTTER_TYPE_MOZEMBED, ClutterMozEmbedPrivate))
 
@@ -67,7 +141,15 @@ enum
   PROP_COMP_PATHS,
   PROP_CHROME_PATHS,
   PROP_PRIVATE,
-  PROP_USER_CHROME_PATH
+  PROP_USER_CHROME_PATH,
+  PROP_SHM_COMMS,
+  PROP_SOCKET,
+  PROP_SHM_FRAMES,
+  PROP_OVERSCAN,
+  PROP_SITE,
+  PROP_MULTIPLEXED,
+  PROP_AUTO_RECOVER,
+  PROP_REQUEST_TIMEOUT
 };
 
 enum
@@ -84,12 +166,20 @@ enum
   SHOW_TOOLTIP,
   HIDE_TOOLTIP,
   CONTEXT_INFO,
+  RECOVERED,
   LAST_SIGNAL
 };
 
 static guint signals[LAST_SIGNAL] = { 0, };
 
 static void clutter_mozembed_open_pipes (ClutterMozEmbed *self);
+static void clutter_mozembed_leave_process (ClutterMozEmbed *self);
+static void clutter_mozembed_shutdown_channel (GIOChannel **channel);
+static gboolean clutter_mozembed_recover (ClutterMozEmbed *self);
+static guint clutter_mozembed_hand_over (ClutterMozEmbed  *self,
+                                         ClutterMozEmbed  *mozembed,
+                                         gchar           **input,
+                                         gchar           **output);
 static MozHeadlessModifier
   clutter_mozembed_get_modifier (ClutterModifierType modifiers);
 
@@ -140,11 +230,10 @@ clutter_mozembed_imcontext_preedit_changed_cb (ClutterIMContext *context,
 static void
 clamp_offset (ClutterMozEmbed *self)
 {
-  gint width, height;
-
   ClutterMozEmbedPrivate *priv = self->priv;
+  gint width = priv->viewport_width;
+  gint height = priv->viewport_height;
 
-  clutter_texture_get_base_size (CLUTTER_TEXTURE (self), &width, &height);
   priv->offset_x = CLAMP (priv->offset_x,
                           -(priv->doc_width - width - priv->scroll_x),
                           priv->scroll_x);
@@ -153,31 +242,133 @@ clamp_offset (ClutterMozEmbed *self)
                           priv->scroll_y);
 }
 
+/* A front buffer the back-end shares with us, see "shm-frames" */
+typedef struct
+{
+  guchar *data;
+  gint    width;
+  gint    height;
+  gint    stride;
+  gint    depth;
+  guint   generation;
+} ClutterMozEmbedShmSurface;
+
+static void
+shm_surface_free (ClutterMozEmbedShmSurface *surface)
+{
+  shmdt (surface->data);
+  g_slice_free (ClutterMozEmbedShmSurface, surface);
+}
+
+static gboolean
+shm_surface_replaced_cb (gpointer                   key,
+                         ClutterMozEmbedShmSurface *surface,
+                         ClutterMozEmbedShmSurface *current)
+{
+  return surface->generation != current->generation;
+}
+
+/* Uploads the damaged area of a shared memory front buffer. All the front
+ * buffers hold the whole frame, so unlike with pixmaps, a new one only
+ * needs uploading in full if the texture has to be replaced.
+ */
+static void
+update_from_shm (ClutterMozEmbed           *self,
+                 ClutterMozEmbedShmSurface *surface,
+                 gint                       x,
+                 gint                       y,
+                 gint                       width,
+                 gint                       height)
+{
+  CoglPixelFormat format, internal_format;
+  ClutterMozEmbedPrivate *priv = self->priv;
+  Display *xdpy = clutter_x11_get_default_display ();
+
+  /* 32 bits per pixel, in the X server's byte order */
+  if (ImageByteOrder (xdpy) == LSBFirst)
+    format = (surface->depth == 32) ?
+      COGL_PIXEL_FORMAT_BGRA_8888_PRE : COGL_PIXEL_FORMAT_BGRA_8888;
+  else
+    format = (surface->depth == 32) ?
+      COGL_PIXEL_FORMAT_ARGB_8888_PRE : COGL_PIXEL_FORMAT_ARGB_8888;
+  internal_format = (surface->depth == 32) ? format : COGL_PIXEL_FORMAT_RGB_888;
+
+  if (!priv->shm_texture ||
+      (priv->shm_texture !=
+       clutter_texture_get_cogl_texture (CLUTTER_TEXTURE (self))) ||
+      (cogl_texture_get_width (priv->shm_texture) != surface->width) ||
+      (cogl_texture_get_height (priv->shm_texture) != surface->height) ||
+      (cogl_texture_get_format (priv->shm_texture) != internal_format))
+    {
+      CoglHandle texture = cogl_texture_new_with_size (surface->width,
+                                                       surface->height,
+                                                       COGL_TEXTURE_NONE,
+                                                       internal_format);
+      clutter_texture_set_cogl_texture (CLUTTER_TEXTURE (self), texture);
+      cogl_handle_unref (texture);
+      priv->shm_texture = texture;
+
+      x = y = 0;
+      width = surface->width;
+      height = surface->height;
+    }
+
+  if ((width > 0) && (height > 0))
+    {
+      cogl_texture_set_region (priv->shm_texture,
+                               x, y, x, y, width, height,
+                               surface->width, surface->height,
+                               format, surface->stride, surface->data);
+      clutter_actor_queue_redraw (CLUTTER_ACTOR (self));
+    }
+
+  /* Buffers from before a resize won't be used again */
+  g_hash_table_foreach_remove (priv->shm_surfaces,
+                               (GHRFunc)shm_surface_replaced_cb,
+                               surface);
+}
+
+/* Refreshes the damaged area of the texture. A new drawable is always
+ * picked up as a whole.
+ */
 static void
 update (ClutterMozEmbed *self,
-        Drawable         drawable)
+        Drawable         drawable,
+        gint             x,
+        gint             y,
+        gint             width,
+        gint             height)
 {
+  ClutterMozEmbedShmSurface *surface;
   ClutterMozEmbedPrivate *priv = self->priv;
 
-  if (priv->drawable != drawable)
+  surface = g_hash_table_lookup (priv->shm_surfaces,
+                                 GUINT_TO_POINTER (drawable));
+  if (surface)
+    {
+      update_from_shm (self, surface, x, y, width, height);
+      priv->drawable = drawable;
+    }
+  else if (priv->drawable != drawable)
     {
       clutter_x11_texture_pixmap_set_pixmap (CLUTTER_X11_TEXTURE_PIXMAP (self),
                                              (Pixmap)drawable);
       priv->drawable = drawable;
     }
+  else if ((width > 0) && (height > 0))
+    clutter_x11_texture_pixmap_update_area (CLUTTER_X11_TEXTURE_PIXMAP (self),
+                                            x, y, width, height);
 }
 
 static void
 send_motion_event (ClutterMozEmbed *self)
 {
   ClutterMozEmbedPrivate *priv = self->priv;
-  clutter_mozembed_comms_send (priv->output,
-                               CME_COMMAND_MOTION,
-                               G_TYPE_INT, priv->motion_x,
-                               G_TYPE_INT, priv->motion_y,
-                               G_TYPE_UINT, clutter_mozembed_get_modifier (
-                                              priv->motion_m),
-                               G_TYPE_INVALID);
+  clutter_mozembed_command_motion_send (priv->output,
+                                        priv->motion_x,
+                                        priv->motion_y,
+                                        clutter_mozembed_get_modifier (
+                                          priv->motion_m));
   priv->pending_motion = FALSE;
 }
 
@@ -185,11 +376,9 @@ static void
 send_scroll_event (ClutterMozEmbed *self)
 {
   ClutterMozEmbedPrivate *priv = self->priv;
-  clutter_mozembed_comms_send (priv->output,
-                               CME_COMMAND_SCROLL_TO,
-                               G_TYPE_INT, priv->pending_scroll_x,
-                               G_TYPE_INT, priv->pending_scroll_y,
-                               G_TYPE_INVALID);
+  clutter_mozembed_command_scroll_to_send (priv->output,
+                                           priv->pending_scroll_x,
+                                           priv->pending_scroll_y);
 }
 
 static void
@@ -212,22 +401,216 @@ static gboolean
 clutter_mozembed_repaint_func (ClutterMozEmbed *self)
 {
   /* Send the paint acknowledgement */
-  clutter_mozembed_comms_send (self->priv->output,
-                               CME_COMMAND_UPDATE_ACK,
-                               G_TYPE_INVALID);
+  clutter_mozembed_command_update_ack_send (self->priv->output);
   self->priv->repaint_id = 0;
   return FALSE;
 }
 
+/* A request waiting for a reply. Asynchronous requests complete through
+ * 'result', synchronous ones just fill in 'reply' or 'error'.
+ */
+typedef struct
+{
+  ClutterMozEmbed        *mozembed;
+  guint                   sequence;
+  GSimpleAsyncResult     *result;
+  GCancellable           *cancellable;
+  gulong                  cancelled_id;
+  guint                   timeout_source;
+
+  gboolean                done;
+  ClutterMozEmbedMessage *reply;
+  GError                 *error;
+} ClutterMozEmbedRequest;
+
+/* Takes ownership of reply and error */
+static void
+clutter_mozembed_request_complete (ClutterMozEmbedRequest *request,
+                                   ClutterMozEmbedMessage *reply,
+                                   GError                 *error)
+{
+  ClutterMozEmbedPrivate *priv = request->mozembed->priv;
+
+  priv->requests = g_list_remove (priv->requests, request);
+
+  if (request->timeout_source)
+    g_source_remove (request->timeout_source);
+  if (request->cancelled_id)
+    g_signal_handler_disconnect (request->cancellable, request->cancelled_id);
+  if (request->cancellable)
+    g_object_unref (request->cancellable);
+
+  if (!request->result)
+    {
+      request->done = TRUE;
+      request->reply = reply;
+      request->error = error;
+      return;
+    }
+
+  if (reply)
+    g_simple_async_result_set_op_res_gpointer (request->result, reply,
+                                               (GDestroyNotify)
+                                               clutter_mozembed_comms_message_free);
+  else
+    {
+      g_simple_async_result_set_from_error (request->result, error);
+      g_error_free (error);
+    }
+
+  g_simple_async_result_complete_in_idle (request->result);
+  g_object_unref (request->result);
+  g_slice_free (ClutterMozEmbedRequest, request);
+}
+
+static void
+clutter_mozembed_fail_requests (ClutterMozEmbed *self, const gchar *reason)
+{
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  while (priv->requests)
+    clutter_mozembed_request_complete (priv->requests->data, NULL,
+                                       g_error_new_literal (G_IO_ERROR,
+                                                            G_IO_ERROR_CLOSED,
+                                                            reason));
+}
+
+static gboolean
+clutter_mozembed_request_timeout_cb (ClutterMozEmbedRequest *request)
+{
+  request->timeout_source = 0;
+  clutter_mozembed_request_complete (request, NULL,
+                                     g_error_new (G_IO_ERROR,
+                                                  G_IO_ERROR_TIMED_OUT,
+                                                  "No reply from renderer"));
+  return FALSE;
+}
+
+static void
+clutter_mozembed_request_cancelled_cb (GCancellable           *cancellable,
+                                       ClutterMozEmbedRequest *request)
+{
+  GError *error = NULL;
+
+  g_cancellable_set_error_if_cancelled (cancellable, &error);
+  clutter_mozembed_request_complete (request, NULL, error);
+}
+
+/* Views sharing another actor's connection have their feedback read by it */
+static ClutterMozEmbed *
+clutter_mozembed_get_reader (ClutterMozEmbed *self)
+{
+  return self->priv->carrier ? self->priv->carrier : self;
+}
+
+static void
+clutter_mozembed_request_start (ClutterMozEmbed        *mozembed,
+                                ClutterMozEmbedRequest *request,
+                                ClutterMozEmbedCommand  command,
+                                gint                    timeout,
+                                GCancellable           *cancellable,
+                                va_list                 args)
+{
+  GByteArray *data;
+  GError *error = NULL;
+  ClutterMozEmbedPrivate *priv = mozembed->priv;
+
+  request->mozembed = mozembed;
+  request->sequence = clutter_mozembed_comms_next_sequence ();
+  priv->requests = g_list_prepend (priv->requests, request);
+
+  if (!priv->output || !clutter_mozembed_get_reader (mozembed)->priv->input)
+    {
+      clutter_mozembed_request_complete (request, NULL,
+        g_error_new (G_IO_ERROR, G_IO_ERROR_CLOSED,
+                     "Not connected to a renderer"));
+      return;
+    }
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, &error))
+    {
+      clutter_mozembed_request_complete (request, NULL, error);
+      return;
+    }
+
+  data = clutter_mozembed_comms_encode_request (command, request->sequence,
+                                                args);
+  clutter_mozembed_comms_send_encoded (priv->output, data);
+  g_byte_array_free (data, TRUE);
+
+  /* Synchronous requests keep track of their own deadline */
+  if (!request->result)
+    return;
+
+  if (cancellable)
+    {
+      request->cancellable = g_object_ref (cancellable);
+      request->cancelled_id =
+        g_signal_connect (cancellable, "cancelled",
+                          G_CALLBACK (clutter_mozembed_request_cancelled_cb),
+                          request);
+    }
+
+  request->timeout_source =
+    g_timeout_add ((timeout < 0) ? priv->request_timeout : timeout,
+                   (GSourceFunc)clutter_mozembed_request_timeout_cb,
+                   request);
+}
+
+/* Picks up changes from the back-end's state page, and notifies about
+ * them like the equivalent feedback messages would.
+ */
 static void
-process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
+clutter_mozembed_sync_state (ClutterMozEmbed *self)
 {
+  ClutterMozEmbedState state;
   ClutterMozEmbedPrivate *priv = self->priv;
 
-  /*g_debug ("Processing feedback: %d", feedback);*/
+  if (!priv->state_page ||
+      !clutter_mozembed_state_read (priv->state_page, &state))
+    return;
+
+  g_object_freeze_notify (G_OBJECT (self));
+
+  if (priv->security != state.security)
+    {
+      priv->security = state.security;
+      g_object_notify (G_OBJECT (self), "security");
+    }
+  if (priv->can_go_back != state.can_go_back)
+    {
+      priv->can_go_back = state.can_go_back;
+      g_object_notify (G_OBJECT (self), "can-go-back");
+    }
+  if (priv->can_go_forward != state.can_go_forward)
+    {
+      priv->can_go_forward = state.can_go_forward;
+      g_object_notify (G_OBJECT (self), "can-go-forward");
+    }
 
-  if (priv->sync_call && (priv->sync_call == feedback))
-    priv->sync_call = 0;
+  g_object_thaw_notify (G_OBJECT (self));
+
+  if (priv->progress != state.progress)
+    {
+      priv->progress = state.progress;
+      g_signal_emit (self, signals[PROGRESS], 0, priv->progress);
+    }
+}
+
+static void
+clutter_mozembed_journal_free (ClutterMozEmbedJournal *journal)
+{
+  g_free (journal->location);
+  g_slice_free (ClutterMozEmbedJournal, journal);
+}
+
+static void
+process_feedback (ClutterMozEmbed *self, ClutterMozEmbedMessage *message)
+{
+  ClutterMozEmbedPrivate *priv = self->priv;
+  ClutterMozEmbedFeedback feedback = message->id;
+
+  /*g_debug ("Processing feedback: %d", feedback);*/
 
   switch (feedback)
     {
@@ -235,17 +618,21 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
       {
         Drawable drawable;
         gint doc_width, doc_height, scroll_x, scroll_y;
+        ClutterMozEmbedFeedbackUpdate body;
 
-        clutter_mozembed_comms_receive (priv->input,
-                                        G_TYPE_ULONG, &drawable,
-                                        G_TYPE_INT, &scroll_x,
-                                        G_TYPE_INT, &scroll_y,
-                                        G_TYPE_INT, &doc_width,
-                                        G_TYPE_INT, &doc_height,
-                                        G_TYPE_INVALID);
+        clutter_mozembed_feedback_update_receive (message, &body);
+        drawable = body.surface;
+        scroll_x = body.scroll_x + body.viewport_x;
+        scroll_y = body.scroll_y + body.viewport_y;
+        doc_width = body.doc_width;
+        doc_height = body.doc_height;
 
         if (priv->doc_width != doc_width)
           {
+            /* The document has probably been laid out again */
+            if (priv->tiles)
+              clutter_mozembed_tiles_clear (priv->tiles);
+
             priv->doc_width = doc_width;
             g_object_notify (G_OBJECT (self), "doc-width");
           }
@@ -274,7 +661,47 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
           }
         clamp_offset (self);
 
-        update (self, drawable);
+        priv->surface_width = body.surface_width;
+        priv->surface_height = body.surface_height;
+
+        if ((priv->viewport_width != body.viewport_width) ||
+            (priv->viewport_height != body.viewport_height))
+          {
+            priv->viewport_width = body.viewport_width;
+            priv->viewport_height = body.viewport_height;
+            if (priv->read_only)
+              clutter_actor_queue_relayout (CLUTTER_ACTOR (self));
+          }
+
+        /* The viewport can move within the overscan area without anything
+         * being redrawn.
+         */
+        if ((priv->viewport_x != body.viewport_x) ||
+            (priv->viewport_y != body.viewport_y))
+          {
+            priv->viewport_x = body.viewport_x;
+            priv->viewport_y = body.viewport_y;
+            clutter_actor_queue_redraw (CLUTTER_ACTOR (self));
+          }
+
+        /* Damage is in frame pixels, which are smaller than surface
+         * pixels when the frame is scaled down.
+         */
+        priv->frame_width = body.frame_width;
+        priv->frame_height = body.frame_height;
+
+        update (self, drawable, body.x, body.y, body.width, body.height);
+        if (priv->tiles)
+          {
+            if ((priv->frame_width != priv->surface_width) ||
+                (priv->frame_height != priv->surface_height))
+              clutter_mozembed_tiles_clear (priv->tiles);
+            else
+              clutter_mozembed_tiles_damage (priv->tiles,
+                                             body.scroll_x + body.x,
+                                             body.scroll_y + body.y,
+                                             body.width, body.height);
+          }
 
         priv->repaint_id =
           clutter_threads_add_repaint_func ((GSourceFunc)
@@ -282,7 +709,9 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
                                             self,
                                             NULL);
 
-        /* We don't queue a redraw, the pixmap update will cause the redraw */
+        /* We don't queue a redraw, updating the area of the pixmap queues
+         * one for the damaged area.
+         */
 
         break;
       }
@@ -313,7 +742,7 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
       }
     case CME_FEEDBACK_PROGRESS :
       {
-        priv->progress = clutter_mozembed_comms_receive_double (priv->input);
+        priv->progress = clutter_mozembed_comms_receive_double (message);
         g_signal_emit (self, signals[PROGRESS], 0, priv->progress);
         break;
       }
@@ -327,34 +756,50 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
     case CME_FEEDBACK_NET_STOP :
       {
         priv->is_loading = FALSE;
+
+        /* Once a recovered page has loaded again, scroll it back to where
+         * it was, unless it's gone somewhere else.
+         */
+        if (priv->journal)
+          {
+            if (!g_strcmp0 (priv->location, priv->journal->location))
+              clutter_mozembed_scroll_to (self, priv->journal->scroll_x,
+                                          priv->journal->scroll_y);
+            clutter_mozembed_journal_free (priv->journal);
+            priv->journal = NULL;
+          }
+
         g_signal_emit (self, signals[NET_STOP], 0);
         break;
       }
     case CME_FEEDBACK_LOCATION :
       {
         g_free (priv->location);
-        priv->location = clutter_mozembed_comms_receive_string (priv->input);
+        priv->location = clutter_mozembed_comms_receive_string (message);
         g_object_notify (G_OBJECT (self), "location");
+
+        if (priv->tiles)
+          clutter_mozembed_tiles_clear (priv->tiles);
         break;
       }
     case CME_FEEDBACK_TITLE :
       {
         g_free (priv->title);
-        priv->title = clutter_mozembed_comms_receive_string (priv->input);
+        priv->title = clutter_mozembed_comms_receive_string (message);
         g_object_notify (G_OBJECT (self), "title");
         break;
       }
     case CME_FEEDBACK_ICON :
       {
         g_free (priv->icon);
-        priv->icon = clutter_mozembed_comms_receive_string (priv->input);
+        priv->icon = clutter_mozembed_comms_receive_string (message);
         g_object_notify (G_OBJECT (self), "icon");
         break;
       }
     case CME_FEEDBACK_CAN_GO_BACK :
       {
         gboolean can_go_back =
-          clutter_mozembed_comms_receive_boolean (priv->input);
+          clutter_mozembed_comms_receive_boolean (message);
         if (priv->can_go_back != can_go_back)
           {
             priv->can_go_back = can_go_back;
@@ -365,7 +810,7 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
     case CME_FEEDBACK_CAN_GO_FORWARD :
       {
         gboolean can_go_forward =
-          clutter_mozembed_comms_receive_boolean (priv->input);
+          clutter_mozembed_comms_receive_boolean (message);
         if (priv->can_go_forward != can_go_forward)
           {
             priv->can_go_forward = can_go_forward;
@@ -376,7 +821,8 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
     case CME_FEEDBACK_NEW_WINDOW :
       {
         ClutterMozEmbed *new_window = NULL;
-        guint chrome = clutter_mozembed_comms_receive_uint (priv->input);
+        guint sequence = clutter_mozembed_comms_receive_uint (message);
+        guint chrome = clutter_mozembed_comms_receive_uint (message);
 
         /* Find out if the new window is received */
         g_signal_emit (self, signals[NEW_WINDOW], 0, &new_window, chrome);
@@ -385,18 +831,19 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
         if (new_window)
           {
             gchar *output_file, *input_file;
+            guint id = clutter_mozembed_hand_over (self, new_window,
+                                                   &input_file,
+                                                   &output_file);
 
-            output_file = input_file = NULL;
-            g_object_get (G_OBJECT (new_window),
-                          "output", &output_file,
-                          "input", &input_file,
-                          NULL);
+            new_window->priv->chrome = chrome;
 
             clutter_mozembed_comms_send (priv->output,
                                          CME_COMMAND_NEW_WINDOW_RESPONSE,
+                                         G_TYPE_UINT, sequence,
                                          G_TYPE_BOOLEAN, TRUE,
                                          G_TYPE_STRING, input_file,
                                          G_TYPE_STRING, output_file,
+                                         G_TYPE_UINT, id,
                                          G_TYPE_INVALID);
 
             g_free (output_file);
@@ -405,6 +852,7 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
         else
           clutter_mozembed_comms_send (priv->output,
                                        CME_COMMAND_NEW_WINDOW_RESPONSE,
+                                       G_TYPE_UINT, sequence,
                                        G_TYPE_BOOLEAN, FALSE,
                                        G_TYPE_INVALID);
 
@@ -412,6 +860,8 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
       }
     case CME_FEEDBACK_CLOSED :
       {
+        priv->closed = TRUE;
+
         /* If we're in dispose, watch_id will be zero */
         if (priv->watch_id)
           g_signal_emit (self, signals[CLOSED], 0);
@@ -419,40 +869,113 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
       }
     case CME_FEEDBACK_LINK_MESSAGE :
       {
-        gchar *link = clutter_mozembed_comms_receive_string (priv->input);
+        gchar *link = clutter_mozembed_comms_receive_string (message);
         g_signal_emit (self, signals[LINK_MESSAGE], 0, link);
         g_free (link);
         break;
       }
     case CME_FEEDBACK_SIZE_REQUEST :
       {
-        gint width, height;
-        clutter_mozembed_comms_receive (priv->input,
-                                        G_TYPE_INT, &width,
-                                        G_TYPE_INT, &height,
-                                        G_TYPE_INVALID);
-        g_signal_emit (self, signals[SIZE_REQUEST], 0, width, height);
+        ClutterMozEmbedFeedbackSizeRequest body;
+        clutter_mozembed_feedback_size_request_receive (message, &body);
+        g_signal_emit (self, signals[SIZE_REQUEST], 0,
+                       body.width, body.height);
         break;
       }
     case CME_FEEDBACK_CURSOR :
       {
-        priv->cursor = clutter_mozembed_comms_receive_int (priv->input);
+        priv->cursor = clutter_mozembed_comms_receive_int (message);
         g_object_notify (G_OBJECT (self), "cursor");
         break;
       }
     case CME_FEEDBACK_SECURITY :
       {
-        priv->security = clutter_mozembed_comms_receive_int (priv->input);
+        priv->security = clutter_mozembed_comms_receive_int (message);
         g_object_notify (G_OBJECT (self), "security");
         break;
       }
+    case CME_FEEDBACK_SHM_NAME :
+      {
+        GError *error = NULL;
+        gchar *name = clutter_mozembed_comms_receive_string (message);
+
+        if (priv->state_page)
+          clutter_mozembed_state_close (priv->state_page, NULL);
+
+        priv->state_page = clutter_mozembed_state_open (name, &error);
+        if (priv->state_page)
+          clutter_mozembed_sync_state (self);
+        else
+          {
+            g_warning ("Error opening state page: %s", error->message);
+            g_error_free (error);
+          }
+
+        g_free (name);
+        break;
+      }
+    case CME_FEEDBACK_STATE_CHANGED :
+      {
+        clutter_mozembed_sync_state (self);
+        break;
+      }
+    case CME_FEEDBACK_REPLY :
+      {
+        GList *r;
+        guint sequence = clutter_mozembed_comms_receive_uint (message);
+
+        for (r = priv->requests; r; r = r->next)
+          {
+            ClutterMozEmbedRequest *request = r->data;
+            if (request->sequence == sequence)
+              {
+                clutter_mozembed_request_complete (
+                  request, clutter_mozembed_comms_message_copy (message),
+                  NULL);
+                break;
+              }
+          }
+
+        /* Replies to requests that timed out or were cancelled are
+         * dropped.
+         */
+        break;
+      }
+    case CME_FEEDBACK_SHM_SURFACE :
+      {
+        gpointer data;
+        ClutterMozEmbedShmSurface *surface;
+        ClutterMozEmbedFeedbackShmSurface body;
+
+        clutter_mozembed_feedback_shm_surface_receive (message, &body);
+
+        data = shmat (body.shmid, NULL, SHM_RDONLY);
+        if (data == (gpointer)-1)
+          {
+            g_warning ("Unable to attach shared memory frames: %s",
+                       g_strerror (errno));
+            break;
+          }
+
+        surface = g_slice_new (ClutterMozEmbedShmSurface);
+        surface->data = data;
+        surface->width = body.width;
+        surface->height = body.height;
+        surface->stride = body.stride;
+        surface->depth = body.depth;
+        surface->generation = body.generation;
+        g_hash_table_replace (priv->shm_surfaces,
+                              GUINT_TO_POINTER ((guint)body.surface),
+                              surface);
+        break;
+      }
     case CME_FEEDBACK_DL_START :
       {
         gint id;
         gchar *source, *dest;
         ClutterMozEmbedDownload *download;
 
-        clutter_mozembed_comms_receive (priv->input,
+        clutter_mozembed_comms_receive (message,
                                         G_TYPE_INT, &id,
                                         G_TYPE_STRING, &source,
                                         G_TYPE_STRING, &dest,
@@ -474,7 +997,7 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
         gint64 progress, max_progress;
         ClutterMozEmbedDownload *download;
 
-        clutter_mozembed_comms_receive (priv->input,
+        clutter_mozembed_comms_receive (message,
                                         G_TYPE_INT, &id,
                                         G_TYPE_INT64, &progress,
                                         G_TYPE_INT64, &max_progress,
@@ -492,7 +1015,7 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
       {
         ClutterMozEmbedDownload *download;
 
-        gint id = clutter_mozembed_comms_receive_int (priv->input);
+        gint id = clutter_mozembed_comms_receive_int (message);
 
         download = g_hash_table_lookup (priv->downloads, GINT_TO_POINTER (id));
         if (download)
@@ -504,7 +1027,7 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
       {
         ClutterMozEmbedDownload *download;
 
-        gint id = clutter_mozembed_comms_receive_int (priv->input);
+        gint id = clutter_mozembed_comms_receive_int (message);
 
         download = g_hash_table_lookup (priv->downloads, GINT_TO_POINTER (id));
         if (download)
@@ -517,7 +1040,7 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
         gint x, y;
         gchar *tooltip;
 
-        clutter_mozembed_comms_receive (priv->input,
+        clutter_mozembed_comms_receive (message,
                                         G_TYPE_INT, &x,
                                         G_TYPE_INT, &y,
                                         G_TYPE_STRING, &tooltip,
@@ -534,7 +1057,7 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
       }
     case CME_FEEDBACK_PRIVATE :
       {
-        gboolean private = clutter_mozembed_comms_receive_boolean (priv->input);
+        gboolean private = clutter_mozembed_comms_receive_boolean (message);
 
         if (priv->private != private)
           {
@@ -550,7 +1073,7 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
         guint plug_id;
         gint x, y, width, height;
 
-        clutter_mozembed_comms_receive (priv->input,
+        clutter_mozembed_comms_receive (message,
                                         G_TYPE_UINT, &plug_id,
                                         G_TYPE_INT, &x,
                                         G_TYPE_INT, &y,
@@ -568,7 +1091,7 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
         guint plug_id;
         gint x, y, width, height;
 
-        clutter_mozembed_comms_receive (priv->input,
+        clutter_mozembed_comms_receive (message,
                                         G_TYPE_UINT, &plug_id,
                                         G_TYPE_INT, &x,
                                         G_TYPE_INT, &y,
@@ -586,7 +1109,7 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
         guint plug_id;
         gboolean visible;
 
-        clutter_mozembed_comms_receive (priv->input,
+        clutter_mozembed_comms_receive (message,
                                         G_TYPE_UINT, &plug_id,
                                         G_TYPE_BOOLEAN, &visible,
                                         G_TYPE_INVALID);
@@ -607,13 +1130,13 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
       }
     case CME_FEEDBACK_IM_ENABLE :
       {
-        priv->im_enabled = clutter_mozembed_comms_receive_boolean (priv->input);
+        priv->im_enabled = clutter_mozembed_comms_receive_boolean (message);
 
         break;
       }
     case CME_FEEDBACK_IM_FOCUS_CHANGE :
       {
-        gboolean in = clutter_mozembed_comms_receive_boolean (priv->input);
+        gboolean in = clutter_mozembed_comms_receive_boolean (message);
 
         if (!priv->im_enabled)
           break;
@@ -629,7 +1152,7 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
       {
         ClutterIMRectangle rect;
 
-        clutter_mozembed_comms_receive (priv->input,
+        clutter_mozembed_comms_receive (message,
                                         G_TYPE_INT, &(rect.x),
                                         G_TYPE_INT, &(rect.y),
                                         G_TYPE_INT, &(rect.width),
@@ -649,7 +1172,7 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
         guint type;
         gchar *uri, *href, *img_href, *txt;
 
-        clutter_mozembed_comms_receive (priv->input,
+        clutter_mozembed_comms_receive (message,
                                         G_TYPE_UINT, &type,
                                         G_TYPE_STRING, &uri,
                                         G_TYPE_STRING, &href,
@@ -673,43 +1196,110 @@ process_feedback (ClutterMozEmbed *self, ClutterMozEmbedFeedback feedback)
     }
 }
 
+/* Finds the actor that feedback read from our connection is for */
+static ClutterMozEmbed *
+clutter_mozembed_find_view (ClutterMozEmbed *self, guint id)
+{
+  GList *v;
+
+  if (!id)
+    return self;
+
+  for (v = self->priv->views; v; v = v->next)
+    {
+      ClutterMozEmbed *view = v->data;
+      if (view->priv->view_id == id)
+        return view;
+    }
+
+  return NULL;
+}
+
+/* Views sharing our connection lose it along with us. They're told they've
+ * closed if we closed, or crashed if our renderer went away.
+ */
+static void
+clutter_mozembed_detach_views (ClutterMozEmbed *self, gboolean crashed)
+{
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  while (priv->views)
+    {
+      ClutterMozEmbed *view = priv->views->data;
+
+      priv->views = g_list_delete_link (priv->views, priv->views);
+      view->priv->carrier = NULL;
+      clutter_mozembed_shutdown_channel (&view->priv->output);
+
+      clutter_mozembed_fail_requests (view, crashed ?
+                                      "Lost connection to renderer" :
+                                      "Closed");
+      g_signal_emit (view, signals[crashed ? CRASHED : CLOSED], 0);
+    }
+}
+
+static gboolean
+dispatch_feedback (ClutterMozEmbed *self)
+{
+  GIOStatus status;
+  ClutterMozEmbedMessage message;
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  while ((status = clutter_mozembed_comms_decoder_pop (&priv->decoder,
+                                                       &message)) ==
+         G_IO_STATUS_NORMAL)
+    {
+      ClutterMozEmbed *target;
+
+      /* Feedback for views that have just gone is dropped */
+      if ((target = clutter_mozembed_find_view (self, message.view)))
+        process_feedback (target, &message);
+      clutter_mozembed_comms_message_clear (&message);
+    }
+
+  return (status != G_IO_STATUS_ERROR);
+}
+
+static gboolean
+read_feedback (ClutterMozEmbed *self,
+               GIOChannel      *source)
+{
+  GIOStatus status;
+  GError *error = NULL;
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  status = clutter_mozembed_comms_decoder_feed (&priv->decoder, source,
+                                                FALSE, &error);
+  if (status == G_IO_STATUS_ERROR)
+    {
+      g_warning ("Error reading from source: %s",
+                 error ? error->message : "Unknown error");
+      if (error)
+        g_error_free (error);
+      return FALSE;
+    }
+  else if (status == G_IO_STATUS_EOF)
+    {
+      g_warning ("Reached end of input pipe");
+      return FALSE;
+    }
+
+  return dispatch_feedback (self);
+}
+
 static gboolean
 input_io_func (GIOChannel      *source,
                GIOCondition     condition,
                ClutterMozEmbed *self)
 {
   /* FYI: Maximum URL length in IE is 2083 characters */
-  ClutterMozEmbedFeedback feedback;
-  gsize length;
-  GError *error = NULL;
   gboolean result = TRUE;
 
-  while (condition & (G_IO_PRI | G_IO_IN))
-    {
-      GIOStatus status = g_io_channel_read_chars (source,
-                                                  (gchar *)(&feedback),
-                                                  sizeof (feedback),
-                                                  &length, &error);
-      if (status == G_IO_STATUS_NORMAL)
-        {
-          process_feedback (self, feedback);
-        }
-      else if (status == G_IO_STATUS_ERROR)
-        {
-          g_warning ("Error reading from source: %s", error->message);
-          g_error_free (error);
-          result = FALSE;
-          break;
-        }
-      else if (status == G_IO_STATUS_EOF)
-        {
-          g_warning ("Reached end of input pipe");
-          result = FALSE;
-          break;
-        }
-
-      condition = g_io_channel_get_buffer_condition (source);
-    }
+  /* Only complete messages are dispatched, anything left over waits in
+   * the decoder until the rest of it arrives.
+   */
+  if (condition & (G_IO_PRI | G_IO_IN))
+    result = read_feedback (self, source);
 
   if (condition & G_IO_HUP)
     {
@@ -730,29 +1320,110 @@ input_io_func (GIOChannel      *source,
     }
 
   if (!result)
-    g_signal_emit (self, signals[CRASHED], 0);
+    {
+      /* Returning FALSE removes this watch */
+      self->priv->watch_id = 0;
+
+      if (!clutter_mozembed_recover (self))
+        {
+          gboolean crashed = !self->priv->closed;
+
+          clutter_mozembed_detach_views (self, crashed);
+          clutter_mozembed_fail_requests (self, crashed ?
+                                          "Lost connection to renderer" :
+                                          "Closed");
+          if (crashed)
+            g_signal_emit (self, signals[CRASHED], 0);
+        }
+    }
 
   return result;
 }
 
 void
-block_until_feedback (ClutterMozEmbed         *mozembed,
-                      ClutterMozEmbedFeedback  feedback)
+clutter_mozembed_request_async (ClutterMozEmbed        *mozembed,
+                                ClutterMozEmbedCommand  command,
+                                gint                    timeout,
+                                GCancellable           *cancellable,
+                                GAsyncReadyCallback     callback,
+                                gpointer                user_data,
+                                ...)
 {
-  ClutterMozEmbedPrivate *priv = mozembed->priv;
+  va_list args;
+  ClutterMozEmbedRequest *request = g_slice_new0 (ClutterMozEmbedRequest);
 
-  if (!priv->input)
-    return;
+  request->result =
+    g_simple_async_result_new (G_OBJECT (mozembed), callback, user_data,
+                               clutter_mozembed_request_async);
 
-  priv->sync_call = feedback;
+  va_start (args, user_data);
+  clutter_mozembed_request_start (mozembed, request, command,
+                                  timeout, cancellable, args);
+  va_end (args);
+}
 
-  /* FIXME: There needs to be a time limit here, or we can hang if the backend
-   *        hangs. Here or in input_io_func anyway...
-   */
-  while (input_io_func (priv->input, G_IO_IN, mozembed) && priv->sync_call);
+ClutterMozEmbedMessage *
+clutter_mozembed_request_finish (ClutterMozEmbed  *mozembed,
+                                 GAsyncResult     *result,
+                                 GError          **error)
+{
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+
+  if (g_simple_async_result_propagate_error (simple, error))
+    return NULL;
+
+  return clutter_mozembed_comms_message_copy (
+           g_simple_async_result_get_op_res_gpointer (simple));
+}
+
+/* Waits for the reply without running the main loop. Other feedback from
+ * the renderer is still processed while waiting.
+ */
+ClutterMozEmbedMessage *
+clutter_mozembed_request_sync (ClutterMozEmbed         *mozembed,
+                               ClutterMozEmbedCommand   command,
+                               gint                     timeout,
+                               GError                 **error,
+                               ...)
+{
+  GTimer *timer;
+  va_list args;
+  ClutterMozEmbedRequest request = { 0, };
+  ClutterMozEmbed *reader = clutter_mozembed_get_reader (mozembed);
+
+  if (timeout < 0)
+    timeout = mozembed->priv->request_timeout;
+
+  va_start (args, error);
+  clutter_mozembed_request_start (mozembed, &request, command,
+                                  timeout, NULL, args);
+  va_end (args);
+
+  timer = g_timer_new ();
+  while (!request.done)
+    {
+      gint remaining = timeout - (gint)(g_timer_elapsed (timer, NULL) * 1000);
+
+      if ((remaining <= 0) ||
+          !clutter_mozembed_comms_poll (reader->priv->input, remaining))
+        {
+          clutter_mozembed_request_complete (&request, NULL,
+            g_error_new (G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                         "No reply from renderer"));
+          break;
+        }
 
-  if (priv->sync_call)
-    g_warning ("Error making synchronous call to backend");
+      if (!read_feedback (reader, reader->priv->input) && !request.done)
+        clutter_mozembed_request_complete (&request, NULL,
+          g_error_new (G_IO_ERROR, G_IO_ERROR_CLOSED,
+                       "Lost connection to renderer"));
+    }
+  g_timer_destroy (timer);
+
+  if (request.error)
+    g_propagate_error (error, request.error);
+
+  return request.reply;
 }
 
 #ifdef SUPPORT_PLUGINS
@@ -1216,14 +1887,56 @@ clutter_mozembed_init_viewport (ClutterMozEmbed *mozembed)
     }
   return TRUE;
 }
+#endif
+
+/* Tells the back-end whether we can be seen, once any reparenting has
+ * settled, so that it can stop drawing while its views are hidden.
+ */
+static gboolean
+clutter_mozembed_visibility_cb (ClutterMozEmbed *mozembed)
+{
+  gboolean visible;
+  ClutterMozEmbedPrivate *priv = mozembed->priv;
+
+  priv->visibility_source = 0;
+
+  visible = CLUTTER_ACTOR_IS_MAPPED (mozembed) &&
+    (clutter_actor_get_opacity (CLUTTER_ACTOR (mozembed)) > 0);
+
+  if (priv->output && (priv->visible != visible))
+    {
+      priv->visible = visible;
+      clutter_mozembed_comms_send (priv->output,
+                                   CME_COMMAND_MAP,
+                                   G_TYPE_BOOLEAN, visible,
+                                   G_TYPE_INVALID);
+    }
+
+  return FALSE;
+}
+
+static void
+clutter_mozembed_queue_visibility (ClutterMozEmbed *mozembed)
+{
+  ClutterMozEmbedPrivate *priv = mozembed->priv;
+
+  if (!priv->visibility_source)
+    priv->visibility_source =
+      g_idle_add ((GSourceFunc)clutter_mozembed_visibility_cb, mozembed);
+}
 
 static void
 clutter_mozembed_unmap (ClutterActor *actor)
 {
+#ifdef SUPPORT_PLUGINS
   GList *p;
   ClutterMozEmbedPrivate *priv = CLUTTER_MOZEMBED (actor)->priv;
+#endif
 
   CLUTTER_ACTOR_CLASS (clutter_mozembed_parent_class)->unmap (actor);
+  clutter_mozembed_queue_visibility (CLUTTER_MOZEMBED (actor));
+
+#ifdef SUPPORT_PLUGINS
   clutter_mozembed_sync_plugin_viewport_pos (CLUTTER_MOZEMBED (actor));
 
   for (p = priv->plugin_windows; p; p = p->next)
@@ -1232,17 +1945,22 @@ clutter_mozembed_unmap (ClutterActor *actor)
       if (window->plugin_tfp)
         clutter_actor_unmap (window->plugin_tfp);
     }
+#endif
 }
 
 static void
 clutter_mozembed_map (ClutterActor *actor)
 {
+#ifdef SUPPORT_PLUGINS
   GList *p;
   ClutterMozEmbed *mozembed = CLUTTER_MOZEMBED (actor);
   ClutterMozEmbedPrivate *priv = mozembed->priv;
+#endif
 
   CLUTTER_ACTOR_CLASS (clutter_mozembed_parent_class)->map (actor);
+  clutter_mozembed_queue_visibility (CLUTTER_MOZEMBED (actor));
 
+#ifdef SUPPORT_PLUGINS
   for (p = priv->plugin_windows; p; p = p->next)
     {
       PluginWindow *window = p->data;
@@ -1251,8 +1969,14 @@ clutter_mozembed_map (ClutterActor *actor)
     }
 
   clutter_mozembed_sync_plugin_viewport_pos (CLUTTER_MOZEMBED (actor));
-}
 #endif
+}
+
+static void
+clutter_mozembed_opacity_cb (ClutterMozEmbed *mozembed)
+{
+  clutter_mozembed_queue_visibility (mozembed);
+}
 
 static void
 clutter_mozembed_get_property (GObject *object, guint property_id,
@@ -1322,11 +2046,11 @@ clutter_mozembed_get_property (GObject *object, guint property_id,
     break;
 
   case PROP_CAN_GO_BACK :
-    g_value_set_boolean (value, self->priv->can_go_back);
+    g_value_set_boolean (value, clutter_mozembed_can_go_back (self));
     break;
 
   case PROP_CAN_GO_FORWARD :
-    g_value_set_boolean (value, self->priv->can_go_forward);
+    g_value_set_boolean (value, clutter_mozembed_can_go_forward (self));
     break;
 
   case PROP_CURSOR :
@@ -1334,7 +2058,7 @@ clutter_mozembed_get_property (GObject *object, guint property_id,
     break;
 
   case PROP_SECURITY :
-    g_value_set_uint (value, self->priv->security);
+    g_value_set_uint (value, clutter_mozembed_get_security (self));
     break;
 
   case PROP_COMP_PATHS :
@@ -1353,6 +2077,38 @@ clutter_mozembed_get_property (GObject *object, guint property_id,
     g_value_set_string (value, self->priv->user_chrome_path);
     break;
 
+  case PROP_SHM_COMMS :
+    g_value_set_boolean (value, self->priv->shm_comms);
+    break;
+
+  case PROP_SOCKET :
+    g_value_set_boolean (value, self->priv->socket);
+    break;
+
+  case PROP_SHM_FRAMES :
+    g_value_set_boolean (value, self->priv->shm_frames);
+    break;
+
+  case PROP_OVERSCAN :
+    g_value_set_int (value, clutter_mozembed_get_overscan (self));
+    break;
+
+  case PROP_REQUEST_TIMEOUT :
+    g_value_set_int (value, clutter_mozembed_get_request_timeout (self));
+    break;
+
+  case PROP_SITE :
+    g_value_set_string (value, self->priv->site);
+    break;
+
+  case PROP_MULTIPLEXED :
+    g_value_set_boolean (value, self->priv->multiplexed);
+    break;
+
+  case PROP_AUTO_RECOVER :
+    g_value_set_boolean (value, clutter_mozembed_get_auto_recover (self));
+    break;
+
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
   }
@@ -1427,6 +2183,39 @@ clutter_mozembed_set_property (GObject *object, guint property_id,
     priv->user_chrome_path = g_value_dup_string (value);
     break;
 
+  case PROP_SHM_COMMS :
+    priv->shm_comms = g_value_get_boolean (value);
+    break;
+
+  case PROP_SOCKET :
+    priv->socket = g_value_get_boolean (value);
+    break;
+
+  case PROP_SHM_FRAMES :
+    priv->shm_frames = g_value_get_boolean (value);
+    break;
+
+  case PROP_OVERSCAN :
+    clutter_mozembed_set_overscan (self, g_value_get_int (value));
+    break;
+
+  case PROP_REQUEST_TIMEOUT :
+    clutter_mozembed_set_request_timeout (self, g_value_get_int (value));
+    break;
+
+  case PROP_SITE :
+    g_free (priv->site);
+    priv->site = g_value_dup_string (value);
+    break;
+
+  case PROP_MULTIPLEXED :
+    priv->multiplexed = g_value_get_boolean (value);
+    break;
+
+  case PROP_AUTO_RECOVER :
+    clutter_mozembed_set_auto_recover (self, g_value_get_boolean (value));
+    break;
+
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
   }
@@ -1482,6 +2271,24 @@ disconnect_file_monitor_sources (ClutterMozEmbed *self)
     }
 }
 
+static void
+clutter_mozembed_shutdown_channel (GIOChannel **channel)
+{
+  GError *error = NULL;
+
+  if (!*channel)
+    return;
+
+  if (g_io_channel_shutdown (*channel, FALSE, &error) == G_IO_STATUS_ERROR)
+    {
+      g_warning ("Error closing IO channel: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_io_channel_unref (*channel);
+  *channel = NULL;
+}
+
 static void
 clutter_mozembed_dispose (GObject *object)
 {
@@ -1518,34 +2325,55 @@ clutter_mozembed_dispose (GObject *object)
       priv->connect_timeout_source = 0;
     }
 
-  if (priv->input)
+  if (priv->overscan_source)
     {
-      GError *error = NULL;
+      g_source_remove (priv->overscan_source);
+      priv->overscan_source = 0;
+    }
 
-      if (g_io_channel_shutdown (priv->input, FALSE, &error) ==
-          G_IO_STATUS_ERROR)
-        {
-          g_warning ("Error closing IO channel: %s", error->message);
-          g_error_free (error);
-        }
+  if (priv->visibility_source)
+    {
+      g_source_remove (priv->visibility_source);
+      priv->visibility_source = 0;
+    }
 
-      g_io_channel_unref (priv->input);
-      priv->input = NULL;
+  if (priv->render_scale_source)
+    {
+      g_source_remove (priv->render_scale_source);
+      priv->render_scale_source = 0;
     }
 
-  if (priv->output)
+  clutter_mozembed_fail_requests (self, "Closed");
+
+  clutter_mozembed_detach_views (self, FALSE);
+  if (priv->carrier)
     {
-      GError *error = NULL;
+      ClutterMozEmbedPrivate *carrier_priv = priv->carrier->priv;
 
-      if (g_io_channel_shutdown (priv->output, FALSE, &error) ==
-          G_IO_STATUS_ERROR)
-        {
-          g_warning ("Error closing IO channel: %s", error->message);
-          g_error_free (error);
-        }
+      clutter_mozembed_command_remove_view_send (priv->output);
+      carrier_priv->views = g_list_remove (carrier_priv->views, self);
+      priv->carrier = NULL;
+    }
+
+  clutter_mozembed_shutdown_channel (&priv->input);
+  clutter_mozembed_shutdown_channel (&priv->output);
+
+  if (priv->process)
+    {
+      clutter_mozembed_leave_process (self);
+      priv->process = NULL;
+    }
+
+  if (priv->control)
+    {
+      g_io_channel_unref (priv->control);
+      priv->control = NULL;
+    }
 
-      g_io_channel_unref (priv->output);
-      priv->output = NULL;
+  if (priv->remote_fd != -1)
+    {
+      close (priv->remote_fd);
+      priv->remote_fd = -1;
     }
 
   if (priv->downloads)
@@ -1571,6 +2399,11 @@ clutter_mozembed_finalize (GObject *object)
   g_remove (priv->output_file);
   g_remove (priv->input_file);
 
+  clutter_mozembed_comms_decoder_clear (&priv->decoder);
+
+  if (priv->state_page)
+    clutter_mozembed_state_close (priv->state_page, NULL);
+
   g_free (priv->location);
   g_free (priv->title);
   g_free (priv->input_file);
@@ -1579,6 +2412,18 @@ clutter_mozembed_finalize (GObject *object)
   g_strfreev (priv->comp_paths);
   g_strfreev (priv->chrome_paths);
   g_free (priv->user_chrome_path);
+  g_free (priv->site);
+
+  if (priv->journal)
+    clutter_mozembed_journal_free (priv->journal);
+  if (priv->recover_timer)
+    g_timer_destroy (priv->recover_timer);
+
+  g_hash_table_destroy (priv->shm_surfaces);
+  if (priv->tiles)
+    clutter_mozembed_tiles_free (priv->tiles);
+  if (priv->scroll_timer)
+    g_timer_destroy (priv->scroll_timer);
 
   G_OBJECT_CLASS (clutter_mozembed_parent_class)->finalize (object);
 }
@@ -1640,8 +2485,8 @@ clutter_mozembed_get_preferred_width (ClutterActor *actor,
       if (min_width_p)
         *min_width_p = 0;
 
-      clutter_texture_get_base_size (CLUTTER_TEXTURE (actor),
-                                     &width, &height);
+      width = priv->viewport_width;
+      height = priv->viewport_height;
 
       if (natural_width_p)
         {
@@ -1672,8 +2517,8 @@ clutter_mozembed_get_preferred_height (ClutterActor *actor,
       if (min_height_p)
         *min_height_p = 0;
 
-      clutter_texture_get_base_size (CLUTTER_TEXTURE (actor),
-                                     &width, &height);
+      width = priv->viewport_width;
+      height = priv->viewport_height;
 
       if (natural_height_p)
         {
@@ -1693,7 +2538,7 @@ clutter_mozembed_allocate (ClutterActor           *actor,
                            const ClutterActorBox  *box,
                            ClutterAllocationFlags  flags)
 {
-  gint width, height, tex_width, tex_height;
+  gint width, height;
   ClutterMozEmbed *mozembed = CLUTTER_MOZEMBED (actor);
   ClutterMozEmbedPrivate *priv = mozembed->priv;
 
@@ -1703,25 +2548,19 @@ clutter_mozembed_allocate (ClutterActor           *actor,
   if (width < 0 || height < 0)
     return;
 
-  clutter_texture_get_base_size (CLUTTER_TEXTURE (actor),
-                                 &tex_width, &tex_height);
-
+  /* The last frame keeps being painted, cropped to the new allocation,
+   * until the back-end sends one at the new size. The back-end keeps the
+   * old pixmap around until then.
+   */
   if ((!priv->read_only) &&
-      (((tex_width != width) || (tex_height != height)) ||
+      (((priv->width != width) || (priv->height != height)) ||
        !priv->drawable))
     {
-      clutter_x11_texture_pixmap_set_pixmap (CLUTTER_X11_TEXTURE_PIXMAP (actor),
-                                             None);
-      priv->drawable = None;
       priv->width = width;
       priv->height = height;
 
       /* Send a resize command to the back-end */
-      clutter_mozembed_comms_send (priv->output,
-                                   CME_COMMAND_RESIZE,
-                                   G_TYPE_INT, width,
-                                   G_TYPE_INT, height,
-                                   G_TYPE_INVALID);
+      clutter_mozembed_command_resize_send (priv->output, width, height);
     }
 
   CLUTTER_ACTOR_CLASS (clutter_mozembed_parent_class)->
@@ -1736,17 +2575,128 @@ clutter_mozembed_allocate (ClutterActor           *actor,
 #endif
 }
 
+/* The tiles only hold full size document content, so they aren't used
+ * when the frame has scrollbars, can be seen through or is scaled down.
+ */
+static gboolean
+clutter_mozembed_use_tiles (ClutterMozEmbed *self)
+{
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  if (!priv->async_scroll || priv->read_only ||
+      priv->scrollbars || priv->transparent ||
+      (priv->frame_width != priv->surface_width) ||
+      (priv->frame_height != priv->surface_height))
+    return FALSE;
+
+  if (!priv->tiles)
+    priv->tiles = clutter_mozembed_tiles_new (CME_TILE_CACHE_SIZE);
+
+  return priv->tiles != NULL;
+}
+
+static void
+clutter_mozembed_set_render_scale (ClutterMozEmbed *self, gdouble scale)
+{
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  if (priv->render_scale == scale)
+    return;
+
+  priv->render_scale = scale;
+  if (priv->output)
+    clutter_mozembed_command_render_scale_send (priv->output, scale);
+}
+
+static gboolean
+clutter_mozembed_render_scale_cb (ClutterMozEmbed *self)
+{
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  priv->render_scale_source = 0;
+  clutter_mozembed_set_render_scale (self, priv->wanted_scale);
+
+  return FALSE;
+}
+
+/* Works out the scale we're painted at, relative to the frames, and asks
+ * the back-end to render at it. The back-end redraws everything when the
+ * scale changes, so smaller scales are only asked for once they've
+ * settled, though larger ones are asked for straight away.
+ */
+static void
+clutter_mozembed_update_render_scale (ClutterMozEmbed *self,
+                                      ClutterGeometry *geom)
+{
+  gfloat width, height;
+  gdouble scale;
+  gint frame_width, frame_height;
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  frame_width = (priv->viewport_width > 0) ?
+    priv->viewport_width : (gint)geom->width;
+  frame_height = (priv->viewport_height > 0) ?
+    priv->viewport_height : (gint)geom->height;
+  if ((frame_width <= 0) || (frame_height <= 0))
+    return;
+
+  clutter_actor_get_transformed_size (CLUTTER_ACTOR (self), &width, &height);
+  scale = MAX (width / frame_width, height / frame_height);
+
+  /* Round up, so frames are never less detailed than they're shown */
+  scale = (gint)(scale / CME_RENDER_SCALE_STEP + 0.99) * CME_RENDER_SCALE_STEP;
+  scale = CLAMP (scale, CME_RENDER_SCALE_STEP, 1.0);
+
+  if (scale >= priv->render_scale)
+    {
+      if (priv->render_scale_source)
+        {
+          g_source_remove (priv->render_scale_source);
+          priv->render_scale_source = 0;
+        }
+      clutter_mozembed_set_render_scale (self, scale);
+    }
+  else if ((scale != priv->wanted_scale) || !priv->render_scale_source)
+    {
+      priv->wanted_scale = scale;
+      if (priv->render_scale_source)
+        g_source_remove (priv->render_scale_source);
+      priv->render_scale_source =
+        g_timeout_add (CME_RENDER_SCALE_DELAY,
+                       (GSourceFunc)clutter_mozembed_render_scale_cb,
+                       self);
+    }
+}
+
 static void
 clutter_mozembed_paint (ClutterActor *actor)
 {
   ClutterMozEmbed *self = CLUTTER_MOZEMBED (actor);
   ClutterMozEmbedPrivate *priv = self->priv;
   ClutterGeometry geom;
+  CoglHandle material;
+  gint tex_width, tex_height;
+  gboolean use_tiles;
 #ifdef SUPPORT_PLUGINS
   GList *pwin;
 #endif
 
   clutter_actor_get_allocation_geometry (actor, &geom);
+  clutter_mozembed_update_render_scale (self, &geom);
+
+  use_tiles = clutter_mozembed_use_tiles (self);
+  if (use_tiles)
+    {
+      CoglHandle texture =
+        clutter_texture_get_cogl_texture (CLUTTER_TEXTURE (actor));
+
+      if (texture != COGL_INVALID_HANDLE)
+        clutter_mozembed_tiles_flush (priv->tiles, texture,
+                                      priv->scroll_x - priv->viewport_x,
+                                      priv->scroll_y - priv->viewport_y,
+                                      priv->surface_width,
+                                      priv->surface_height);
+    }
 
   /* Offset if we're using async scrolling */
   if (priv->async_scroll || !priv->read_only)
@@ -1756,27 +2706,60 @@ clutter_mozembed_paint (ClutterActor *actor)
         cogl_translate (priv->offset_x, priv->offset_y, 0);
     }
 
-  /* Paint texture */
-  if (priv->read_only)
-    CLUTTER_ACTOR_CLASS (clutter_mozembed_parent_class)->paint (actor);
-  else
+  /* Fill in what scrolling has revealed with content seen before */
+  if (use_tiles && (priv->offset_x || priv->offset_y))
     {
-      CoglHandle material =
-        clutter_texture_get_cogl_material (CLUTTER_TEXTURE (actor));
-      if (material != COGL_INVALID_HANDLE)
-        {
-          guint opacity;
-          gint width, height;
-
-          clutter_texture_get_base_size (CLUTTER_TEXTURE (actor),
-                                         &width, &height);
-          opacity = clutter_actor_get_paint_opacity (actor);
+      cogl_push_matrix ();
+      cogl_translate (-priv->scroll_x, -priv->scroll_y, 0);
+      clutter_mozembed_tiles_paint (priv->tiles,
+                                    priv->scroll_x - priv->offset_x,
+                                    priv->scroll_y - priv->offset_y,
+                                    geom.width, geom.height,
+                                    clutter_actor_get_paint_opacity (actor));
+      cogl_pop_matrix ();
+    }
 
-          cogl_material_set_color4ub (material,
-                                      opacity, opacity, opacity, opacity);
-          cogl_set_source (material);
-          cogl_rectangle (0, 0, width, height);
-        }
+  /* Paint texture. Only the part of the pixmap that's in use is sampled,
+   * and it's positioned so that the viewport is at the origin. Read-only
+   * views scale the viewport to their allocation. The frame may be scaled
+   * down in the pixmap, so surface positions are scaled to match.
+   */
+  material = clutter_texture_get_cogl_material (CLUTTER_TEXTURE (actor));
+  clutter_texture_get_base_size (CLUTTER_TEXTURE (actor),
+                                 &tex_width, &tex_height);
+  if ((material != COGL_INVALID_HANDLE) &&
+      (tex_width > 0) && (tex_height > 0) &&
+      (priv->surface_width > 0) && (priv->surface_height > 0))
+    {
+      guint opacity;
+      gfloat tx, ty;
+
+      tx = priv->frame_width / ((gfloat)priv->surface_width * tex_width);
+      ty = priv->frame_height / ((gfloat)priv->surface_height * tex_height);
+
+      opacity = clutter_actor_get_paint_opacity (actor);
+      cogl_material_set_color4ub (material,
+                                  opacity, opacity, opacity, opacity);
+      cogl_set_source (material);
+
+      if (priv->read_only)
+        cogl_rectangle_with_texture_coords (0, 0, geom.width, geom.height,
+                                            priv->viewport_x * tx,
+                                            priv->viewport_y * ty,
+                                            (priv->viewport_x +
+                                             priv->viewport_width) * tx,
+                                            (priv->viewport_y +
+                                             priv->viewport_height) * ty);
+      else
+        cogl_rectangle_with_texture_coords (-priv->viewport_x,
+                                            -priv->viewport_y,
+                                            priv->surface_width -
+                                            priv->viewport_x,
+                                            priv->surface_height -
+                                            priv->viewport_y,
+                                            0, 0,
+                                            priv->surface_width * tx,
+                                            priv->surface_height * ty);
     }
 
 #ifdef SUPPORT_PLUGINS
@@ -1892,15 +2875,13 @@ clutter_mozembed_button_press_event (ClutterActor *actor,
 
   clutter_grab_pointer (actor);
 
-  clutter_mozembed_comms_send (priv->output,
-                               CME_COMMAND_BUTTON_PRESS,
-                               G_TYPE_INT, (gint)x_out,
-                               G_TYPE_INT, (gint)y_out,
-                               G_TYPE_INT, event->button,
-                               G_TYPE_INT, event->click_count,
-                               G_TYPE_UINT, clutter_mozembed_get_modifier (
-                                              event->modifier_state),
-                               G_TYPE_INVALID);
+  clutter_mozembed_command_button_press_send (priv->output,
+                                              (gint)x_out,
+                                              (gint)y_out,
+                                              event->button,
+                                              event->click_count,
+                                              clutter_mozembed_get_modifier (
+                                                event->modifier_state));
 
   return TRUE;
 }
@@ -1922,14 +2903,12 @@ clutter_mozembed_button_release_event (ClutterActor *actor,
                                             &x_out, &y_out))
     return FALSE;
 
-  clutter_mozembed_comms_send (priv->output,
-                               CME_COMMAND_BUTTON_RELEASE,
-                               G_TYPE_INT, (gint)x_out,
-                               G_TYPE_INT, (gint)y_out,
-                               G_TYPE_INT, event->button,
-                               G_TYPE_UINT, clutter_mozembed_get_modifier (
-                                              event->modifier_state),
-                               G_TYPE_INVALID);
+  clutter_mozembed_command_button_release_send (priv->output,
+                                                (gint)x_out,
+                                                (gint)y_out,
+                                                event->button,
+                                                clutter_mozembed_get_modifier (
+                                                  event->modifier_state));
 
   return TRUE;
 }
@@ -2121,13 +3100,11 @@ clutter_mozembed_key_press_event (ClutterActor *actor, ClutterKeyEvent *event)
       (event->unicode_value == '\0'))
     return FALSE;
 
-  clutter_mozembed_comms_send (priv->output,
-                               CME_COMMAND_KEY_PRESS,
-                               G_TYPE_UINT, keyval,
-                               G_TYPE_UINT, event->unicode_value,
-                               G_TYPE_UINT, clutter_mozembed_get_modifier (
-                                              event->modifier_state),
-                               G_TYPE_INVALID);
+  clutter_mozembed_command_key_press_send (priv->output,
+                                           keyval,
+                                           event->unicode_value,
+                                           clutter_mozembed_get_modifier (
+                                             event->modifier_state));
 
   return TRUE;
 }
@@ -2148,12 +3125,10 @@ clutter_mozembed_key_release_event (ClutterActor *actor, ClutterKeyEvent *event)
 
   if (clutter_mozembed_get_keyval (event, &keyval))
     {
-      clutter_mozembed_comms_send (priv->output,
-                                   CME_COMMAND_KEY_RELEASE,
-                                   G_TYPE_UINT, keyval,
-                                   G_TYPE_UINT, clutter_mozembed_get_modifier (
-                                                  event->modifier_state),
-                                   G_TYPE_INVALID);
+      clutter_mozembed_command_key_release_send (priv->output,
+                                                 keyval,
+                                                 clutter_mozembed_get_modifier (
+                                                   event->modifier_state));
       return TRUE;
     }
 
@@ -2214,19 +3189,60 @@ clutter_mozembed_scroll_event (ClutterActor *actor,
         }
     }
 
-  clutter_mozembed_comms_send (priv->output,
-                               CME_COMMAND_BUTTON_PRESS,
-                               G_TYPE_INT, (gint)x_out,
-                               G_TYPE_INT, (gint)y_out,
-                               G_TYPE_INT, button,
-                               G_TYPE_INT, 1,
-                               G_TYPE_UINT, clutter_mozembed_get_modifier (
-                                              event->modifier_state),
-                               G_TYPE_INVALID);
+  clutter_mozembed_command_button_press_send (priv->output,
+                                              (gint)x_out,
+                                              (gint)y_out,
+                                              button,
+                                              1,
+                                              clutter_mozembed_get_modifier (
+                                                event->modifier_state));
 
   return TRUE;
 }
 
+/* Whether the GLX texture-from-pixmap extension is there to show frames */
+static gboolean
+clutter_mozembed_have_tfp (void)
+{
+  Display *xdpy = clutter_x11_get_default_display ();
+
+  return cogl_check_extension ("GLX_EXT_texture_from_pixmap",
+                               glXQueryExtensionsString (
+                                 xdpy, clutter_x11_get_default_screen ()));
+}
+
+static void
+clutter_mozembed_watch_input (ClutterMozEmbed *self)
+{
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  /* Views sharing a connection are fed by the actor that owns it */
+  if (priv->input)
+    priv->watch_id = g_io_add_watch (priv->input,
+                                     G_IO_IN | G_IO_PRI | G_IO_ERR |
+                                     G_IO_NVAL | G_IO_HUP,
+                                     (GIOFunc)input_io_func,
+                                     self);
+
+  if (priv->shm_frames || !clutter_mozembed_have_tfp ())
+    clutter_mozembed_command_shm_frames_send (priv->output, TRUE);
+
+  if (priv->overscan_margin)
+    clutter_mozembed_command_overscan_send (priv->output,
+                                            priv->overscan_margin);
+
+  if (priv->request_timeout != CME_REQUEST_TIMEOUT)
+    clutter_mozembed_command_request_timeout_send (priv->output,
+                                                   priv->request_timeout);
+
+  /* The back-end takes new views to be on screen, at full size */
+  priv->visible = TRUE;
+  clutter_mozembed_queue_visibility (self);
+  priv->render_scale = 1.0;
+
+  priv->is_loading = FALSE;
+}
+
 static void
 file_changed_cb (GFileMonitor      *monitor,
                  GFile             *file,
@@ -2255,13 +3271,8 @@ file_changed_cb (GFileMonitor      *monitor,
   g_io_channel_set_encoding (priv->input, NULL, NULL);
   g_io_channel_set_buffered (priv->input, FALSE);
   g_io_channel_set_close_on_unref (priv->input, TRUE);
-  priv->watch_id = g_io_add_watch (priv->input,
-                                   G_IO_IN | G_IO_PRI | G_IO_ERR |
-                                   G_IO_NVAL | G_IO_HUP,
-                                   (GIOFunc)input_io_func,
-                                   self);
 
-  priv->is_loading = FALSE;
+  clutter_mozembed_watch_input (self);
 }
 
 static gboolean
@@ -2365,9 +3376,11 @@ clutter_mozembed_strv_to_env (gchar **strv, const gchar *prefix)
 }
 
 static gchar **
-clutter_mozembed_get_paths_env (ClutterMozEmbed *self)
+clutter_mozembed_get_paths_env (ClutterMozEmbed        *self,
+                                gint                    control_fd,
+                                ClutterMozEmbedRingFds *ring)
 {
-  ClutterMozEmbedPrivate *priv = self->priv;
+  ClutterMozEmbedPrivate *priv = self ? self->priv : NULL;
   gchar **env_names;
   guint i, env_size;
   gchar **new_env;
@@ -2375,7 +3388,7 @@ clutter_mozembed_get_paths_env (ClutterMozEmbed *self)
   /* Copy the existing environment */
   env_names = g_listenv ();
   env_size = g_strv_length (env_names);
-  new_env = g_new (gchar *, env_size + 4);
+  new_env = g_new (gchar *, env_size + 6);
 
   for (i = 0; i < env_size; i++)
     new_env[i] = g_strconcat (env_names[i], "=", g_getenv (env_names[i]), NULL);
@@ -2383,32 +3396,762 @@ clutter_mozembed_get_paths_env (ClutterMozEmbed *self)
   g_strfreev (env_names);
 
   /* Add vars containing the list of paths */
-  if (priv->comp_paths)
+  if (priv && priv->comp_paths)
     new_env[i++] =
       clutter_mozembed_strv_to_env (priv->comp_paths,
                                     "CLUTTER_MOZEMBED_COMP_PATHS=");
-  if (priv->chrome_paths)
+  if (priv && priv->chrome_paths)
     new_env[i++] =
       clutter_mozembed_strv_to_env (priv->chrome_paths,
                                     "CLUTTER_MOZEMBED_CHROME_PATHS=");
 
-  if (priv->user_chrome_path)
+  if (priv && priv->user_chrome_path)
     new_env[i++] =
       g_strconcat ("CLUTTER_MOZEMBED_DIRECTORIES=UChrm,",
                    priv->user_chrome_path,
                    NULL);
 
+  /* And the descriptors for the connection */
+  new_env[i++] = g_strdup_printf ("CLUTTER_MOZEMBED_SOCKET=%d", control_fd);
+  if (ring)
+    {
+      gchar *fds = clutter_mozembed_ring_fds_to_string (ring);
+      new_env[i++] = g_strconcat ("CLUTTER_MOZEMBED_RING=", fds, NULL);
+      g_free (fds);
+    }
+
   new_env[i++] = NULL;
 
   return new_env;
 }
 
+typedef struct
+{
+  gint                    control_fd;
+  ClutterMozEmbedRingFds *ring;
+} ClutterMozEmbedChildFds;
+
+static void
+clutter_mozembed_child_setup (gpointer user_data)
+{
+  ClutterMozEmbedChildFds *fds = user_data;
+
+  /* Called between fork and exec, so the renderer inherits these */
+  fcntl (fds->control_fd, F_SETFD, 0);
+  if (fds->ring)
+    clutter_mozembed_ring_child_setup (fds->ring);
+}
+
+/* Spawns a renderer, which inherits one end of a control socket, over
+ * which the connections for its windows are passed. Returns our end of
+ * it, or NULL on failure. 'self' is NULL for renderers spawned for the
+ * pool. When 'use_ring' is set, shared memory comms are set up too, and
+ * 'local' is set to our end of them. It's unset if they couldn't be.
+ */
+static GIOChannel *
+clutter_mozembed_spawn_renderer (ClutterMozEmbed        *self,
+                                 gchar                 **argv,
+                                 gboolean               *use_ring,
+                                 ClutterMozEmbedRingFds *local,
+                                 GPid                   *pid)
+{
+  gchar **env;
+  gboolean success;
+  GIOChannel *control;
+  gint control_fd, remote_control_fd;
+  ClutterMozEmbedChildFds child_fds;
+  ClutterMozEmbedRingFds remote;
+  GError *error = NULL;
+
+  if (!clutter_mozembed_comms_socketpair (&control_fd, &remote_control_fd))
+    return NULL;
+
+  if (*use_ring && !clutter_mozembed_ring_create (local, &remote, &error))
+    {
+      g_warning ("Error creating shared memory comms, "
+                 "falling back to sockets: %s", error->message);
+      g_error_free (error);
+      error = NULL;
+      *use_ring = FALSE;
+    }
+
+  child_fds.control_fd = remote_control_fd;
+  child_fds.ring = *use_ring ? &remote : NULL;
+
+  env = clutter_mozembed_get_paths_env (self,
+                                        remote_control_fd,
+                                        child_fds.ring);
+
+  success = g_spawn_async_with_pipes (NULL,
+                                      argv,
+                                      env,
+                                      G_SPAWN_SEARCH_PATH /*|
+                                      G_SPAWN_STDERR_TO_DEV_NULL |
+                                      G_SPAWN_STDOUT_TO_DEV_NULL*/,
+                                      clutter_mozembed_child_setup,
+                                      &child_fds,
+                                      pid,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      &error);
+
+  g_strfreev (env);
+
+  /* The child has its own copies of its ends of the sockets now */
+  close (remote_control_fd);
+  if (*use_ring)
+    {
+      close (remote.hup_fd);
+      if (!success)
+        clutter_mozembed_ring_close_fds (local);
+    }
+
+  if (!success)
+    {
+      g_warning ("Error spawning renderer: %s", error->message);
+      g_error_free (error);
+      close (control_fd);
+      return NULL;
+    }
+
+  control = g_io_channel_unix_new (control_fd);
+  g_io_channel_set_encoding (control, NULL, NULL);
+  g_io_channel_set_buffered (control, FALSE);
+  g_io_channel_set_close_on_unref (control, TRUE);
+
+  return control;
+}
+
+/* Spawns a renderer without any window's settings, for the pool or as the
+ * zygote. 'mode' is its optional mode argument.
+ */
+static GIOChannel *
+clutter_mozembed_spawn_plain_renderer (gchar *mode, GPid *pid)
+{
+  GIOChannel *control;
+  gboolean use_ring = FALSE;
+  gchar *argv[] = { CMH_BIN, NULL, NULL, mode, NULL };
+
+  /* The pipes are only used if no connection is passed to it */
+  argv[1] = g_strdup_printf ("%s/clutter-mozembed-%d-%d",
+                             g_get_tmp_dir (), getpid (), spawned_windows);
+  argv[2] = g_strdup_printf ("%s/clutter-mozheadless-%d-%d",
+                             g_get_tmp_dir (), getpid (), spawned_windows);
+  spawned_windows ++;
+
+  control = clutter_mozembed_spawn_renderer (NULL, argv, &use_ring, NULL, pid);
+
+  g_free (argv[1]);
+  g_free (argv[2]);
+
+  return control;
+}
+
+/* Whether a window can use a renderer that was started without any of
+ * its settings, as ones from the pool or the zygote are.
+ */
+static gboolean
+clutter_mozembed_is_plain (ClutterMozEmbed *self)
+{
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  return !priv->shm_comms && !priv->comp_paths &&
+    !priv->chrome_paths && !priv->user_chrome_path;
+}
+
+/* Asks the zygote to fork a new renderer, starting it if it isn't running
+ * yet. Returns the new renderer's control socket, or NULL if it needs
+ * spawning normally. We don't learn the pid of forked renderers.
+ */
+static GIOChannel *
+clutter_mozembed_fork_renderer (gboolean private)
+{
+  gint tries;
+  GIOChannel *control;
+  gint control_fd, remote_control_fd;
+
+  if (!use_zygote)
+    return NULL;
+
+  if (!clutter_mozembed_comms_socketpair (&control_fd, &remote_control_fd))
+    return NULL;
+
+  /* Start a new zygote if the last one has gone away */
+  for (tries = 0; tries < 2; tries++)
+    {
+      if (!zygote)
+        {
+          GPid pid;
+
+          if (!(zygote = clutter_mozembed_spawn_plain_renderer ("z", &pid)))
+            break;
+        }
+
+      if (clutter_mozembed_comms_send_fd (zygote, private ? 1 : 0,
+                                          remote_control_fd))
+        {
+          close (remote_control_fd);
+
+          control = g_io_channel_unix_new (control_fd);
+          g_io_channel_set_encoding (control, NULL, NULL);
+          g_io_channel_set_buffered (control, FALSE);
+          g_io_channel_set_close_on_unref (control, TRUE);
+
+          return control;
+        }
+
+      g_io_channel_unref (zygote);
+      zygote = NULL;
+    }
+
+  close (control_fd);
+  close (remote_control_fd);
+
+  return NULL;
+}
+
+static void
+clutter_mozembed_renderer_free (ClutterMozEmbedRenderer *renderer)
+{
+  /* Closing its control socket makes it exit */
+  g_io_channel_unref (renderer->control);
+  g_slice_free (ClutterMozEmbedRenderer, renderer);
+}
+
+/* Tops the pools up, one renderer per main loop iteration */
+static gboolean
+clutter_mozembed_pool_refill_cb (gpointer data)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (pools); i++)
+    {
+      ClutterMozEmbedRenderer *renderer;
+      ClutterMozEmbedPool *pool = &pools[i];
+
+      if (g_queue_get_length (&pool->renderers) >= pool->size)
+        continue;
+
+      renderer = g_slice_new0 (ClutterMozEmbedRenderer);
+      renderer->control = clutter_mozembed_fork_renderer (i);
+      if (!renderer->control)
+        renderer->control =
+          clutter_mozembed_spawn_plain_renderer (i ? "p" : NULL,
+                                                 &renderer->pid);
+
+      if (!renderer->control)
+        {
+          g_slice_free (ClutterMozEmbedRenderer, renderer);
+          break;
+        }
+
+      g_queue_push_tail (&pool->renderers, renderer);
+      return TRUE;
+    }
+
+  pool_source = 0;
+  return FALSE;
+}
+
+static void
+clutter_mozembed_pool_queue_refill (void)
+{
+  if (!pool_source)
+    pool_source = g_idle_add_full (G_PRIORITY_LOW,
+                                   clutter_mozembed_pool_refill_cb,
+                                   NULL, NULL);
+}
+
+static gboolean clutter_mozembed_open_socket (ClutterMozEmbed *self);
+
+/* Passes our connection to a renderer from the pool, if there's one
+ * waiting. Returns FALSE if we need to spawn our own. Renderers in the
+ * pool are spawned without any extra paths, and don't use shared memory
+ * comms, so windows that need those can't use them.
+ */
+static gboolean
+clutter_mozembed_claim_renderer (ClutterMozEmbed *self)
+{
+  ClutterMozEmbedRenderer *renderer;
+  ClutterMozEmbedPrivate *priv = self->priv;
+  ClutterMozEmbedPool *pool = &pools[priv->private ? 1 : 0];
+
+  if (!pool->size || !clutter_mozembed_is_plain (self))
+    return FALSE;
+
+  clutter_mozembed_pool_queue_refill ();
+
+  if (g_queue_is_empty (&pool->renderers) ||
+      ((priv->remote_fd == -1) && !clutter_mozembed_open_socket (self)))
+    {
+      pool->misses ++;
+      return FALSE;
+    }
+
+  while ((renderer = g_queue_pop_head (&pool->renderers)))
+    {
+      if (clutter_mozembed_comms_send_fd (renderer->control, 0,
+                                          priv->remote_fd))
+        {
+          close (priv->remote_fd);
+          priv->remote_fd = -1;
+
+          priv->control = renderer->control;
+          priv->child_pid = renderer->pid;
+          g_slice_free (ClutterMozEmbedRenderer, renderer);
+
+          pool->hits ++;
+          return TRUE;
+        }
+
+      /* It must have exited while it was waiting */
+      clutter_mozembed_renderer_free (renderer);
+    }
+
+  pool->misses ++;
+  return FALSE;
+}
+
+static gboolean
+clutter_mozembed_open_socket (ClutterMozEmbed *self)
+{
+  gint fd;
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  if (!clutter_mozembed_comms_socketpair (&fd, &priv->remote_fd))
+    return FALSE;
+
+  clutter_mozembed_comms_channels_new (fd, &priv->input, &priv->output);
+  clutter_mozembed_watch_input (self);
+
+  return TRUE;
+}
+
+static void
+clutter_mozembed_fall_back_to_pipes (ClutterMozEmbed *self)
+{
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  close (priv->remote_fd);
+  priv->remote_fd = -1;
+
+  if (priv->watch_id)
+    {
+      g_source_remove (priv->watch_id);
+      priv->watch_id = 0;
+    }
+
+  clutter_mozembed_shutdown_channel (&priv->input);
+  clutter_mozembed_shutdown_channel (&priv->output);
+  clutter_mozembed_comms_decoder_clear (&priv->decoder);
+
+  priv->is_loading = TRUE;
+  clutter_mozembed_open_pipes (self);
+}
+
+/* Hands the connection of a window or view created from this one over to
+ * our renderer. Returns the id its socket was passed with, or 0 if the
+ * renderer should connect to the pipes named in input and output instead.
+ */
+static guint
+clutter_mozembed_hand_over (ClutterMozEmbed  *self,
+                            ClutterMozEmbed  *mozembed,
+                            gchar           **input,
+                            gchar           **output)
+{
+  ClutterMozEmbedPrivate *priv = self->priv;
+  ClutterMozEmbedPrivate *new_priv = mozembed->priv;
+
+  *input = *output = NULL;
+
+  if (new_priv->remote_fd != -1)
+    {
+      guint id = ++connection_id;
+
+      if (priv->control &&
+          clutter_mozembed_comms_send_fd (priv->control, id,
+                                          new_priv->remote_fd))
+        {
+          close (new_priv->remote_fd);
+          new_priv->remote_fd = -1;
+          new_priv->control = g_io_channel_ref (priv->control);
+          return id;
+        }
+
+      /* Our renderer wasn't spawned by us, so it can't take sockets */
+      clutter_mozembed_fall_back_to_pipes (mozembed);
+    }
+
+  g_object_get (G_OBJECT (mozembed),
+                "input", input,
+                "output", output,
+                NULL);
+
+  return 0;
+}
+
+/* Finds a renderer for a new window to share under the process policy, or
+ * returns NULL if it should have one of its own.
+ */
+static ClutterMozEmbedProcess *
+clutter_mozembed_find_process (ClutterMozEmbed *self)
+{
+  GList *p;
+  guint n_processes = 0;
+  ClutterMozEmbedProcess *best = NULL;
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  for (p = processes; p; p = p->next)
+    {
+      ClutterMozEmbedProcess *process = p->data;
+
+      /* Private browsing is turned on for the whole renderer */
+      if (process->private != priv->private)
+        continue;
+
+      if (process_policy == CLUTTER_MOZEMBED_PROCESS_PER_SITE)
+        {
+          if (priv->site && process->site &&
+              g_str_equal (priv->site, process->site))
+            return process;
+        }
+      else if (!best || (g_list_length (process->windows) <
+                         g_list_length (best->windows)))
+        best = process;
+
+      n_processes ++;
+    }
+
+  return (n_processes >= max_processes) ? best : NULL;
+}
+
+/* Records that our window's renderer can be shared with later windows,
+ * creating a record for it if it isn't in one already.
+ */
+static void
+clutter_mozembed_add_to_process (ClutterMozEmbed        *self,
+                                 ClutterMozEmbedProcess *process)
+{
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  if (!process)
+    {
+      if ((process_policy == CLUTTER_MOZEMBED_PROCESS_PER_WINDOW) ||
+          !priv->control || !clutter_mozembed_is_plain (self))
+        return;
+
+      process = g_slice_new0 (ClutterMozEmbedProcess);
+      process->control = g_io_channel_ref (priv->control);
+      process->private = priv->private;
+      process->site = g_strdup (priv->site);
+      processes = g_list_prepend (processes, process);
+    }
+
+  priv->process = process;
+  process->windows = g_list_append (process->windows, self);
+}
+
+static void
+clutter_mozembed_leave_process (ClutterMozEmbed *self)
+{
+  ClutterMozEmbedProcess *process = self->priv->process;
+
+  process->windows = g_list_remove (process->windows, self);
+  if (process->windows)
+    return;
+
+  processes = g_list_remove (processes, process);
+  g_io_channel_unref (process->control);
+  g_free (process->site);
+  g_slice_free (ClutterMozEmbedProcess, process);
+}
+
+/* Opens our window in a renderer shared with other windows, if the process
+ * policy says to. Returns FALSE if we need a renderer of our own, in which
+ * case our socket may already be open.
+ */
+static gboolean
+clutter_mozembed_join_process (ClutterMozEmbed *self)
+{
+  GList *w;
+  guint id;
+  ClutterMozEmbedProcess *process;
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  if ((process_policy == CLUTTER_MOZEMBED_PROCESS_PER_WINDOW) ||
+      !clutter_mozembed_is_plain (self) ||
+      !(process = clutter_mozembed_find_process (self)))
+    return FALSE;
+
+  /* Any window still connected to the renderer can ask it for ours */
+  for (w = process->windows; w; w = w->next)
+    if (CLUTTER_MOZEMBED (w->data)->priv->output)
+      break;
+
+  if (!w || !clutter_mozembed_open_socket (self))
+    return FALSE;
+
+  id = ++connection_id;
+  if (!clutter_mozembed_comms_send_fd (process->control, id, priv->remote_fd))
+    {
+      /* It's exited, so don't put any more windows in it */
+      processes = g_list_remove (processes, process);
+      return FALSE;
+    }
+
+  close (priv->remote_fd);
+  priv->remote_fd = -1;
+  priv->control = g_io_channel_ref (process->control);
+
+  clutter_mozembed_comms_send (CLUTTER_MOZEMBED (w->data)->priv->output,
+                               CME_COMMAND_NEW_WINDOW,
+                               G_TYPE_STRING, NULL,
+                               G_TYPE_STRING, NULL,
+                               G_TYPE_UINT, id,
+                               G_TYPE_INVALID);
+
+  clutter_mozembed_add_to_process (self, process);
+
+  return TRUE;
+}
+
+/* Connects us to a renderer, preferring one we can share under the process
+ * policy, then one waiting in the pool, then a forked one, and finally
+ * spawning one. 'argv' is what the renderer is spawned with.
+ */
+static void
+clutter_mozembed_start_renderer (ClutterMozEmbed *self, gchar **argv)
+{
+  ClutterMozEmbedRingFds local;
+  GError *error = NULL;
+  ClutterMozEmbedPrivate *priv = self->priv;
+  gboolean use_ring = priv->shm_comms;
+
+  if (clutter_mozembed_join_process (self))
+    return;
+
+  /* Renderers from the pool have already started up, and just need passing
+   * our connection.
+   */
+  if (clutter_mozembed_claim_renderer (self))
+    {
+      clutter_mozembed_add_to_process (self, NULL);
+      return;
+    }
+
+  if (clutter_mozembed_is_plain (self))
+    priv->control = clutter_mozembed_fork_renderer (priv->private);
+  if (!priv->control)
+    priv->control =
+      clutter_mozembed_spawn_renderer (self, argv, &use_ring, &local,
+                                       &priv->child_pid);
+  if (!priv->control)
+    return;
+
+  /* With shared memory comms, the connection exists as soon as the
+   * renderer does.
+   */
+  if (use_ring)
+    {
+      if (!clutter_mozembed_ring_open (&local, TRUE,
+                                       &priv->input, &priv->output,
+                                       &error))
+        {
+          g_warning ("Error opening shared memory comms: %s",
+                     error->message);
+          g_error_free (error);
+        }
+      else
+        clutter_mozembed_watch_input (self);
+
+      return;
+    }
+
+  /* Otherwise, the renderer expects the socket for its first window to be
+   * the first thing passed to it. The socket may already be open, if there
+   * was no renderer in the pool that could take it.
+   */
+  if ((priv->remote_fd != -1) || clutter_mozembed_open_socket (self))
+    {
+      if (clutter_mozembed_comms_send_fd (priv->control, 0, priv->remote_fd))
+        {
+          close (priv->remote_fd);
+          priv->remote_fd = -1;
+          clutter_mozembed_add_to_process (self, NULL);
+        }
+    }
+}
+
+/* Forgets everything that came from a renderer that's gone */
+static void
+clutter_mozembed_reset_renderer_state (ClutterMozEmbed *self)
+{
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  clutter_mozembed_fail_requests (self, "Lost connection to renderer");
+
+  if (priv->control)
+    {
+      g_io_channel_unref (priv->control);
+      priv->control = NULL;
+    }
+
+  if (priv->state_page)
+    {
+      clutter_mozembed_state_close (priv->state_page, NULL);
+      priv->state_page = NULL;
+    }
+
+  /* Don't ack a frame the new renderer never sent */
+  if (priv->repaint_id)
+    {
+      clutter_threads_remove_repaint_func (priv->repaint_id);
+      priv->repaint_id = 0;
+    }
+
+  g_hash_table_remove_all (priv->shm_surfaces);
+  if (priv->tiles)
+    clutter_mozembed_tiles_clear (priv->tiles);
+
+  priv->motion_ack = TRUE;
+  priv->scroll_ack = TRUE;
+}
+
+/* Brings a window whose renderer has gone away back in a new renderer, if
+ * it's set to auto-recover, and puts it back the way it was. Views sharing
+ * its connection are re-attached. Returns FALSE if the window should be
+ * treated as crashed instead.
+ */
+static gboolean
+clutter_mozembed_recover (ClutterMozEmbed *self)
+{
+  GList *v, *views;
+  gchar *argv[] = {
+    CMH_BIN,
+    NULL, /* Output pipe */
+    NULL, /* Input pipe */
+    NULL, /* Private mode */
+    NULL
+  };
+
+  ClutterMozEmbedPrivate *priv = self->priv;
+
+  if (!priv->auto_recover || priv->closed || priv->read_only ||
+      !(priv->spawn || priv->socket))
+    return FALSE;
+
+  if (priv->recover_timer &&
+      (g_timer_elapsed (priv->recover_timer, NULL) < CME_RECOVER_INTERVAL))
+    {
+      g_warning ("Renderer crashed again straight after recovery");
+      return FALSE;
+    }
+
+  /* Keep hold of where we were, if we weren't still getting back there
+   * after the last recovery.
+   */
+  if (!priv->journal && priv->location)
+    {
+      priv->journal = g_slice_new0 (ClutterMozEmbedJournal);
+      priv->journal->location = g_strdup (priv->location);
+      priv->journal->scroll_x = priv->scroll_x;
+      priv->journal->scroll_y = priv->scroll_y;
+    }
+
+  clutter_mozembed_shutdown_channel (&priv->input);
+  clutter_mozembed_shutdown_channel (&priv->output);
+  clutter_mozembed_comms_decoder_clear (&priv->decoder);
+
+  if (priv->process)
+    {
+      clutter_mozembed_leave_process (self);
+      priv->process = NULL;
+    }
+
+  clutter_mozembed_reset_renderer_state (self);
+
+  argv[1] = priv->output_file;
+  argv[2] = priv->input_file;
+  if (priv->private)
+    argv[3] = "p";
+
+  clutter_mozembed_start_renderer (self, argv);
+  if (!priv->output || !priv->control)
+    return FALSE;
+
+  if (priv->recover_timer)
+    g_timer_start (priv->recover_timer);
+  else
+    priv->recover_timer = g_timer_new ();
+
+  /* The new renderer starts with a blank window, so send it everything
+   * we'd told the old one.
+   */
+  if (priv->width && priv->height)
+    clutter_mozembed_command_resize_send (priv->output,
+                                          priv->width, priv->height);
+
+  if (priv->chrome)
+    clutter_mozembed_comms_send (priv->output,
+                                 CME_COMMAND_SET_CHROME,
+                                 G_TYPE_INT, priv->chrome,
+                                 G_TYPE_INVALID);
+
+  if (!priv->scrollbars)
+    clutter_mozembed_comms_send (priv->output,
+                                 CME_COMMAND_TOGGLE_CHROME,
+                                 G_TYPE_INT, MOZ_HEADLESS_FLAG_SCROLLBARSON,
+                                 G_TYPE_INVALID);
+
+  if (priv->transparent)
+    clutter_mozembed_comms_send (priv->output,
+                                 CME_COMMAND_SET_TRANSPARENT,
+                                 G_TYPE_BOOLEAN, TRUE,
+                                 G_TYPE_INVALID);
+
+  /* The scroll position is restored when the page has loaded */
+  if (priv->journal)
+    clutter_mozembed_open (self, priv->journal->location);
+
+  for (v = priv->views; v; v = v->next)
+    {
+      ClutterMozEmbed *view = v->data;
+      ClutterMozEmbedPrivate *view_priv = view->priv;
+
+      clutter_mozembed_shutdown_channel (&view_priv->output);
+      clutter_mozembed_reset_renderer_state (view);
+
+      if (priv->control)
+        view_priv->control = g_io_channel_ref (priv->control);
+
+      clutter_mozembed_command_add_view_send (priv->output,
+                                              view_priv->view_id);
+      view_priv->output =
+        clutter_mozembed_comms_view_channel_new (priv->output,
+                                                 view_priv->view_id);
+      clutter_mozembed_watch_input (view);
+    }
+
+  /* Handlers may get rid of views */
+  views = g_list_copy (priv->views);
+  g_list_foreach (views, (GFunc)g_object_ref, NULL);
+
+  for (v = views; v; v = v->next)
+    {
+      g_signal_emit (v->data, signals[RECOVERED], 0);
+      g_object_unref (v->data);
+    }
+  g_list_free (views);
+
+  g_signal_emit (self, signals[RECOVERED], 0);
+
+  return TRUE;
+}
+
 static void
 clutter_mozembed_constructed (GObject *object)
 {
-  static gint spawned_windows = 0;
-  gboolean success;
-
   gchar *argv[] = {
     CMH_BIN,
     NULL, /* Output pipe */
@@ -2419,7 +4162,6 @@ clutter_mozembed_constructed (GObject *object)
 
   ClutterMozEmbed *self = CLUTTER_MOZEMBED (object);
   ClutterMozEmbedPrivate *priv = self->priv;
-  GError *error = NULL;
 
   /* Set up out-of-process renderer */
 
@@ -2465,32 +4207,22 @@ clutter_mozembed_constructed (GObject *object)
         }
       else
         {
-          gchar **env = clutter_mozembed_get_paths_env (self);
-
-          success = g_spawn_async_with_pipes (NULL,
-                                              argv,
-                                              env,
-                                              G_SPAWN_SEARCH_PATH /*|
-                                              G_SPAWN_STDERR_TO_DEV_NULL |
-                                              G_SPAWN_STDOUT_TO_DEV_NULL*/,
-                                              NULL,
-                                              NULL,
-                                              &priv->child_pid,
-                                              NULL,
-                                              NULL,
-                                              NULL,
-                                              &error);
-
-          g_strfreev (env);
-
-          if (!success)
-            {
-              g_warning ("Error spawning renderer: %s", error->message);
-              g_error_free (error);
-              return;
-            }
+          clutter_mozembed_start_renderer (self, argv);
+          return;
         }
     }
+  else if (priv->multiplexed)
+    {
+      /* This is connected by clutter_mozembed_new_view_with_parent() */
+      return;
+    }
+  else if (priv->socket && clutter_mozembed_open_socket (self))
+    {
+      /* This will be connected when its parent hands the socket over to
+       * the renderer.
+       */
+      return;
+    }
 
   if (priv->connect_timeout)
     priv->connect_timeout_source =
@@ -2538,10 +4270,8 @@ clutter_mozembed_class_init (ClutterMozEmbedClass *klass)
   actor_class->scroll_event         = clutter_mozembed_scroll_event;
   actor_class->key_focus_in         = clutter_mozembed_key_focus_in;
   actor_class->key_focus_out        = clutter_mozembed_key_focus_out;
-#ifdef SUPPORT_PLUGINS
   actor_class->map                  = clutter_mozembed_map;
   actor_class->unmap                = clutter_mozembed_unmap;
-#endif
 
   texture_class->size_change        = clutter_mozembed_size_change;
 
@@ -2844,6 +4574,131 @@ clutter_mozembed_class_init (ClutterMozEmbedClass *klass)
                                                         G_PARAM_STATIC_BLURB |
                                                         G_PARAM_CONSTRUCT_ONLY));
 
+  g_object_class_install_property (object_class,
+                                   PROP_SHM_COMMS,
+                                   g_param_spec_boolean ("shm-comms",
+                                                         "Shared memory comms",
+                                                         "Whether to talk to a "
+                                                         "spawned renderer "
+                                                         "over shared memory "
+                                                         "instead of pipes.",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_NAME |
+                                                         G_PARAM_STATIC_NICK |
+                                                         G_PARAM_STATIC_BLURB |
+                                                         G_PARAM_CONSTRUCT_ONLY));
+
+  g_object_class_install_property (object_class,
+                                   PROP_SOCKET,
+                                   g_param_spec_boolean ("socket",
+                                                         "Socket",
+                                                         "Whether to connect "
+                                                         "with a socket handed "
+                                                         "to the parent's "
+                                                         "renderer, instead "
+                                                         "of pipes, when not "
+                                                         "spawning.",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_NAME |
+                                                         G_PARAM_STATIC_NICK |
+                                                         G_PARAM_STATIC_BLURB |
+                                                         G_PARAM_CONSTRUCT_ONLY));
+
+  g_object_class_install_property (object_class,
+                                   PROP_SHM_FRAMES,
+                                   g_param_spec_boolean ("shm-frames",
+                                                         "Shared memory frames",
+                                                         "Whether to upload "
+                                                         "frames from shared "
+                                                         "memory instead of "
+                                                         "using texture-from-"
+                                                         "pixmap. Always done "
+                                                         "without the "
+                                                         "extension.",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_NAME |
+                                                         G_PARAM_STATIC_NICK |
+                                                         G_PARAM_STATIC_BLURB |
+                                                         G_PARAM_CONSTRUCT_ONLY));
+
+  g_object_class_install_property (object_class,
+                                   PROP_OVERSCAN,
+                                   g_param_spec_int ("overscan",
+                                                     "Overscan",
+                                                     "Largest margin above "
+                                                     "and below the view "
+                                                     "that's rendered ahead "
+                                                     "of scrolling.",
+                                                     0, G_MAXINT, 0,
+                                                     G_PARAM_READWRITE |
+                                                     G_PARAM_STATIC_NAME |
+                                                     G_PARAM_STATIC_NICK |
+                                                     G_PARAM_STATIC_BLURB));
+
+  g_object_class_install_property (object_class,
+                                   PROP_REQUEST_TIMEOUT,
+                                   g_param_spec_int ("request-timeout",
+                                                     "Request timeout",
+                                                     "Milliseconds to wait "
+                                                     "for an answer from the "
+                                                     "other side before "
+                                                     "giving up on it.",
+                                                     0, G_MAXINT,
+                                                     CME_REQUEST_TIMEOUT,
+                                                     G_PARAM_READWRITE |
+                                                     G_PARAM_STATIC_NAME |
+                                                     G_PARAM_STATIC_NICK |
+                                                     G_PARAM_STATIC_BLURB));
+
+  g_object_class_install_property (object_class,
+                                   PROP_SITE,
+                                   g_param_spec_string ("site",
+                                                        "Site",
+                                                        "Site the window is "
+                                                        "opened for, windows "
+                                                        "for the same site "
+                                                        "share a renderer "
+                                                        "under the per-site "
+                                                        "process policy.",
+                                                        NULL,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_STATIC_NAME |
+                                                        G_PARAM_STATIC_NICK |
+                                                        G_PARAM_STATIC_BLURB |
+                                                        G_PARAM_CONSTRUCT_ONLY));
+
+  g_object_class_install_property (object_class,
+                                   PROP_MULTIPLEXED,
+                                   g_param_spec_boolean ("multiplexed",
+                                                         "Multiplexed",
+                                                         "Whether the view "
+                                                         "shares its parent's "
+                                                         "connection, instead "
+                                                         "of having its own.",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_NAME |
+                                                         G_PARAM_STATIC_NICK |
+                                                         G_PARAM_STATIC_BLURB |
+                                                         G_PARAM_CONSTRUCT_ONLY));
+
+  g_object_class_install_property (object_class,
+                                   PROP_AUTO_RECOVER,
+                                   g_param_spec_boolean ("auto-recover",
+                                                         "Auto-recover",
+                                                         "Whether to reopen "
+                                                         "the page in a new "
+                                                         "renderer when the "
+                                                         "renderer crashes.",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_NAME |
+                                                         G_PARAM_STATIC_NICK |
+                                                         G_PARAM_STATIC_BLURB));
+
   signals[PROGRESS] =
     g_signal_new ("progress",
                   G_TYPE_FROM_CLASS (klass),
@@ -2952,6 +4807,15 @@ clutter_mozembed_class_init (ClutterMozEmbedClass *klass)
                   _clutter_mozembed_marshal_VOID__UINT_STRING_STRING_STRING_STRING,
                   G_TYPE_NONE, 5, G_TYPE_UINT,
                   G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
+
+  signals[RECOVERED] =
+    g_signal_new ("recovered",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  G_STRUCT_OFFSET (ClutterMozEmbedClass, recovered),
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__VOID,
+                  G_TYPE_NONE, 0);
 }
 
 static void
@@ -3019,15 +4883,25 @@ clutter_mozembed_init (ClutterMozEmbed *self)
                                            _destroy_download_cb);
   priv->scrollbars = TRUE;
   priv->is_loading = TRUE;
+  priv->remote_fd = -1;
+  priv->visible = TRUE;
+  priv->render_scale = 1.0;
+  priv->request_timeout = CME_REQUEST_TIMEOUT;
+  priv->shm_surfaces = g_hash_table_new_full (NULL, NULL, NULL,
+                                              (GDestroyNotify)
+                                              shm_surface_free);
 
   clutter_actor_set_reactive (CLUTTER_ACTOR (self), TRUE);
+  g_signal_connect (self, "notify::opacity",
+                    G_CALLBACK (clutter_mozembed_opacity_cb), NULL);
 
   /* Turn off sync-size (we manually size the texture on allocate) and turn
-   * on automatic tfp updates.
+   * off automatic tfp updates; the back-end tells us which area changed with
+   * each update.
    */
   g_object_set (G_OBJECT (self),
                 "sync-size", FALSE,
-                "automatic-updates", TRUE,
+                "automatic-updates", FALSE,
                 "disable-slicing", TRUE,
                 "filter-quality", CLUTTER_TEXTURE_QUALITY_HIGH,
                 NULL);
@@ -3060,6 +4934,7 @@ clutter_mozembed_new (void)
 ClutterActor *
 clutter_mozembed_new_with_parent (ClutterMozEmbed *parent)
 {
+  guint id;
   gchar *input, *output;
   ClutterActor *mozembed;
 
@@ -3069,17 +4944,22 @@ clutter_mozembed_new_with_parent (ClutterMozEmbed *parent)
   /* Open up a new window using the same process as the provided
    * ClutterMozEmbed.
    */
-  mozembed = g_object_new (CLUTTER_TYPE_MOZEMBED, "spawn", FALSE, NULL);
-  g_object_get (G_OBJECT (mozembed),
-                "input", &input,
-                "output", &output,
-                NULL);
+  mozembed = g_object_new (CLUTTER_TYPE_MOZEMBED,
+                           "spawn", FALSE,
+                           "socket", parent->priv->control != NULL,
+                           NULL);
   CLUTTER_MOZEMBED (mozembed)->priv->private = parent->priv->private;
 
+  id = clutter_mozembed_hand_over (parent, CLUTTER_MOZEMBED (mozembed),
+                                   &input, &output);
+  if (parent->priv->process)
+    clutter_mozembed_add_to_process (CLUTTER_MOZEMBED (mozembed),
+                                     parent->priv->process);
   clutter_mozembed_comms_send (parent->priv->output,
                                CME_COMMAND_NEW_WINDOW,
                                G_TYPE_STRING, input,
                                G_TYPE_STRING, output,
+                               G_TYPE_UINT, id,
                                G_TYPE_INVALID);
 
   g_free (input);
@@ -3091,7 +4971,11 @@ clutter_mozembed_new_with_parent (ClutterMozEmbed *parent)
 ClutterActor *
 clutter_mozembed_new_for_new_window ()
 {
-  return g_object_new (CLUTTER_TYPE_MOZEMBED, "spawn", FALSE, NULL);
+  /* This will be handed to the renderer over a socket, if it can take one */
+  return g_object_new (CLUTTER_TYPE_MOZEMBED,
+                       "spawn", FALSE,
+                       "socket", TRUE,
+                       NULL);
 }
 
 ClutterActor *
@@ -3108,6 +4992,45 @@ clutter_mozembed_new_view (void)
   return CLUTTER_ACTOR (mozembed);
 }
 
+ClutterActor *
+clutter_mozembed_new_view_with_parent (ClutterMozEmbed *parent)
+{
+  ClutterMozEmbed *mozembed, *carrier;
+  ClutterMozEmbedPrivate *priv;
+
+  /* Create a read-only mozembed that shares the connection of the parent,
+   * or of the window the parent is a view of. This needs no new pipes,
+   * descriptors or watches.
+   */
+  mozembed = g_object_new (CLUTTER_TYPE_MOZEMBED,
+                           "read-only", TRUE,
+                           "spawn", FALSE,
+                           "multiplexed", TRUE,
+                           NULL);
+  priv = mozembed->priv;
+
+  carrier = parent->priv->view_id ? parent->priv->carrier : parent;
+  if (!carrier || !carrier->priv->output)
+    return CLUTTER_ACTOR (mozembed);
+
+  priv->carrier = carrier;
+  priv->view_id = ++carrier->priv->last_view_id;
+  carrier->priv->views = g_list_prepend (carrier->priv->views, mozembed);
+
+  /* Windows opened from the view can still be handed over as sockets */
+  if (carrier->priv->control)
+    priv->control = g_io_channel_ref (carrier->priv->control);
+
+  clutter_mozembed_command_add_view_send (carrier->priv->output,
+                                          priv->view_id);
+  priv->output =
+    clutter_mozembed_comms_view_channel_new (carrier->priv->output,
+                                             priv->view_id);
+  clutter_mozembed_watch_input (mozembed);
+
+  return CLUTTER_ACTOR (mozembed);
+}
+
 void
 clutter_mozembed_connect_view (ClutterMozEmbed *mozembed,
                                const gchar     *input,
@@ -3117,6 +5040,7 @@ clutter_mozembed_connect_view (ClutterMozEmbed *mozembed,
                                CME_COMMAND_NEW_VIEW,
                                G_TYPE_STRING, input,
                                G_TYPE_STRING, output,
+                               G_TYPE_UINT, 0,
                                G_TYPE_INVALID);
 }
 
@@ -3152,20 +5076,132 @@ clutter_mozembed_get_icon (ClutterMozEmbed *mozembed)
   return priv->icon;
 }
 
+/* Reads the back-end's current page state, if it's shared with us. If the
+ * page can't be read, the last state we synced from it is used instead.
+ */
+static gboolean
+clutter_mozembed_read_state (ClutterMozEmbed      *mozembed,
+                             ClutterMozEmbedState *state)
+{
+  ClutterMozEmbedPrivate *priv = mozembed->priv;
+
+  if (!priv->state_page)
+    return FALSE;
+
+  return clutter_mozembed_state_read (priv->state_page, state);
+}
+
 gboolean
 clutter_mozembed_can_go_back (ClutterMozEmbed *mozembed)
 {
+  ClutterMozEmbedState state;
   ClutterMozEmbedPrivate *priv = mozembed->priv;
+
+  if (clutter_mozembed_read_state (mozembed, &state))
+    return state.can_go_back;
+
   return priv->can_go_back;
 }
 
 gboolean
 clutter_mozembed_can_go_forward (ClutterMozEmbed *mozembed)
 {
+  ClutterMozEmbedState state;
   ClutterMozEmbedPrivate *priv = mozembed->priv;
+
+  if (clutter_mozembed_read_state (mozembed, &state))
+    return state.can_go_forward;
+
   return priv->can_go_forward;
 }
 
+/* Reads the answer to a yes/no request, and frees the reply */
+static gboolean
+clutter_mozembed_reply_get_boolean (ClutterMozEmbedMessage *reply)
+{
+  gboolean value;
+
+  if (!reply)
+    return FALSE;
+
+  value = clutter_mozembed_comms_receive_boolean (reply);
+  clutter_mozembed_comms_message_free (reply);
+
+  return value;
+}
+
+void
+clutter_mozembed_query_can_go_back_async (ClutterMozEmbed     *mozembed,
+                                          GCancellable        *cancellable,
+                                          GAsyncReadyCallback  callback,
+                                          gpointer             user_data)
+{
+  clutter_mozembed_request_async (mozembed,
+                                  CME_COMMAND_GET_CAN_GO_BACK,
+                                  -1,
+                                  cancellable,
+                                  callback,
+                                  user_data,
+                                  G_TYPE_INVALID);
+}
+
+gboolean
+clutter_mozembed_query_can_go_back_finish (ClutterMozEmbed  *mozembed,
+                                           GAsyncResult     *result,
+                                           GError          **error)
+{
+  return clutter_mozembed_reply_get_boolean (
+           clutter_mozembed_request_finish (mozembed, result, error));
+}
+
+gboolean
+clutter_mozembed_query_can_go_back_sync (ClutterMozEmbed  *mozembed,
+                                         GError          **error)
+{
+  return clutter_mozembed_reply_get_boolean (
+           clutter_mozembed_request_sync (mozembed,
+                                          CME_COMMAND_GET_CAN_GO_BACK,
+                                          -1,
+                                          error,
+                                          G_TYPE_INVALID));
+}
+
+void
+clutter_mozembed_query_can_go_forward_async (ClutterMozEmbed     *mozembed,
+                                             GCancellable        *cancellable,
+                                             GAsyncReadyCallback  callback,
+                                             gpointer             user_data)
+{
+  clutter_mozembed_request_async (mozembed,
+                                  CME_COMMAND_GET_CAN_GO_FORWARD,
+                                  -1,
+                                  cancellable,
+                                  callback,
+                                  user_data,
+                                  G_TYPE_INVALID);
+}
+
+gboolean
+clutter_mozembed_query_can_go_forward_finish (ClutterMozEmbed  *mozembed,
+                                              GAsyncResult     *result,
+                                              GError          **error)
+{
+  return clutter_mozembed_reply_get_boolean (
+           clutter_mozembed_request_finish (mozembed, result, error));
+}
+
+gboolean
+clutter_mozembed_query_can_go_forward_sync (ClutterMozEmbed  *mozembed,
+                                            GError          **error)
+{
+  return clutter_mozembed_reply_get_boolean (
+           clutter_mozembed_request_sync (mozembed,
+                                          CME_COMMAND_GET_CAN_GO_FORWARD,
+                                          -1,
+                                          error,
+                                          G_TYPE_INVALID));
+}
+
 void
 clutter_mozembed_back (ClutterMozEmbed *mozembed)
 {
@@ -3234,6 +5270,111 @@ clutter_mozembed_set_async_scroll (ClutterMozEmbed *mozembed, gboolean async)
   mozembed->priv->async_scroll = async;
 }
 
+static void
+clutter_mozembed_set_overscan_margin (ClutterMozEmbed *mozembed, gint margin)
+{
+  ClutterMozEmbedPrivate *priv = mozembed->priv;
+
+  /* Round up to a whole step, without going over the limit */
+  margin = MIN (priv->overscan,
+                (margin + CME_OVERSCAN_STEP - 1) / CME_OVERSCAN_STEP *
+                CME_OVERSCAN_STEP);
+
+  if (priv->overscan_margin == margin)
+    return;
+
+  priv->overscan_margin = margin;
+  if (priv->output)
+    clutter_mozembed_command_overscan_send (priv->output, margin);
+}
+
+static gboolean
+clutter_mozembed_overscan_idle_cb (ClutterMozEmbed *mozembed)
+{
+  ClutterMozEmbedPrivate *priv = mozembed->priv;
+
+  priv->overscan_source = 0;
+  priv->scroll_speed = 0;
+  clutter_mozembed_set_overscan_margin (mozembed, priv->overscan / 4);
+
+  return FALSE;
+}
+
+/* Grows the overscan margin to cover a quarter of a second of scrolling
+ * at the recent speed. Resizing makes Gecko redraw everything, so it only
+ * shrinks again once scrolling has stopped for a while.
+ */
+static void
+clutter_mozembed_adapt_overscan (ClutterMozEmbed *mozembed, gint dy)
+{
+  gdouble elapsed;
+  ClutterMozEmbedPrivate *priv = mozembed->priv;
+
+  if (!priv->overscan)
+    return;
+
+  if (!priv->scroll_timer)
+    priv->scroll_timer = g_timer_new ();
+  else
+    {
+      elapsed = MAX (g_timer_elapsed (priv->scroll_timer, NULL), 0.001);
+      priv->scroll_speed = (priv->scroll_speed + ABS (dy) / elapsed) / 2;
+    }
+  g_timer_start (priv->scroll_timer);
+
+  if (priv->scroll_speed / 4 > priv->overscan_margin)
+    clutter_mozembed_set_overscan_margin (mozembed, priv->scroll_speed / 4);
+
+  if (priv->overscan_source)
+    g_source_remove (priv->overscan_source);
+  priv->overscan_source =
+    g_timeout_add_seconds (1, (GSourceFunc)clutter_mozembed_overscan_idle_cb,
+                           mozembed);
+}
+
+gint
+clutter_mozembed_get_overscan (ClutterMozEmbed *mozembed)
+{
+  return mozembed->priv->overscan;
+}
+
+void
+clutter_mozembed_set_overscan (ClutterMozEmbed *mozembed, gint overscan)
+{
+  ClutterMozEmbedPrivate *priv = mozembed->priv;
+
+  if (priv->overscan == overscan)
+    return;
+
+  priv->overscan = MAX (0, overscan);
+  clutter_mozembed_set_overscan_margin (mozembed, priv->overscan / 4);
+  g_object_notify (G_OBJECT (mozembed), "overscan");
+}
+
+gint
+clutter_mozembed_get_request_timeout (ClutterMozEmbed *mozembed)
+{
+  return mozembed->priv->request_timeout;
+}
+
+void
+clutter_mozembed_set_request_timeout (ClutterMozEmbed *mozembed,
+                                      gint             timeout)
+{
+  ClutterMozEmbedPrivate *priv = mozembed->priv;
+
+  timeout = MAX (0, timeout);
+  if (priv->request_timeout == timeout)
+    return;
+
+  /* The back-end uses the same deadline for what it asks of us */
+  priv->request_timeout = timeout;
+  if (priv->output)
+    clutter_mozembed_command_request_timeout_send (priv->output, timeout);
+
+  g_object_notify (G_OBJECT (mozembed), "request-timeout");
+}
+
 gboolean
 clutter_mozembed_get_scrollbars (ClutterMozEmbed *mozembed)
 {
@@ -3260,11 +5401,8 @@ clutter_mozembed_scroll_by (ClutterMozEmbed *mozembed, gint dx, gint dy)
 {
   ClutterMozEmbedPrivate *priv = mozembed->priv;
 
-  clutter_mozembed_comms_send (priv->output,
-                               CME_COMMAND_SCROLL,
-                               G_TYPE_INT, dx,
-                               G_TYPE_INT, dy,
-                               G_TYPE_INVALID);
+  clutter_mozembed_command_scroll_send (priv->output, dx, dy);
+  clutter_mozembed_adapt_overscan (mozembed, dy);
 
   priv->offset_x -= dx;
   priv->offset_y -= dy;
@@ -3280,13 +5418,12 @@ clutter_mozembed_scroll_to (ClutterMozEmbed *mozembed, gint x, gint y)
 {
   ClutterMozEmbedPrivate *priv = mozembed->priv;
 
+  clutter_mozembed_adapt_overscan (mozembed,
+                                   y - (priv->scroll_y - priv->offset_y));
+
   if (priv->scroll_ack)
     {
-      clutter_mozembed_comms_send (priv->output,
-                                   CME_COMMAND_SCROLL_TO,
-                                   G_TYPE_INT, x,
-                                   G_TYPE_INT, y,
-                                   G_TYPE_INVALID);
+      clutter_mozembed_command_scroll_to_send (priv->output, x, y);
       priv->scroll_ack = FALSE;
     }
   else
@@ -3316,7 +5453,12 @@ clutter_mozembed_is_loading (ClutterMozEmbed *mozembed)
 gdouble
 clutter_mozembed_get_progress (ClutterMozEmbed *mozembed)
 {
+  ClutterMozEmbedState state;
   ClutterMozEmbedPrivate *priv = mozembed->priv;
+
+  if (clutter_mozembed_read_state (mozembed, &state))
+    return state.progress;
+
   return priv->progress;
 }
 
@@ -3329,6 +5471,11 @@ clutter_mozembed_get_cursor (ClutterMozEmbed *mozembed)
 guint
 clutter_mozembed_get_security (ClutterMozEmbed *mozembed)
 {
+  ClutterMozEmbedState state;
+
+  if (clutter_mozembed_read_state (mozembed, &state))
+    return state.security;
+
   return mozembed->priv->security;
 }
 
@@ -3442,9 +5589,105 @@ clutter_mozembed_set_transparent (ClutterMozEmbed *mozembed,
 {
   ClutterMozEmbedPrivate *priv = mozembed->priv;
 
+  priv->transparent = transparent;
   clutter_mozembed_comms_send (priv->output,
                                CME_COMMAND_SET_TRANSPARENT,
                                G_TYPE_BOOLEAN, transparent,
                                G_TYPE_INVALID);
 }
 
+
+gboolean
+clutter_mozembed_get_auto_recover (ClutterMozEmbed *mozembed)
+{
+  return mozembed->priv->auto_recover;
+}
+
+void
+clutter_mozembed_set_auto_recover (ClutterMozEmbed *mozembed,
+                                   gboolean         recover)
+{
+  ClutterMozEmbedPrivate *priv = mozembed->priv;
+
+  if (priv->auto_recover != recover)
+    {
+      priv->auto_recover = recover;
+      g_object_notify (G_OBJECT (mozembed), "auto-recover");
+    }
+}
+
+/* Keeps 'size' renderers started up and waiting for new windows, so that
+ * new windows don't wait for a renderer to start up. Windows with extra
+ * paths, or that use shared memory comms, always spawn their own.
+ */
+void
+clutter_mozembed_set_pool_size (gboolean private, guint size)
+{
+  ClutterMozEmbedPool *pool = &pools[private ? 1 : 0];
+
+  pool->size = size;
+  while (g_queue_get_length (&pool->renderers) > size)
+    clutter_mozembed_renderer_free (g_queue_pop_tail (&pool->renderers));
+
+  clutter_mozembed_pool_queue_refill ();
+}
+
+guint
+clutter_mozembed_get_pool_size (gboolean private)
+{
+  return pools[private ? 1 : 0].size;
+}
+
+/* Counts the windows that could use the pool that found a renderer
+ * waiting, and those that had to spawn their own.
+ */
+void
+clutter_mozembed_get_pool_stats (gboolean  private,
+                                 guint    *hits,
+                                 guint    *misses)
+{
+  ClutterMozEmbedPool *pool = &pools[private ? 1 : 0];
+
+  if (hits)
+    *hits = pool->hits;
+  if (misses)
+    *misses = pool->misses;
+}
+
+/* Has new renderers forked from a zygote renderer, which has loaded
+ * Mozilla's libraries but not started it up, rather than spawned. They
+ * start faster and share the zygote's copy of the libraries' data. Windows
+ * with extra paths, or that use shared memory comms, are still spawned.
+ */
+void
+clutter_mozembed_set_zygote (gboolean enable)
+{
+  use_zygote = enable;
+
+  /* Closing its socket makes the zygote exit */
+  if (!enable && zygote)
+    {
+      g_io_channel_unref (zygote);
+      zygote = NULL;
+    }
+}
+
+/* Decides which renderer new windows are opened in. By default each window
+ * has its own, but windows with the same "site" can share one, or all
+ * windows can share 'n' renderers, with new windows going to whichever has
+ * the fewest. Private windows never share with normal ones, and windows
+ * with extra paths, or that use shared memory comms, have their own.
+ */
+void
+clutter_mozembed_set_process_policy (ClutterMozEmbedProcessPolicy policy,
+                                     guint                        n)
+{
+  process_policy = policy;
+  max_processes = MAX (n, 1);
+}
+
+ClutterMozEmbedProcessPolicy
+clutter_mozembed_get_process_policy (void)
+{
+  return process_policy;
+}
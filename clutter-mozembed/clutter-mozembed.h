@@ -23,6 +23,7 @@
 
 #include <gtk/gtk.h>
 #include <glib-object.h>
+#include <gio/gio.h>
 #include <clutter/clutter.h>
 #include <clutter/x11/clutter-x11.h>
 #include <clutter/glx/clutter-glx.h>
@@ -88,6 +89,7 @@ typedef struct {
                          const gchar     *ctx_href,
                          const gchar     *ctx_img_href,
                          const gchar     *selected_txt);
+  void (* recovered)    (ClutterMozEmbed *mozembed);
 } ClutterMozEmbedClass;
 
 /* Security property's flags match Mozilla's nsIWebProgressListener values */
@@ -103,12 +105,19 @@ typedef enum {
   CLUTTER_MOZEMBED_BAD_CERT = (1 << 24)
 } ClutterMozEmbedSecurity;
 
+typedef enum {
+  CLUTTER_MOZEMBED_PROCESS_PER_WINDOW,
+  CLUTTER_MOZEMBED_PROCESS_PER_SITE,
+  CLUTTER_MOZEMBED_PROCESS_SHARED
+} ClutterMozEmbedProcessPolicy;
+
 GType clutter_mozembed_get_type (void);
 
 ClutterActor *clutter_mozembed_new (void);
 ClutterActor *clutter_mozembed_new_with_parent (ClutterMozEmbed *parent);
 ClutterActor *clutter_mozembed_new_for_new_window (void);
 ClutterActor *clutter_mozembed_new_view (void);
+ClutterActor *clutter_mozembed_new_view_with_parent (ClutterMozEmbed *parent);
 
 void clutter_mozembed_connect_view (ClutterMozEmbed *mozembed,
                                     const gchar     *input,
@@ -120,6 +129,28 @@ const gchar *clutter_mozembed_get_title (ClutterMozEmbed *mozembed);
 const gchar *clutter_mozembed_get_icon (ClutterMozEmbed *mozembed);
 gboolean clutter_mozembed_can_go_back (ClutterMozEmbed *mozembed);
 gboolean clutter_mozembed_can_go_forward (ClutterMozEmbed *mozembed);
+
+/* Ask the renderer directly, rather than going by the last state it
+ * reported. These fail if it doesn't answer within the request timeout.
+ */
+void clutter_mozembed_query_can_go_back_async (ClutterMozEmbed     *mozembed,
+                                               GCancellable        *cancellable,
+                                               GAsyncReadyCallback  callback,
+                                               gpointer             user_data);
+gboolean clutter_mozembed_query_can_go_back_finish (ClutterMozEmbed  *mozembed,
+                                                   GAsyncResult     *result,
+                                                   GError          **error);
+gboolean clutter_mozembed_query_can_go_back_sync (ClutterMozEmbed  *mozembed,
+                                                 GError          **error);
+void clutter_mozembed_query_can_go_forward_async (ClutterMozEmbed     *mozembed,
+                                                  GCancellable        *cancellable,
+                                                  GAsyncReadyCallback  callback,
+                                                  gpointer             user_data);
+gboolean clutter_mozembed_query_can_go_forward_finish (ClutterMozEmbed  *mozembed,
+                                                      GAsyncResult     *result,
+                                                      GError          **error);
+gboolean clutter_mozembed_query_can_go_forward_sync (ClutterMozEmbed  *mozembed,
+                                                    GError          **error);
 void clutter_mozembed_back (ClutterMozEmbed *mozembed);
 void clutter_mozembed_forward (ClutterMozEmbed *mozembed);
 void clutter_mozembed_stop (ClutterMozEmbed *mozembed);
@@ -138,6 +169,11 @@ gboolean clutter_mozembed_get_async_scroll (ClutterMozEmbed *mozembed);
 void clutter_mozembed_set_scrollbars (ClutterMozEmbed *mozembed, gboolean show);
 void clutter_mozembed_set_async_scroll (ClutterMozEmbed *mozembed,
                                         gboolean         async);
+gint clutter_mozembed_get_overscan (ClutterMozEmbed *mozembed);
+void clutter_mozembed_set_overscan (ClutterMozEmbed *mozembed, gint overscan);
+gint clutter_mozembed_get_request_timeout (ClutterMozEmbed *mozembed);
+void clutter_mozembed_set_request_timeout (ClutterMozEmbed *mozembed,
+                                           gint             timeout);
 void clutter_mozembed_scroll_by (ClutterMozEmbed *mozembed, gint dx, gint dy);
 void clutter_mozembed_scroll_to (ClutterMozEmbed *mozembed, gint x, gint y);
 
@@ -161,6 +197,20 @@ void clutter_mozembed_find_prev (ClutterMozEmbed *mozembed);
 void clutter_mozembed_set_transparent (ClutterMozEmbed *mozembed,
                                        gboolean         transparent);
 
+gboolean clutter_mozembed_get_auto_recover (ClutterMozEmbed *mozembed);
+void clutter_mozembed_set_auto_recover (ClutterMozEmbed *mozembed,
+                                        gboolean         recover);
+
+void clutter_mozembed_set_pool_size (gboolean private, guint size);
+guint clutter_mozembed_get_pool_size (gboolean private);
+void clutter_mozembed_get_pool_stats (gboolean  private,
+                                      guint    *hits,
+                                      guint    *misses);
+void clutter_mozembed_set_zygote (gboolean enable);
+void clutter_mozembed_set_process_policy (ClutterMozEmbedProcessPolicy policy,
+                                          guint                        n);
+ClutterMozEmbedProcessPolicy clutter_mozembed_get_process_policy (void);
+
 G_END_DECLS
 
 #endif /* _CLUTTER_MOZEMBED */
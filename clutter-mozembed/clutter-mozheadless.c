@@ -24,7 +24,10 @@
 #include <gtk/gtk.h>
 #include <gdk/gdkx.h>
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
 #endif
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xrender.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <stdlib.h>
@@ -32,11 +35,18 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
 
 #include "clutter-mozheadless.h"
 #include "clutter-mozembed-comms.h"
+#include "clutter-mozembed-comms-stubs.h"
+#include "clutter-mozembed-ring.h"
+#include "clutter-mozembed-state.h"
 #include "clutter-mozheadless-history.h"
 #include "clutter-mozheadless-prefs.h"
 #include "clutter-mozheadless-downloads.h"
@@ -65,7 +75,9 @@ enum
   PROP_OUTPUT,
   PROP_XID,
   PROP_CONNECT_TIMEOUT,
-  PROP_PRIVATE
+  PROP_PRIVATE,
+  PROP_INPUT_CHANNEL,
+  PROP_OUTPUT_CHANNEL
 };
 
 enum
@@ -77,26 +89,104 @@ enum
 
 static guint signals[LAST_SIGNAL] = { 0, };
 
+/* A buffer that views are sent updates from */
+typedef struct
+{
+  Drawable  pixmap;
+  gint      refs;  /* Views that haven't acknowledged an update from it */
+  Region    stale; /* Area that changed since it was last copied to */
+  XShmSegmentInfo shm; /* shmaddr is set when the pixmap is shared */
+  Picture   picture; /* Set when frames are scaled down into it */
+} ClutterMozHeadlessBuffer;
+
+/* A frame that has been copied to a front buffer, the damaged area is
+ * what changed since the previous frame.
+ */
+typedef struct
+{
+  gint                          buffer;
+  XRectangle                    area;
+  ClutterMozEmbedFeedbackUpdate update;
+} ClutterMozHeadlessFrame;
+
 struct _ClutterMozHeadlessPrivate
 {
   /* Connection/comms variables */
   GList           *views;
   gint             waiting_for_ack;
-  gboolean         pending_resize;
   gchar           *input_file;
   gchar           *output_file;
+  GIOChannel      *input_channel;
+  GIOChannel      *output_channel;
 
   /* Surface property variables */
-  Drawable         buffer[2];
-  GC               buffer_gc;
+  Drawable                  back_buffer;
+  ClutterMozHeadlessBuffer *buffers;
+  gint                      n_buffers;
+  gint                      buffer_width;
+  gint                      buffer_height;
+  gint                      buffer_depth;
+  GC                        buffer_gc;
+  gboolean                  buffer_shm;
+
+  /* Frames are scaled down by 'render_scale' when no view shows them at
+   * full size. Gecko still draws at full size, so the back buffer is
+   * 'back_width' by 'back_height', and 'buffer_scale' is the scale the
+   * front buffers were made for.
+   */
+  gdouble                   render_scale;
+  gdouble                   buffer_scale;
+  gint                      back_width;
+  gint                      back_height;
+  Picture                   back_picture;
+
+  /* Whether the front buffers should be shared memory pixmaps, which views
+   * without texture-from-pixmap read frames from directly.
+   */
+  gboolean                  shm_frames;
+
+  /* Front buffers replaced by a resize, which views keep showing until
+   * they're sent a frame from the new ones. 'generation' counts the
+   * replacements.
+   */
+  GList                    *retired;
+  guint                     generation;
   gint             surface_width;
   gint             surface_height;
   gboolean         transparent;
 
+  /* The views see a 'viewport' of the surface, at a position in the
+   * document. The surface extends 'overscan' pixels above and below it,
+   * so Gecko renders some of the document that's just out of view.
+   * 'gecko_scroll_y' is where we last saw Gecko scrolled to.
+   */
+  gint             overscan;
+  gint             viewport_x;
+  gint             viewport_y;
+  gint             viewport_width;
+  gint             viewport_height;
+  gint             gecko_scroll_y;
+
+  /* Set while none of the views are on screen, Gecko isn't given a
+   * surface to draw into then.
+   */
+  gboolean         suspended;
+
+  /* The buffer and details of the last frame sent to the views */
+  gint                          front;
+  ClutterMozEmbedFeedbackUpdate latest;
+
+  /* Damage to the back buffer that hasn't been copied to the front yet */
+  Region           damage;
+  guint            damage_source;
+
   /* Synchronous call variables */
   ClutterMozEmbedCommand  sync_call;
+  guint                   sync_sequence;
+  gint                    request_timeout;
   gchar                  *new_input_file;
   gchar                  *new_output_file;
+  gint                    new_fd;
 
   /* Connection timeout variables */
   guint            connect_timeout;
@@ -105,23 +195,68 @@ struct _ClutterMozHeadlessPrivate
   /* Page property variables */
   gboolean         private;
   guint            security;
+  gdouble          progress;
+  gboolean         can_go_back;
+  gboolean         can_go_forward;
+
+  /* Page properties that have changed since they were last sent */
+  guint            dirty_state;
+  guint            state_source;
 };
 
+/* Page state where only the latest value matters. Changes are collected and
+ * sent once per main-loop iteration, rather than as they happen.
+ */
+enum
+{
+  CMH_STATE_LOCATION       = 1 << 0,
+  CMH_STATE_TITLE          = 1 << 1,
+  CMH_STATE_ICON           = 1 << 2,
+  CMH_STATE_SECURITY       = 1 << 3,
+  CMH_STATE_CAN_GO_BACK    = 1 << 4,
+  CMH_STATE_CAN_GO_FORWARD = 1 << 5,
+  CMH_STATE_PROGRESS       = 1 << 6
+};
+
+/* State that's published in the shared page, when there is one */
+#define CMH_STATE_PAGE (CMH_STATE_SECURITY | CMH_STATE_CAN_GO_BACK | \
+                        CMH_STATE_CAN_GO_FORWARD | CMH_STATE_PROGRESS)
+
 static GMainLoop *mainloop;
 static gint spawned_heads = 0;
 
-static void block_until_command (ClutterMozHeadless     *moz_headless,
-                                 ClutterMozEmbedCommand  command);
+/* Control socket that the front-end passes connections over, and the
+ * connections that have been received but not yet claimed.
+ */
+static GIOChannel *control_channel = NULL;
+static GHashTable *passed_fds = NULL;
+
+/* Number of front buffers, set with CLUTTER_MOZEMBED_BUFFERS (which counts
+ * the back buffer too). With more than one, a view that's slow to
+ * acknowledge its updates doesn't hold up the others.
+ */
+#define CMH_DEFAULT_FRONT_BUFFERS 2
+static gint n_front_buffers = CMH_DEFAULT_FRONT_BUFFERS;
+
+static gboolean block_until_command (ClutterMozHeadless     *moz_headless,
+                                     ClutterMozEmbedCommand  command,
+                                     guint                   sequence,
+                                     gint                    timeout);
 
 static gboolean input_io_func (GIOChannel              *source,
                                GIOCondition             condition,
                                ClutterMozHeadlessView  *view);
 
+static void disconnect_view (ClutterMozHeadlessView *view);
+
 static void security_change_cb (ClutterMozHeadless *self,
                                 const gchar        *uri,
                                 guint               state,
                                 gpointer            ignored);
 
+static void clutter_moz_headless_update_suspended (ClutterMozHeadless *self);
+static void clutter_moz_headless_update_render_scale (ClutterMozHeadless *self);
+
 Display *
 clutter_moz_headless_get_default_display ()
 {
@@ -137,24 +272,216 @@ clutter_moz_headless_get_default_display ()
   return dpy;
 }
 
-void
-send_feedback_all (ClutterMozHeadless      *headless,
-                   ClutterMozEmbedFeedback  id,
-                   ...)
+/* Sends an encoded message to every view, and frees it */
+static void
+send_encoded_all (ClutterMozHeadless *headless, GByteArray *data)
 {
   GList *v;
   ClutterMozHeadlessPrivate *priv = headless->priv;
 
-  va_list args;
+  for (v = priv->views; v; v = v->next)
+    {
+      ClutterMozHeadlessView *view = v->data;
+      clutter_mozembed_comms_send_encoded (view->output, data);
+    }
+
+  g_byte_array_free (data, TRUE);
+}
+
+/* Sends an encoded message to the views that read the simple page
+ * properties from a shared page, or to those that don't, and frees it.
+ */
+static void
+send_encoded_paged (ClutterMozHeadless *headless,
+                    GByteArray         *data,
+                    gboolean            paged)
+{
+  GList *v;
+  ClutterMozHeadlessPrivate *priv = headless->priv;
 
   for (v = priv->views; v; v = v->next)
     {
       ClutterMozHeadlessView *view = v->data;
+      if ((view->state_page != NULL) == paged)
+        clutter_mozembed_comms_send_encoded (view->output, data);
+    }
 
-      va_start (args, id);
-      clutter_mozembed_comms_sendv (view->output, id, args);
-      va_end (args);
+  g_byte_array_free (data, TRUE);
+}
+
+/* Copies the simple page properties to a view's shared page */
+static void
+write_view_state (ClutterMozHeadlessView *view)
+{
+  ClutterMozEmbedState page_state;
+  ClutterMozHeadlessPrivate *priv = view->parent->priv;
+
+  page_state.progress = priv->progress;
+  page_state.security = priv->security;
+  page_state.can_go_back = priv->can_go_back;
+  page_state.can_go_forward = priv->can_go_forward;
+  clutter_mozembed_state_write (view->state_page, &page_state);
+}
+
+static GByteArray *
+encode_feedback (ClutterMozEmbedFeedback id, ...)
+{
+  GByteArray *data;
+  va_list args;
+
+  va_start (args, id);
+  data = clutter_mozembed_comms_encode (id, args);
+  va_end (args);
+
+  return data;
+}
+
+static void
+flush_state (ClutterMozHeadless *headless)
+{
+  guint dirty;
+  gchar *string;
+  MozHeadless *headless_base = MOZ_HEADLESS (headless);
+  ClutterMozHeadlessPrivate *priv = headless->priv;
+
+  if (priv->state_source)
+    {
+      g_source_remove (priv->state_source);
+      priv->state_source = 0;
+    }
+
+  dirty = priv->dirty_state;
+  priv->dirty_state = 0;
+
+  if (!dirty || !priv->views)
+    return;
+
+  /* Views with a shared page read these from it, they only need to know
+   * that it's changed.
+   */
+  if (dirty & CMH_STATE_PAGE)
+    send_encoded_paged (headless,
+                        clutter_mozembed_feedback_state_changed_encode (),
+                        TRUE);
+
+  if (dirty & CMH_STATE_LOCATION)
+    {
+      string = moz_headless_get_location (headless_base);
+      send_encoded_all (headless,
+                        encode_feedback (CME_FEEDBACK_LOCATION,
+                                         G_TYPE_STRING, string,
+                                         G_TYPE_INVALID));
+      g_free (string);
+    }
+
+  if (dirty & CMH_STATE_TITLE)
+    {
+      string = moz_headless_get_title (headless_base);
+      send_encoded_all (headless,
+                        encode_feedback (CME_FEEDBACK_TITLE,
+                                         G_TYPE_STRING, string,
+                                         G_TYPE_INVALID));
+      g_free (string);
+    }
+
+  if (dirty & CMH_STATE_ICON)
+    {
+      string = moz_headless_get_icon (headless_base);
+      send_encoded_all (headless,
+                        encode_feedback (CME_FEEDBACK_ICON,
+                                         G_TYPE_STRING, string,
+                                         G_TYPE_INVALID));
+      g_free (string);
     }
+
+  if (dirty & CMH_STATE_SECURITY)
+    send_encoded_paged (headless,
+                        encode_feedback (CME_FEEDBACK_SECURITY,
+                                         G_TYPE_INT, priv->security,
+                                         G_TYPE_INVALID),
+                        FALSE);
+
+  if (dirty & CMH_STATE_CAN_GO_BACK)
+    send_encoded_paged (headless,
+                        encode_feedback (CME_FEEDBACK_CAN_GO_BACK,
+                                         G_TYPE_BOOLEAN, priv->can_go_back,
+                                         G_TYPE_INVALID),
+                        FALSE);
+
+  if (dirty & CMH_STATE_CAN_GO_FORWARD)
+    send_encoded_paged (headless,
+                        encode_feedback (CME_FEEDBACK_CAN_GO_FORWARD,
+                                         G_TYPE_BOOLEAN, priv->can_go_forward,
+                                         G_TYPE_INVALID),
+                        FALSE);
+
+  if (dirty & CMH_STATE_PROGRESS)
+    send_encoded_paged (headless,
+                        encode_feedback (CME_FEEDBACK_PROGRESS,
+                                         G_TYPE_DOUBLE, priv->progress,
+                                         G_TYPE_INVALID),
+                        FALSE);
+}
+
+static gboolean
+flush_state_cb (ClutterMozHeadless *headless)
+{
+  headless->priv->state_source = 0;
+  flush_state (headless);
+  return FALSE;
+}
+
+static void
+mark_state_dirty (ClutterMozHeadless *headless, guint state)
+{
+  ClutterMozHeadlessPrivate *priv = headless->priv;
+
+  /* Pages are kept current straight away, only the notification waits */
+  if (state & CMH_STATE_PAGE)
+    {
+      GList *v;
+
+      for (v = priv->views; v; v = v->next)
+        {
+          ClutterMozHeadlessView *view = v->data;
+          if (view->state_page)
+            write_view_state (view);
+        }
+    }
+
+  priv->dirty_state |= state;
+  if (!priv->state_source)
+    priv->state_source =
+      g_idle_add_full (G_PRIORITY_DEFAULT,
+                       (GSourceFunc)flush_state_cb,
+                       headless,
+                       NULL);
+}
+
+void
+send_feedback_all (ClutterMozHeadless      *headless,
+                   ClutterMozEmbedFeedback  id,
+                   ...)
+{
+  GByteArray *data;
+  ClutterMozHeadlessPrivate *priv = headless->priv;
+
+  va_list args;
+
+  /* Pending state goes first, so the client sees it in the order it
+   * changed relative to everything else.
+   */
+  flush_state (headless);
+
+  if (!priv->views)
+    return;
+
+  /* Encode once, and send the same bytes to every view */
+  va_start (args, id);
+  data = clutter_mozembed_comms_encode (id, args);
+  va_end (args);
+
+  send_encoded_all (headless, data);
 }
 
 static void
@@ -165,9 +492,7 @@ location_cb (ClutterMozHeadless *headless)
   ClutterMozHeadlessPrivate *priv = headless->priv;
 
   location = moz_headless_get_location (MOZ_HEADLESS (headless));
-  send_feedback_all (headless, CME_FEEDBACK_LOCATION,
-                     G_TYPE_STRING, location,
-                     G_TYPE_INVALID);
+  mark_state_dirty (headless, CMH_STATE_LOCATION);
 
   status = update = (priv->security & CLUTTER_MOZEMBED_BAD_CERT) ? TRUE : FALSE;
   clutter_mozheadless_update_cert_status (location, &update);
@@ -187,27 +512,13 @@ location_cb (ClutterMozHeadless *headless)
 static void
 title_cb (ClutterMozHeadless *headless)
 {
-  gchar *title;
-
-  title = moz_headless_get_title (MOZ_HEADLESS (headless));
-  send_feedback_all (headless, CME_FEEDBACK_TITLE,
-                     G_TYPE_STRING, title,
-                     G_TYPE_INVALID);
-
-  g_free (title);
+  mark_state_dirty (headless, CMH_STATE_TITLE);
 }
 
 static void
 icon_cb (ClutterMozHeadless *headless)
 {
-  gchar *icon;
-
-  icon = moz_headless_get_icon (MOZ_HEADLESS (headless));
-  send_feedback_all (headless, CME_FEEDBACK_ICON,
-                     G_TYPE_STRING, icon,
-                     G_TYPE_INVALID);
-
-  g_free (icon);
+  mark_state_dirty (headless, CMH_STATE_ICON);
 }
 
 static void
@@ -222,15 +533,20 @@ progress_cb (ClutterMozHeadless *headless,
   else
     progress = -1.0;
 
-  send_feedback_all (headless, CME_FEEDBACK_PROGRESS,
-                     G_TYPE_DOUBLE, progress,
-                     G_TYPE_INVALID);
+  headless->priv->progress = progress;
+  mark_state_dirty (headless, CMH_STATE_PROGRESS);
 }
 
 static void
 net_start_cb (ClutterMozHeadless *headless)
 {
   send_feedback_all (headless, CME_FEEDBACK_NET_START, G_TYPE_INVALID);
+
+  /* Views reset their progress on a new load, so do the same for the
+   * published value.
+   */
+  headless->priv->progress = 0.0;
+  mark_state_dirty (headless, CMH_STATE_PROGRESS);
 }
 
 static void
@@ -240,58 +556,411 @@ net_stop_cb (ClutterMozHeadless *headless)
 }
 
 static void
-updated_cb (MozHeadless        *headless,
-            gint                x,
-            gint                y,
-            gint                width,
-            gint                height)
+discard_damage (ClutterMozHeadless *moz_headless)
 {
-  gint doc_width, doc_height, sx, sy;
-  GList *v;
+  ClutterMozHeadlessPrivate *priv = moz_headless->priv;
 
-  ClutterMozHeadlessPrivate *priv = CLUTTER_MOZHEADLESS (headless)->priv;
+  if (priv->damage_source)
+    {
+      g_source_remove (priv->damage_source);
+      priv->damage_source = 0;
+    }
+
+  if (priv->damage)
+    {
+      XDestroyRegion (priv->damage);
+      priv->damage = NULL;
+    }
+}
+
+static void
+add_view_damage (ClutterMozHeadlessView *view, XRectangle *area)
+{
+  if (!view->damage)
+    view->damage = XCreateRegion ();
+  XUnionRectWithRegion (area, view->damage, view->damage);
+}
+
+/* Sends the latest frame to a view, along with the area that has changed
+ * since it was last sent one.
+ */
+static void
+send_view_update (ClutterMozHeadlessView *view)
+{
+  XRectangle box = { 0, };
+  ClutterMozHeadlessPrivate *priv = view->parent->priv;
+  ClutterMozEmbedFeedbackUpdate *frame = &priv->latest;
+
+  if (view->damage)
+    {
+      XClipBox (view->damage, &box);
+      XDestroyRegion (view->damage);
+      view->damage = NULL;
+    }
+
+  /* Where the viewport is in this frame */
+  frame->viewport_width = MIN (priv->viewport_width, frame->surface_width);
+  frame->viewport_height = MIN (priv->viewport_height, frame->surface_height);
+  frame->viewport_x = CLAMP (priv->viewport_x - frame->scroll_x, 0,
+                             frame->surface_width - frame->viewport_width);
+  frame->viewport_y = CLAMP (priv->viewport_y - frame->scroll_y, 0,
+                             frame->surface_height - frame->viewport_height);
+
+  clutter_mozembed_feedback_update_send (view->output,
+                                         frame->surface,
+                                         frame->surface_width,
+                                         frame->surface_height,
+                                         box.x, box.y,
+                                         box.width, box.height,
+                                         frame->scroll_x, frame->scroll_y,
+                                         frame->doc_width,
+                                         frame->doc_height,
+                                         frame->viewport_x,
+                                         frame->viewport_y,
+                                         frame->viewport_width,
+                                         frame->viewport_height,
+                                         frame->frame_width,
+                                         frame->frame_height);
+
+  view->buffer = priv->front;
+  view->generation = priv->generation;
+  view->needs_update = FALSE;
+  priv->buffers[priv->front].refs ++;
+
+  priv->waiting_for_ack ++;
+  view->waiting_for_ack ++;
+}
+
+/* Called when a view has acknowledged its update */
+static void
+release_view_buffer (ClutterMozHeadlessView *view)
+{
+  ClutterMozHeadlessPrivate *priv = view->parent->priv;
 
-  /* If we're pending a resize, the surface width/height will be incorrect */
-  if (priv->pending_resize)
+  /* Ignore acks for updates we haven't sent */
+  if (!view->waiting_for_ack)
     return;
 
-  /*g_debug ("Update +%d+%d %dx%d", x, y, width, height);*/
+  view->waiting_for_ack --;
+  priv->waiting_for_ack --;
+
+  /* Buffers that have been replaced aren't reused, so aren't counted */
+  if (view->generation == priv->generation)
+    priv->buffers[view->buffer].refs --;
+}
+
+static void
+destroy_buffer (ClutterMozHeadlessBuffer *buffer)
+{
+  Display *display = clutter_moz_headless_get_default_display ();
+
+  if (buffer->picture)
+    XRenderFreePicture (display, buffer->picture);
+  XFreePixmap (display, (Pixmap)buffer->pixmap);
+  if (buffer->shm.shmaddr)
+    {
+      XShmDetach (display, &buffer->shm);
+      shmdt (buffer->shm.shmaddr);
+      buffer->shm.shmaddr = NULL;
+    }
+}
+
+static void
+free_retired_buffers (ClutterMozHeadless *moz_headless)
+{
+  GList *v;
+  ClutterMozHeadlessPrivate *priv = moz_headless->priv;
+
+  if (!priv->retired)
+    return;
+
+  for (v = priv->views; v; v = v->next)
+    {
+      ClutterMozHeadlessView *view = v->data;
+
+      if (view->waiting_for_ack || (view->generation != priv->generation))
+        return;
+    }
+
+  while (priv->retired)
+    {
+      destroy_buffer (priv->retired->data);
+      g_slice_free (ClutterMozHeadlessBuffer, priv->retired->data);
+      priv->retired = g_list_delete_link (priv->retired, priv->retired);
+    }
+}
+
+/* A view that's still busy with an earlier frame just has the damage
+ * recorded, and is sent the latest frame once it's finished.
+ */
+static void
+send_update (ClutterMozHeadless            *moz_headless,
+             const ClutterMozHeadlessFrame *frame)
+{
+  GList *v;
+  ClutterMozHeadlessPrivate *priv = moz_headless->priv;
+
+  priv->front = frame->buffer;
+  priv->latest = frame->update;
+
+  flush_state (moz_headless);
+
+  for (v = priv->views; v; v = v->next)
+    {
+      ClutterMozHeadlessView *view = v->data;
+
+      add_view_damage (view, &frame->area);
+      if (view->waiting_for_ack)
+        view->needs_update = TRUE;
+      else
+        send_view_update (view);
+    }
+}
+
+/* Moves the viewport to (x, y) in the document. Gecko is only scrolled
+ * when the viewport would leave the surface, or when 'recentre' is set,
+ * otherwise the views are just sent the last frame with the new viewport.
+ */
+static void
+scroll_viewport (ClutterMozHeadless *moz_headless,
+                 gint                x,
+                 gint                y,
+                 gboolean            recentre)
+{
+  GList *v;
+  gint doc_width, doc_height, sx, sy;
+
+  MozHeadless *headless = MOZ_HEADLESS (moz_headless);
+  ClutterMozHeadlessPrivate *priv = moz_headless->priv;
 
   moz_headless_get_document_size (headless, &doc_width, &doc_height);
   moz_headless_get_scroll_pos (headless, &sx, &sy);
 
-  /* Copy from back buffer to front buffer. We tell the backends so that
-   * they can update their pixmap reference if necessary, and so that they
-   * can tell us when they've finished so we don't resize/free the pixmap
-   * while they're still using it.
-   */
-  XCopyArea (clutter_moz_headless_get_default_display (),
-             priv->buffer[0],
-             priv->buffer[1],
-             priv->buffer_gc,
-             x, y,
-             width,
-             height,
-             x, y);
-  XSync (clutter_moz_headless_get_default_display (), False);
-
-  send_feedback_all (CLUTTER_MOZHEADLESS (headless), CME_FEEDBACK_UPDATE,
-                     G_TYPE_ULONG, priv->buffer[1],
-                     G_TYPE_INT, sx,
-                     G_TYPE_INT, sy,
-                     G_TYPE_INT, doc_width,
-                     G_TYPE_INT, doc_height,
-                     G_TYPE_INVALID);
+  y = CLAMP (y, 0, MAX (0, doc_height - priv->viewport_height));
 
-  /*g_debug ("Doc-size: %dx%d", doc_width, doc_height);*/
+  if (recentre || (x != sx) || (y < sy) ||
+      (y + priv->viewport_height > sy + priv->surface_height))
+    {
+      moz_headless_set_scroll_pos (headless, x, y - priv->overscan);
+      moz_headless_get_scroll_pos (headless, &sx, &sy);
+      recentre = TRUE;
+    }
+
+  priv->viewport_x = sx;
+  priv->viewport_y = y;
+  priv->gecko_scroll_y = sy;
+
+  /* Scrolling Gecko damages the surface, which sends a new frame */
+  if (recentre || !priv->buffers)
+    return;
 
   for (v = priv->views; v; v = v->next)
     {
       ClutterMozHeadlessView *view = v->data;
 
-      priv->waiting_for_ack ++;
-      view->waiting_for_ack ++;
+      if (view->waiting_for_ack)
+        view->needs_update = TRUE;
+      else
+        send_view_update (view);
+    }
+}
+
+/* Picks the front buffer to copy the next frame to. Views can't be
+ * throttled by a buffer that another view is still using.
+ */
+static gint
+choose_buffer (ClutterMozHeadlessPrivate *priv)
+{
+  gint i;
+
+  /* Staying with the buffer the views already have means they only need
+   * to refresh the damaged area.
+   */
+  if (!priv->buffers[priv->front].refs)
+    return priv->front;
+
+  for (i = 0; i < priv->n_buffers; i++)
+    if (!priv->buffers[i].refs)
+      return i;
+
+  /* Every buffer is in use, so someone will see a partial frame */
+  return priv->front;
+}
+
+/* Size of a surface dimension in the front buffers */
+static gint
+scaled_size (ClutterMozHeadlessPrivate *priv, gint size)
+{
+  return (priv->render_scale < 1.0) ?
+    MAX (1, (gint)(size * priv->render_scale + 0.5)) : size;
+}
+
+/* Turns an area of the surface into the area of the front buffers it
+ * affects. When scaling, that includes the pixels filtered from it.
+ */
+static void
+scale_area (ClutterMozHeadlessPrivate *priv, XRectangle *area)
+{
+  gint x1, y1, x2, y2;
+
+  if (priv->render_scale >= 1.0)
+    return;
+
+  x1 = MAX (0, (gint)(area->x * priv->render_scale) - 1);
+  y1 = MAX (0, (gint)(area->y * priv->render_scale) - 1);
+  x2 = MIN (scaled_size (priv, priv->surface_width),
+            (gint)((area->x + area->width) * priv->render_scale) + 2);
+  y2 = MIN (scaled_size (priv, priv->surface_height),
+            (gint)((area->y + area->height) * priv->render_scale) + 2);
+
+  area->x = x1;
+  area->y = y1;
+  area->width = MAX (0, x2 - x1);
+  area->height = MAX (0, y2 - y1);
+}
+
+/* Copies everything that was damaged since the last flush to a front
+ * buffer in one go, and tells the views about it with a single update.
+ */
+static void
+flush_damage (ClutterMozHeadless *moz_headless)
+{
+  gint i;
+  Display *display;
+  XRectangle box;
+  ClutterMozHeadlessFrame frame;
+  ClutterMozHeadlessBuffer *buffer;
+  gint doc_width, doc_height, sx, sy;
+
+  MozHeadless *headless = MOZ_HEADLESS (moz_headless);
+  ClutterMozHeadlessPrivate *priv = moz_headless->priv;
+
+  if (!priv->damage)
+    return;
+
+  if (!priv->buffer_gc)
+    {
+      discard_damage (moz_headless);
+      return;
+    }
+
+  display = clutter_moz_headless_get_default_display ();
+
+  moz_headless_get_document_size (headless, &doc_width, &doc_height);
+  moz_headless_get_scroll_pos (headless, &sx, &sy);
+
+  /* When Gecko scrolls by itself, the page expects what it scrolled to
+   * to be at the top.
+   */
+  priv->viewport_x = sx;
+  if (sy != priv->gecko_scroll_y)
+    {
+      priv->gecko_scroll_y = sy;
+      priv->viewport_y = sy;
+    }
+
+  /* Every front buffer is now out of date in the damaged area, and the
+   * one we copy to also needs anything it missed while it was in use.
+   */
+  for (i = 0; i < priv->n_buffers; i++)
+    XUnionRegion (priv->buffers[i].stale, priv->damage,
+                  priv->buffers[i].stale);
+
+  frame.buffer = choose_buffer (priv);
+  buffer = &priv->buffers[frame.buffer];
+
+  /* Copy from back buffer to front buffer. Clipping to the stale region
+   * copies each rectangle of it with a single request. We tell the
+   * backends so that they can update their pixmap reference if necessary,
+   * and so that they can tell us when they've finished so we don't reuse
+   * or free the pixmap while they're still using it.
+   */
+  XClipBox (buffer->stale, &box);
+  if (priv->back_picture)
+    {
+      /* Scaled frames are filtered down from the back buffer */
+      scale_area (priv, &box);
+      XRenderComposite (display, PictOpSrc,
+                        priv->back_picture, None, buffer->picture,
+                        box.x, box.y, 0, 0, box.x, box.y,
+                        box.width, box.height);
+    }
+  else
+    {
+      XSetRegion (display, priv->buffer_gc, buffer->stale);
+      XCopyArea (display,
+                 priv->back_buffer,
+                 buffer->pixmap,
+                 priv->buffer_gc,
+                 box.x, box.y,
+                 box.width,
+                 box.height,
+                 box.x, box.y);
+      XSetClipMask (display, priv->buffer_gc, None);
     }
+
+  XDestroyRegion (buffer->stale);
+  buffer->stale = XCreateRegion ();
+
+  XClipBox (priv->damage, &frame.area);
+  scale_area (priv, &frame.area);
+  XDestroyRegion (priv->damage);
+  priv->damage = NULL;
+
+  frame.update.surface = buffer->pixmap;
+  frame.update.surface_width = priv->surface_width;
+  frame.update.surface_height = priv->surface_height;
+  frame.update.frame_width = scaled_size (priv, priv->surface_width);
+  frame.update.frame_height = scaled_size (priv, priv->surface_height);
+  frame.update.scroll_x = sx;
+  frame.update.scroll_y = sy;
+  frame.update.doc_width = doc_width;
+  frame.update.doc_height = doc_height;
+
+  /*g_debug ("Doc-size: %dx%d", doc_width, doc_height);*/
+
+  XSync (display, False);
+  send_update (moz_headless, &frame);
+}
+
+static gboolean
+flush_damage_cb (ClutterMozHeadless *moz_headless)
+{
+  moz_headless->priv->damage_source = 0;
+  flush_damage (moz_headless);
+  return FALSE;
+}
+
+static void
+updated_cb (MozHeadless        *headless,
+            gint                x,
+            gint                y,
+            gint                width,
+            gint                height)
+{
+  XRectangle rect;
+  ClutterMozHeadlessPrivate *priv = CLUTTER_MOZHEADLESS (headless)->priv;
+
+  /*g_debug ("Update +%d+%d %dx%d", x, y, width, height);*/
+
+  /* Gecko often paints a frame in several pieces, so collect the damage
+   * and flush it once everything else pending has run.
+   */
+  rect.x = x;
+  rect.y = y;
+  rect.width = width;
+  rect.height = height;
+
+  if (!priv->damage)
+    priv->damage = XCreateRegion ();
+  XUnionRectWithRegion (&rect, priv->damage, priv->damage);
+
+  if (!priv->damage_source)
+    priv->damage_source =
+      g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+                       (GSourceFunc)flush_damage_cb,
+                       headless,
+                       NULL);
 }
 
 static void
@@ -300,13 +969,19 @@ new_window_cb (MozHeadless *headless, MozHeadless **newEmbed, guint chromemask)
   ClutterMozHeadless *moz_headless = CLUTTER_MOZHEADLESS (headless);
   ClutterMozHeadlessPrivate *priv = moz_headless->priv;
   ClutterMozHeadlessView *view = (ClutterMozHeadlessView *)priv->views->data;
+  guint sequence = clutter_mozembed_comms_next_sequence ();
 
+  flush_state (moz_headless);
   clutter_mozembed_comms_send (view->output, CME_FEEDBACK_NEW_WINDOW,
+                               G_TYPE_UINT, sequence,
                                G_TYPE_INT, chromemask,
                                G_TYPE_INVALID);
-  block_until_command (moz_headless, CME_COMMAND_NEW_WINDOW_RESPONSE);
 
-  if (priv->new_input_file && priv->new_output_file)
+  /* If the front-end doesn't answer in time, there's no new window */
+  if (!block_until_command (moz_headless, CME_COMMAND_NEW_WINDOW_RESPONSE,
+                            sequence, priv->request_timeout))
+    *newEmbed = NULL;
+  else if (priv->new_input_file && priv->new_output_file)
     {
       *newEmbed = g_object_new (CLUTTER_TYPE_MOZHEADLESS,
                                 "chromeflags", chromemask,
@@ -322,6 +997,24 @@ new_window_cb (MozHeadless *headless, MozHeadless **newEmbed, guint chromemask)
       priv->new_input_file = NULL;
       priv->new_output_file = NULL;
     }
+  else if (priv->new_fd != -1)
+    {
+      GIOChannel *input, *output;
+
+      clutter_mozembed_comms_channels_new (priv->new_fd, &input, &output);
+      priv->new_fd = -1;
+
+      *newEmbed = g_object_new (CLUTTER_TYPE_MOZHEADLESS,
+                                "chromeflags", chromemask,
+                                "input-channel", input,
+                                "output-channel", output,
+                                "private", priv->private,
+                                NULL);
+      moz_headless_set_chrome_mask (*newEmbed, chromemask);
+
+      g_io_channel_unref (input);
+      g_io_channel_unref (output);
+    }
   else
     *newEmbed = NULL;
 }
@@ -345,17 +1038,15 @@ link_message_cb (ClutterMozHeadless *self)
 static void
 can_go_back_cb (ClutterMozHeadless *self, gboolean can_go_back)
 {
-  send_feedback_all (self, CME_FEEDBACK_CAN_GO_BACK,
-                     G_TYPE_BOOLEAN, can_go_back,
-                     G_TYPE_INVALID);
+  self->priv->can_go_back = can_go_back;
+  mark_state_dirty (self, CMH_STATE_CAN_GO_BACK);
 }
 
 static void
 can_go_forward_cb (ClutterMozHeadless *self, gboolean can_go_forward)
 {
-  send_feedback_all (self, CME_FEEDBACK_CAN_GO_FORWARD,
-                     G_TYPE_BOOLEAN, can_go_forward,
-                     G_TYPE_INVALID);
+  self->priv->can_go_forward = can_go_forward;
+  mark_state_dirty (self, CMH_STATE_CAN_GO_FORWARD);
 }
 
 static void
@@ -369,11 +1060,8 @@ size_to_cb (ClutterMozHeadless *self, gint width, gint height)
     return;
 
   primary_view = (ClutterMozHeadlessView *)priv->views->data;
-  clutter_mozembed_comms_send (primary_view->output,
-                               CME_FEEDBACK_SIZE_REQUEST,
-                               G_TYPE_INT, width,
-                               G_TYPE_INT, height,
-                               G_TYPE_INVALID);
+  clutter_mozembed_feedback_size_request_send (primary_view->output,
+                                               width, height);
 }
 
 static void
@@ -388,9 +1076,7 @@ security_change_cb (ClutterMozHeadless *self,
     return;
 
   priv->security = state | (priv->security & CLUTTER_MOZEMBED_BAD_CERT);
-  send_feedback_all (self, CME_FEEDBACK_SECURITY,
-                     G_TYPE_INT, priv->security,
-                     G_TYPE_INVALID);
+  mark_state_dirty (self, CMH_STATE_SECURITY);
 }
 
 static void
@@ -412,21 +1098,88 @@ hide_tooltip_cb (ClutterMozHeadless *self)
   send_feedback_all (self, CME_FEEDBACK_HIDE_TOOLTIP, G_TYPE_INVALID);
 }
 
-static void
-context_info_cb (ClutterMozHeadless *self,
-                 guint               ctx_type,
-                 const char         *ctx_uri,
-                 const char         *ctx_href,
-                 const char         *ctx_img_href,
-                 const char         *selected_txt)
-{
-  send_feedback_all (self, CME_FEEDBACK_CONTEXT_INFO,
-                     G_TYPE_UINT, ctx_type,
-                     G_TYPE_STRING, ctx_uri,
-                     G_TYPE_STRING, ctx_href,
-                     G_TYPE_STRING, ctx_img_href,
-                     G_TYPE_STRING, selected_txt,
-                     G_TYPE_INVALID);
+static void
+context_info_cb (ClutterMozHeadless *self,
+                 guint               ctx_type,
+                 const char         *ctx_uri,
+                 const char         *ctx_href,
+                 const char         *ctx_img_href,
+                 const char         *selected_txt)
+{
+  send_feedback_all (self, CME_FEEDBACK_CONTEXT_INFO,
+                     G_TYPE_UINT, ctx_type,
+                     G_TYPE_STRING, ctx_uri,
+                     G_TYPE_STRING, ctx_href,
+                     G_TYPE_STRING, ctx_img_href,
+                     G_TYPE_STRING, selected_txt,
+                     G_TYPE_INVALID);
+}
+
+static void
+connect_view (ClutterMozHeadlessView *view)
+{
+  gint doc_width, doc_height, sx, sy;
+  GError *error = NULL;
+
+  ClutterMozHeadlessPrivate *priv = view->parent->priv;
+
+  /* Views sharing a connection are read by their carrier */
+  if (view->input)
+    view->watch_id = g_io_add_watch (view->input,
+                                     G_IO_IN | G_IO_PRI | G_IO_ERR |
+                                     G_IO_NVAL | G_IO_HUP,
+                                     (GIOFunc)input_io_func,
+                                     view);
+
+  /* Views are on screen, at full size, until they say otherwise */
+  view->mapped = TRUE;
+  view->scale = 1.0;
+  clutter_moz_headless_update_suspended (view->parent);
+  clutter_moz_headless_update_render_scale (view->parent);
+
+  /* Each view gets a page of its own, as the front-end unlinks the name
+   * once it has opened it.
+   */
+  view->state_page = clutter_mozembed_state_create (&view->state_name,
+                                                    &error);
+  if (view->state_page)
+    {
+      write_view_state (view);
+      clutter_mozembed_comms_send (view->output, CME_FEEDBACK_SHM_NAME,
+                                   G_TYPE_STRING, view->state_name,
+                                   G_TYPE_INVALID);
+    }
+  else
+    {
+      g_warning ("Falling back to sending page state: %s", error->message);
+      g_error_free (error);
+    }
+
+  moz_headless_get_document_size (MOZ_HEADLESS (view->parent),
+                                  &doc_width, &doc_height);
+  moz_headless_get_scroll_pos (MOZ_HEADLESS (view->parent), &sx, &sy);
+
+  /* If we have an active surface, inform the view of it */
+  if (priv->buffers)
+    {
+      XRectangle area =
+        { 0, 0, priv->latest.frame_width, priv->latest.frame_height };
+
+      priv->latest.scroll_x = sx;
+      priv->latest.scroll_y = sy;
+      priv->latest.doc_width = doc_width;
+      priv->latest.doc_height = doc_height;
+
+      add_view_damage (view, &area);
+      send_view_update (view);
+    }
+
+  /* Inform if we're private */
+  /* FIXME: I don't think we need to do this */
+  if (priv->private)
+    clutter_mozembed_comms_send (view->output, CME_FEEDBACK_PRIVATE,
+                                 G_TYPE_BOOLEAN, TRUE,
+                                 G_TYPE_INVALID);
 }
 
 static void
@@ -437,9 +1190,6 @@ file_changed_cb (GFileMonitor           *monitor,
                  ClutterMozHeadlessView *view)
 {
   gint fd;
-  gint doc_width, doc_height, sx, sy;
-
-  ClutterMozHeadlessPrivate *priv = view->parent->priv;
 
   if (event_type != G_FILE_MONITOR_EVENT_CREATED)
     return;
@@ -455,37 +1205,8 @@ file_changed_cb (GFileMonitor           *monitor,
   g_io_channel_set_encoding (view->input, NULL, NULL);
   g_io_channel_set_buffered (view->input, FALSE);
   g_io_channel_set_close_on_unref (view->input, TRUE);
-  view->watch_id = g_io_add_watch (view->input,
-                                   G_IO_IN | G_IO_PRI | G_IO_ERR |
-                                   G_IO_NVAL | G_IO_HUP,
-                                   (GIOFunc)input_io_func,
-                                   view);
-
-  moz_headless_get_document_size (MOZ_HEADLESS (view->parent),
-                                  &doc_width, &doc_height);
-  moz_headless_get_scroll_pos (MOZ_HEADLESS (view->parent), &sx, &sy);
-
-  /* If we have an active surface, inform the view of it */
-  if (priv->buffer[1])
-    {
-      clutter_mozembed_comms_send (view->output, CME_FEEDBACK_UPDATE,
-                                   G_TYPE_ULONG, priv->buffer[1],
-                                   G_TYPE_INT, sx,
-                                   G_TYPE_INT, sy,
-                                   G_TYPE_INT, doc_width,
-                                   G_TYPE_INT, doc_height,
-                                   G_TYPE_INVALID);
-
-      view->waiting_for_ack ++;
-      priv->waiting_for_ack ++;
-    }
 
-  /* Inform if we're private */
-  /* FIXME: I don't think we need to do this */
-  if (priv->private)
-    clutter_mozembed_comms_send (view->output, CME_FEEDBACK_PRIVATE,
-                                 G_TYPE_BOOLEAN, TRUE,
-                                 G_TYPE_INVALID);
+  connect_view (view);
 }
 
 static void
@@ -588,6 +1309,45 @@ plugin_visibility_cb (ClutterMozHeadless *self,
 
 #endif
 
+/* Returns the connection the front-end passed with the given id, waiting
+ * for it if it hasn't been received yet.
+ */
+static gint
+claim_connection (guint id)
+{
+  gpointer fd;
+
+  if (!control_channel)
+    {
+      g_warning ("Connection passed without a control socket");
+      return -1;
+    }
+
+  if (!passed_fds)
+    passed_fds = g_hash_table_new (NULL, NULL);
+
+  /* Descriptors arrive in the order they were sent, which needn't be the
+   * order that their commands are processed in, across views.
+   */
+  while (!g_hash_table_lookup_extended (passed_fds, GUINT_TO_POINTER (id),
+                                        NULL, &fd))
+    {
+      guint passed_id;
+      gint passed_fd =
+        clutter_mozembed_comms_receive_fd (control_channel, &passed_id);
+
+      if (passed_fd == -1)
+        return -1;
+
+      g_hash_table_insert (passed_fds, GUINT_TO_POINTER (passed_id),
+                           GINT_TO_POINTER (passed_fd));
+    }
+
+  g_hash_table_remove (passed_fds, GUINT_TO_POINTER (id));
+
+  return GPOINTER_TO_INT (fd);
+}
+
 static void
 clutter_mozheadless_create_view (ClutterMozHeadless *self,
                                  gchar              *input_file,
@@ -624,13 +1384,69 @@ clutter_mozheadless_create_view (ClutterMozHeadless *self,
                      G_FILE_MONITOR_EVENT_CREATED, view);
 }
 
+static void
+clutter_mozheadless_create_channel_view (ClutterMozHeadless *self,
+                                         GIOChannel         *input,
+                                         GIOChannel         *output)
+{
+  ClutterMozHeadlessPrivate *priv = self->priv;
+  ClutterMozHeadlessView *view = g_new0 (ClutterMozHeadlessView, 1);
+
+  priv->views = g_list_append (priv->views, view);
+
+  /* The channels are already connected, so there are no pipe files */
+  view->parent = self;
+  view->input = g_io_channel_ref (input);
+  view->output = g_io_channel_ref (output);
+
+  connect_view (view);
+}
+
+static void
+clutter_mozheadless_create_muxed_view (ClutterMozHeadless     *self,
+                                       ClutterMozHeadlessView *carrier,
+                                       guint                   id)
+{
+  ClutterMozHeadlessPrivate *priv = self->priv;
+  ClutterMozHeadlessView *view = g_new0 (ClutterMozHeadlessView, 1);
+
+  priv->views = g_list_append (priv->views, view);
+
+  view->parent = self;
+  view->id = id;
+  view->carrier = carrier;
+  view->output = clutter_mozembed_comms_view_channel_new (carrier->output,
+                                                         id);
+  carrier->muxed = g_list_prepend (carrier->muxed, view);
+
+  connect_view (view);
+}
+
+/* Finds the view that a message read from a carrier's connection is for */
+static ClutterMozHeadlessView *
+find_message_view (ClutterMozHeadlessView *carrier,
+                   ClutterMozEmbedMessage *message)
+{
+  GList *v;
+
+  if (!message->view)
+    return carrier;
+
+  for (v = carrier->muxed; v; v = v->next)
+    {
+      ClutterMozHeadlessView *view = v->data;
+      if (view->id == message->view)
+        return view;
+    }
+
+  return NULL;
+}
+
 static gboolean
 send_mack (ClutterMozHeadlessView *view)
 {
   view->mack_source = 0;
-  clutter_mozembed_comms_send (view->output,
-                               CME_FEEDBACK_MOTION_ACK,
-                               G_TYPE_INVALID);
+  clutter_mozembed_feedback_motion_ack_send (view->output);
   return FALSE;
 }
 
@@ -638,9 +1454,7 @@ static gboolean
 send_sack_cb (ClutterMozHeadlessView *view)
 {
   view->sack_source = 0;
-  clutter_mozembed_comms_send (view->output,
-                               CME_FEEDBACK_SCROLL_ACK,
-                               G_TYPE_INVALID);
+  clutter_mozembed_feedback_scroll_ack_send (view->output);
   return FALSE;
 }
 
@@ -652,17 +1466,331 @@ send_sack (ClutterMozHeadlessView *view)
       g_idle_add_full (G_PRIORITY_LOW, (GSourceFunc)send_sack_cb, view, NULL);
 }
 
+/* When 'retire' is set, the front buffers are kept until no view is
+ * showing them any more.
+ */
+static void
+free_buffers (ClutterMozHeadless *moz_headless, gboolean retire)
+{
+  gint i;
+  ClutterMozHeadlessPrivate *priv = moz_headless->priv;
+  Display *display = clutter_moz_headless_get_default_display ();
+
+  if (priv->back_picture)
+    {
+      XRenderFreePicture (display, priv->back_picture);
+      priv->back_picture = None;
+    }
+
+  if (priv->back_buffer)
+    {
+      XFreePixmap (display, (Pixmap)priv->back_buffer);
+      priv->back_buffer = None;
+    }
+
+  for (i = 0; i < priv->n_buffers; i++)
+    {
+      ClutterMozHeadlessBuffer *buffer = &priv->buffers[i];
+
+      XDestroyRegion (buffer->stale);
+      buffer->stale = NULL;
+      if (retire)
+        priv->retired =
+          g_list_prepend (priv->retired,
+                          g_slice_dup (ClutterMozHeadlessBuffer, buffer));
+      else
+        destroy_buffer (buffer);
+    }
+  if (priv->buffers && retire)
+    priv->generation ++;
+  g_free (priv->buffers);
+  priv->buffers = NULL;
+  priv->n_buffers = 0;
+  priv->buffer_shm = FALSE;
+
+  if (priv->buffer_gc)
+    {
+      XFreeGC (display, priv->buffer_gc);
+      priv->buffer_gc = NULL;
+    }
+}
+
+static gint
+surface_depth (ClutterMozHeadless *moz_headless)
+{
+  Display *display = clutter_moz_headless_get_default_display ();
+
+  return moz_headless->priv->transparent ?
+    32 : DefaultDepth (display, DefaultScreen (display));
+}
+
+/* The buffers are allocated in size steps, so the surface can be resized
+ * within them without replacing the pixmaps the views are using.
+ */
+static gboolean
+surface_fits_buffers (ClutterMozHeadless *moz_headless)
+{
+  ClutterMozHeadlessPrivate *priv = moz_headless->priv;
+
+  return priv->buffers &&
+    (priv->back_width ==
+     clutter_mozembed_comms_surface_size (priv->surface_width)) &&
+    (priv->back_height ==
+     clutter_mozembed_comms_surface_size (priv->surface_height)) &&
+    (priv->buffer_width == clutter_mozembed_comms_surface_size
+     (scaled_size (priv, priv->surface_width))) &&
+    (priv->buffer_height == clutter_mozembed_comms_surface_size
+     (scaled_size (priv, priv->surface_height))) &&
+    (priv->buffer_scale == priv->render_scale) &&
+    (priv->buffer_depth == surface_depth (moz_headless)) &&
+    (priv->buffer_shm || !priv->shm_frames);
+}
+
+/* Whether the X server can create shared memory pixmaps in a format views
+ * can upload from directly, which is 32 bits per pixel.
+ */
+static gboolean
+shm_pixmaps_supported (Display *display, gint depth)
+{
+  gint i, major, minor, n_formats;
+  Bool pixmaps;
+  XPixmapFormatValues *formats;
+  gboolean supported = FALSE;
+
+  if (!XShmQueryVersion (display, &major, &minor, &pixmaps) || !pixmaps ||
+      (XShmPixmapFormat (display) != ZPixmap))
+    return FALSE;
+
+  formats = XListPixmapFormats (display, &n_formats);
+  for (i = 0; i < n_formats; i++)
+    if (formats[i].depth == depth)
+      supported = (formats[i].bits_per_pixel == 32);
+  XFree (formats);
+
+  return supported;
+}
+
+static gboolean
+create_shm_buffer (ClutterMozHeadless       *moz_headless,
+                   ClutterMozHeadlessBuffer *buffer,
+                   gint                      depth)
+{
+  ClutterMozHeadlessPrivate *priv = moz_headless->priv;
+  Display *display = clutter_moz_headless_get_default_display ();
+  gint screen = DefaultScreen (display);
+
+  buffer->shm.shmid = shmget (IPC_PRIVATE,
+                              priv->buffer_width * priv->buffer_height * 4,
+                              IPC_CREAT | 0600);
+  if (buffer->shm.shmid == -1)
+    return FALSE;
+
+  buffer->shm.shmaddr = (char *)shmat (buffer->shm.shmid, NULL, 0);
+  if (buffer->shm.shmaddr == (char *)-1)
+    {
+      shmctl (buffer->shm.shmid, IPC_RMID, NULL);
+      buffer->shm.shmaddr = NULL;
+      return FALSE;
+    }
+  buffer->shm.readOnly = False;
+
+  XShmAttach (display, &buffer->shm);
+  XSync (display, False);
+
+  /* The segment goes away once the X server, views and we have detached
+   * from it, views can still attach until then.
+   */
+  shmctl (buffer->shm.shmid, IPC_RMID, NULL);
+
+  buffer->pixmap = XShmCreatePixmap (display,
+                                     RootWindow (display, screen),
+                                     buffer->shm.shmaddr,
+                                     &buffer->shm,
+                                     priv->buffer_width,
+                                     priv->buffer_height,
+                                     depth);
+
+  return TRUE;
+}
+
+/* Tells a view where it can read the front buffers from */
+static void
+send_shm_surfaces (ClutterMozHeadlessView *view)
+{
+  gint i;
+  ClutterMozHeadlessPrivate *priv = view->parent->priv;
+
+  if (!priv->buffer_shm)
+    return;
+
+  for (i = 0; i < priv->n_buffers; i++)
+    clutter_mozembed_feedback_shm_surface_send (view->output,
+                                                priv->buffers[i].pixmap,
+                                                priv->buffers[i].shm.shmid,
+                                                priv->buffer_width,
+                                                priv->buffer_height,
+                                                priv->buffer_width * 4,
+                                                priv->buffer_depth,
+                                                priv->generation);
+}
+
+/* Returns the format of pictures for pixmaps of the given depth, or NULL
+ * if the X server can't scale them.
+ */
+static XRenderPictFormat *
+picture_format (Display *display, gint depth)
+{
+  gint event_base, error_base;
+  XRenderPictFormat template;
+
+  if (!XRenderQueryExtension (display, &event_base, &error_base))
+    return NULL;
+
+  template.type = PictTypeDirect;
+  template.depth = depth;
+  return XRenderFindFormat (display, PictFormatType | PictFormatDepth,
+                            &template, 0);
+}
+
+/* Frames are scaled down with a bilinear filter when they're copied to
+ * the front buffers.
+ */
+static void
+create_pictures (ClutterMozHeadless *moz_headless, gint depth)
+{
+  gint i;
+  XTransform transform;
+  XRenderPictFormat *format;
+  ClutterMozHeadlessPrivate *priv = moz_headless->priv;
+  Display *display = clutter_moz_headless_get_default_display ();
+
+  format = picture_format (display, depth);
+  priv->back_picture = XRenderCreatePicture (display, priv->back_buffer,
+                                             format, 0, NULL);
+
+  memset (&transform, 0, sizeof (transform));
+  transform.matrix[0][0] = XDoubleToFixed (1.0 / priv->render_scale);
+  transform.matrix[1][1] = XDoubleToFixed (1.0 / priv->render_scale);
+  transform.matrix[2][2] = XDoubleToFixed (1.0);
+  XRenderSetPictureTransform (display, priv->back_picture, &transform);
+  XRenderSetPictureFilter (display, priv->back_picture, FilterBilinear,
+                           NULL, 0);
+
+  for (i = 0; i < priv->n_buffers; i++)
+    priv->buffers[i].picture =
+      XRenderCreatePicture (display, priv->buffers[i].pixmap,
+                            format, 0, NULL);
+}
+
+static void
+create_buffers (ClutterMozHeadless *moz_headless, gint depth)
+{
+  gint i;
+  GList *v;
+  XRectangle area;
+  XGCValues gc_values;
+  ClutterMozHeadlessPrivate *priv = moz_headless->priv;
+  Display *display = clutter_moz_headless_get_default_display ();
+  gint screen = DefaultScreen (display);
+
+  priv->back_width = clutter_mozembed_comms_surface_size (priv->surface_width);
+  priv->back_height =
+    clutter_mozembed_comms_surface_size (priv->surface_height);
+  priv->buffer_width =
+    clutter_mozembed_comms_surface_size (scaled_size (priv,
+                                                      priv->surface_width));
+  priv->buffer_height =
+    clutter_mozembed_comms_surface_size (scaled_size (priv,
+                                                      priv->surface_height));
+  priv->buffer_depth = depth;
+  priv->buffer_scale = priv->render_scale;
+
+  /* FIXME: Error checking */
+
+  /* Create pixmaps. Gecko draws into the back buffer, and views are sent
+   * the front buffers, which start off entirely out of date.
+   */
+  priv->back_buffer = XCreatePixmap (display,
+                                     RootWindow (display, screen),
+                                     priv->back_width,
+                                     priv->back_height,
+                                     depth);
+
+  area.x = 0;
+  area.y = 0;
+  area.width = priv->surface_width;
+  area.height = priv->surface_height;
+
+  priv->front = 0;
+  priv->n_buffers = n_front_buffers;
+  priv->buffers = g_new0 (ClutterMozHeadlessBuffer, priv->n_buffers);
+
+  /* Fall back to regular pixmaps if shared ones can't be made, views
+   * that asked for them are then just never told about any.
+   */
+  priv->buffer_shm = priv->shm_frames &&
+    shm_pixmaps_supported (display, depth);
+  if (priv->buffer_shm)
+    for (i = 0; i < priv->n_buffers; i++)
+      if (!create_shm_buffer (moz_headless, &priv->buffers[i], depth))
+        {
+          while (i-- > 0)
+            destroy_buffer (&priv->buffers[i]);
+          priv->buffer_shm = FALSE;
+          break;
+        }
+  if (priv->shm_frames && !priv->buffer_shm)
+    {
+      g_warning ("Unable to create shared memory pixmaps");
+      priv->shm_frames = FALSE;
+    }
+
+  for (i = 0; i < priv->n_buffers; i++)
+    {
+      ClutterMozHeadlessBuffer *buffer = &priv->buffers[i];
+
+      if (!priv->buffer_shm)
+        buffer->pixmap = XCreatePixmap (display,
+                                        RootWindow (display, screen),
+                                        priv->buffer_width,
+                                        priv->buffer_height,
+                                        depth);
+      buffer->stale = XCreateRegion ();
+      XUnionRectWithRegion (&area, buffer->stale, buffer->stale);
+    }
+  priv->latest.surface = priv->buffers[0].pixmap;
+
+  if (priv->render_scale < 1.0)
+    create_pictures (moz_headless, depth);
+
+  /* Copying between pixmaps never generates GraphicsExpose events, only a
+   * NoExpose event once the copy is done, which nothing reads.
+   */
+  gc_values.graphics_exposures = False;
+  priv->buffer_gc = XCreateGC (display, priv->back_buffer,
+                               GCGraphicsExposures, &gc_values);
+
+  for (v = priv->views; v; v = v->next)
+    {
+      ClutterMozHeadlessView *view = v->data;
+
+      if (view->shm_frames)
+        send_shm_surfaces (view);
+    }
+}
+
 static void
 clutter_moz_headless_resize (ClutterMozHeadless *moz_headless)
 {
   Display *display;
-  int screen, depth, window_depth;
+  int screen, depth;
   XVisualInfo template, visual_info;
+  GList *v;
 
   MozHeadless *headless = MOZ_HEADLESS (moz_headless);
   ClutterMozHeadlessPrivate *priv = moz_headless->priv;
 
-  priv->pending_resize = FALSE;
+  discard_damage (moz_headless);
 
   /*g_debug ("Resizing to %dx%d", priv->surface_width, priv->surface_height);*/
   moz_headless_set_xsurface (headless, NULL, None, NULL, 0, 0);
@@ -672,121 +1800,232 @@ clutter_moz_headless_resize (ClutterMozHeadless *moz_headless)
 
   display = clutter_moz_headless_get_default_display ();
   screen = DefaultScreen (display);
-  window_depth = DefaultDepth (display, screen);
-  depth = priv->transparent ? 32 : window_depth;
+  depth = surface_depth (moz_headless);
+
+  if (!surface_fits_buffers (moz_headless))
+    {
+      free_buffers (moz_headless, TRUE);
+      free_retired_buffers (moz_headless);
+    }
 
-  if (priv->buffer[0])
+  /* Views will be sent the new surface in full */
+  for (v = priv->views; v; v = v->next)
     {
-      XFreePixmap (display, (Pixmap)priv->buffer[0]);
-      priv->buffer[0] = None;
+      ClutterMozHeadlessView *view = v->data;
+
+      view->needs_update = FALSE;
+      if (view->damage)
+        {
+          XDestroyRegion (view->damage);
+          view->damage = NULL;
+        }
     }
-  if (priv->buffer[1])
+
+  if ((priv->surface_width <= 0) || (priv->surface_height <= 0))
+    return;
+
+  if (!priv->buffers)
+    create_buffers (moz_headless, depth);
+
+  priv->latest.surface_width = priv->surface_width;
+  priv->latest.surface_height = priv->surface_height;
+  priv->latest.frame_width = scaled_size (priv, priv->surface_width);
+  priv->latest.frame_height = scaled_size (priv, priv->surface_height);
+
+  /* Get the appropriate visual */
+  template.screen = screen;
+  if (XMatchVisualInfo (display,
+                        screen,
+                        depth,
+                        TrueColor,
+                        &visual_info) == 0)
     {
-      XFreePixmap (display, (Pixmap)priv->buffer[1]);
-      priv->buffer[1] = None;
+      g_warning ("Unable to get suitable visual");
+      free_buffers (moz_headless, TRUE);
+      return;
     }
-  if (priv->buffer_gc)
+
+  /* Gecko is given its surface back once a view is shown again */
+  if (priv->suspended)
+    return;
+
+  /* Gecko only draws into the part of the back buffer that's in use */
+  moz_headless_set_xsurface (headless,
+                             (gpointer)display,
+                             (gulong)priv->back_buffer,
+                             visual_info.visual,
+                             priv->surface_width, priv->surface_height);
+  moz_headless_set_transparent (headless, priv->transparent);
+}
+
+/* Stops Gecko drawing while none of the views are on screen. Taking
+ * away its surface means nothing is painted, copied or sent, and giving
+ * it back has it redraw everything once.
+ */
+static void
+clutter_moz_headless_update_suspended (ClutterMozHeadless *moz_headless)
+{
+  GList *v;
+  gboolean suspended;
+  ClutterMozHeadlessPrivate *priv = moz_headless->priv;
+
+  /* Nothing changes once the last view has gone */
+  if (!priv->views)
+    return;
+
+  suspended = TRUE;
+  for (v = priv->views; v; v = v->next)
     {
-      XFreeGC (display, priv->buffer_gc);
-      priv->buffer_gc = NULL;
+      ClutterMozHeadlessView *view = v->data;
+      if (view->mapped)
+        suspended = FALSE;
+    }
+
+  if (priv->suspended == suspended)
+    return;
+
+  priv->suspended = suspended;
+  if (suspended)
+    {
+      discard_damage (moz_headless);
+      moz_headless_set_xsurface (MOZ_HEADLESS (moz_headless),
+                                 NULL, None, NULL, 0, 0);
+    }
+  else
+    clutter_moz_headless_resize (moz_headless);
+}
+
+/* Frames only need to be as detailed as the largest view of them. Gecko
+ * redraws everything when the scale changes, so views should only ask for
+ * a new one once it's settled.
+ */
+static void
+clutter_moz_headless_update_render_scale (ClutterMozHeadless *moz_headless)
+{
+  GList *v;
+  gdouble scale;
+  ClutterMozHeadlessPrivate *priv = moz_headless->priv;
+
+  if (!priv->views)
+    return;
+
+  scale = 0.0;
+  for (v = priv->views; v; v = v->next)
+    {
+      ClutterMozHeadlessView *view = v->data;
+      scale = MAX (scale, view->scale);
     }
+  scale = CLAMP (scale, CME_RENDER_SCALE_STEP, 1.0);
 
-  if ((priv->surface_width <= 0) || (priv->surface_height <= 0))
+  if ((scale < 1.0) &&
+      !picture_format (clutter_moz_headless_get_default_display (),
+                       surface_depth (moz_headless)))
+    scale = 1.0;
+
+  if (priv->render_scale == scale)
     return;
 
-  /* FIXME: Error checking */
+  priv->render_scale = scale;
+  if (priv->buffers)
+    clutter_moz_headless_resize (moz_headless);
+}
 
-  /* Create pixmaps */
-  priv->buffer[0] = XCreatePixmap (display,
-                                   RootWindow (display, screen),
-                                   priv->surface_width,
-                                   priv->surface_height,
-                                   depth);
-  priv->buffer[1] = XCreatePixmap (display,
-                                   RootWindow (display, screen),
-                                   priv->surface_width,
-                                   priv->surface_height,
-                                   depth);
-  priv->buffer_gc = XCreateGC (display, priv->buffer[1], 0, NULL);
+/* Sizes the surface to the viewport and the overscan area around it */
+static void
+clutter_moz_headless_resize_viewport (ClutterMozHeadless *moz_headless)
+{
+  ClutterMozHeadlessPrivate *priv = moz_headless->priv;
+  gint height = (priv->viewport_height > 0) ?
+    priv->viewport_height + priv->overscan * 2 : priv->viewport_height;
 
-  /* Get the appropriate visual */
-  template.screen = screen;
-  if (XMatchVisualInfo (display,
-                        screen,
-                        depth,
-                        TrueColor,
-                        &visual_info) == 0)
+  if ((priv->surface_width != priv->viewport_width) ||
+      (priv->surface_height != height))
     {
-      g_warning ("Unable to get suitable visual");
-      XFreePixmap (display, (Pixmap)priv->buffer[0]);
-      priv->buffer[0] = None;
-      return;
+      priv->surface_width = priv->viewport_width;
+      priv->surface_height = height;
+      clutter_moz_headless_resize (moz_headless);
     }
 
-  moz_headless_set_xsurface (headless,
-                             (gpointer)display,
-                             (gulong)priv->buffer[0],
-                             visual_info.visual,
-                             priv->surface_width, priv->surface_height);
-  moz_headless_set_transparent (headless, priv->transparent);
+  /* Keep the viewport where it was, with as much overscan either side of
+   * it as possible.
+   */
+  if (priv->overscan || (priv->viewport_y != priv->gecko_scroll_y))
+    scroll_viewport (moz_headless, priv->viewport_x, priv->viewport_y, TRUE);
 }
 
 static void
-process_command (ClutterMozHeadlessView *view, ClutterMozEmbedCommand command)
+process_command (ClutterMozHeadlessView *view, ClutterMozEmbedMessage *message)
 {
+  ClutterMozEmbedCommand command = message->id;
   ClutterMozHeadless *moz_headless = view->parent;
   ClutterMozHeadlessPrivate *priv = moz_headless->priv;
   MozHeadless *headless = MOZ_HEADLESS (moz_headless);
 
   /*g_debug ("Processing command: %d", command);*/
 
-  if (priv->sync_call && (priv->sync_call == command))
-    priv->sync_call = 0;
-
   switch (command)
     {
       case CME_COMMAND_UPDATE_ACK :
         {
-          view->waiting_for_ack --;
-          priv->waiting_for_ack --;
+          release_view_buffer (view);
 
-          if (!priv->waiting_for_ack && priv->pending_resize)
-            clutter_moz_headless_resize (moz_headless);
+          if (view->needs_update)
+            send_view_update (view);
+          else
+            free_retired_buffers (moz_headless);
 
           break;
         }
       case CME_COMMAND_OPEN_URL :
         {
-          gchar *url = clutter_mozembed_comms_receive_string (view->input);
+          gchar *url = clutter_mozembed_comms_receive_string (message);
           moz_headless_load_url (headless, url);
           g_free (url);
           break;
         }
       case CME_COMMAND_RESIZE :
         {
-          gint width, height;
-          clutter_mozembed_comms_receive (view->input,
-                                          G_TYPE_INT, &width,
-                                          G_TYPE_INT, &height,
-                                          G_TYPE_INVALID);
+          ClutterMozEmbedCommandResize body;
+
+          clutter_mozembed_command_resize_receive (message, &body);
+
+          if ((body.width == priv->viewport_width) &&
+              (body.height == priv->viewport_height))
+            break;
+
+          priv->viewport_width = body.width;
+          priv->viewport_height = body.height;
+          clutter_moz_headless_resize_viewport (moz_headless);
+
+          break;
+        }
+      case CME_COMMAND_OVERSCAN :
+        {
+          ClutterMozEmbedCommandOverscan body;
+
+          clutter_mozembed_command_overscan_receive (message, &body);
 
-          if ((width == priv->surface_width) && (height == priv->surface_height))
+          if (MAX (0, body.margin) == priv->overscan)
             break;
 
-          priv->surface_width = width;
-          priv->surface_height = height;
+          priv->overscan = MAX (0, body.margin);
+          clutter_moz_headless_resize_viewport (moz_headless);
+
+          break;
+        }
+      case CME_COMMAND_REQUEST_TIMEOUT :
+        {
+          ClutterMozEmbedCommandRequestTimeout body;
 
-          if (priv->waiting_for_ack)
-            priv->pending_resize = TRUE;
-          else if (!priv->pending_resize)
-            clutter_moz_headless_resize (moz_headless);
+          clutter_mozembed_command_request_timeout_receive (message, &body);
+          priv->request_timeout = MAX (0, body.timeout);
 
           break;
         }
       case CME_COMMAND_SET_TRANSPARENT :
         {
           gboolean transparent =
-            clutter_mozembed_comms_receive_boolean (view->input);
+            clutter_mozembed_comms_receive_boolean (message);
 
           if (priv->transparent != transparent)
             {
@@ -795,25 +2034,17 @@ process_command (ClutterMozHeadlessView *view, ClutterMozEmbedCommand command)
               /* Trigger a resize to recreate the surfaces in the right
                * format.
                */
-              if (priv->waiting_for_ack)
-                priv->pending_resize = TRUE;
-              else if (!priv->pending_resize)
-                clutter_moz_headless_resize (moz_headless);
+              clutter_moz_headless_resize (moz_headless);
             }
           break;
         }
       case CME_COMMAND_MOTION :
         {
-          gint x, y;
-          MozHeadlessModifier m;
-
-          clutter_mozembed_comms_receive (view->input,
-                                          G_TYPE_INT, &x,
-                                          G_TYPE_INT, &y,
-                                          G_TYPE_INT, &m,
-                                          G_TYPE_INVALID);
+          ClutterMozEmbedCommandMotion body;
 
-          moz_headless_motion (headless, x, y, m);
+          clutter_mozembed_command_motion_receive (message, &body);
+          moz_headless_motion (headless, body.x, body.y,
+                               (MozHeadlessModifier)body.modifiers);
 
           /* This is done so that we definitely get to do any redrawing before we
            * send an acknowledgement.
@@ -829,77 +2060,60 @@ process_command (ClutterMozHeadlessView *view, ClutterMozEmbedCommand command)
         }
       case CME_COMMAND_BUTTON_PRESS :
         {
-          gint x, y, button, count;
-          MozHeadlessModifier m;
-
-          clutter_mozembed_comms_receive (view->input,
-                                          G_TYPE_INT, &x,
-                                          G_TYPE_INT, &y,
-                                          G_TYPE_INT, &button,
-                                          G_TYPE_INT, &count,
-                                          G_TYPE_INT, &m,
-                                          G_TYPE_INVALID);
+          ClutterMozEmbedCommandButtonPress body;
 
-          moz_headless_button_press (headless, x, y, button, count, m);
+          clutter_mozembed_command_button_press_receive (message, &body);
+          moz_headless_button_press (headless, body.x, body.y,
+                                     body.button, body.count,
+                                     (MozHeadlessModifier)body.modifiers);
 
           break;
         }
       case CME_COMMAND_BUTTON_RELEASE :
         {
-          gint x, y, button;
-          MozHeadlessModifier m;
-
-          clutter_mozembed_comms_receive (view->input,
-                                          G_TYPE_INT, &x,
-                                          G_TYPE_INT, &y,
-                                          G_TYPE_INT, &button,
-                                          G_TYPE_INT, &m,
-                                          G_TYPE_INVALID);
+          ClutterMozEmbedCommandButtonRelease body;
 
-          moz_headless_button_release (headless, x, y, button, m);
+          clutter_mozembed_command_button_release_receive (message, &body);
+          moz_headless_button_release (headless, body.x, body.y, body.button,
+                                       (MozHeadlessModifier)body.modifiers);
 
           break;
         }
       case CME_COMMAND_KEY_PRESS :
         {
-          MozHeadlessKey key;
-          gunichar unicode_char;
-          MozHeadlessModifier m;
-
-          clutter_mozembed_comms_receive (view->input,
-                                          G_TYPE_INT, &key,
-                                          G_TYPE_INT, &unicode_char,
-                                          G_TYPE_INT, &m,
-                                          G_TYPE_INVALID);
+          ClutterMozEmbedCommandKeyPress body;
 
-          moz_headless_key_press (headless, key, unicode_char, m);
+          clutter_mozembed_command_key_press_receive (message, &body);
+          moz_headless_key_press (headless,
+                                  (MozHeadlessKey)body.key,
+                                  (gunichar)body.unicode,
+                                  (MozHeadlessModifier)body.modifiers);
 
           break;
         }
       case CME_COMMAND_KEY_RELEASE :
         {
-          MozHeadlessKey key;
-          MozHeadlessModifier m;
-
-          clutter_mozembed_comms_receive (view->input,
-                                          G_TYPE_INT, &key,
-                                          G_TYPE_INT, &m,
-                                          G_TYPE_INVALID);
+          ClutterMozEmbedCommandKeyRelease body;
 
-          moz_headless_key_release (headless, key, m);
+          clutter_mozembed_command_key_release_receive (message, &body);
+          moz_headless_key_release (headless,
+                                    (MozHeadlessKey)body.key,
+                                    (MozHeadlessModifier)body.modifiers);
 
           break;
         }
       case CME_COMMAND_SCROLL :
         {
-          gint dx, dy;
-
-          clutter_mozembed_comms_receive (view->input,
-                                          G_TYPE_INT, &dx,
-                                          G_TYPE_INT, &dy,
-                                          G_TYPE_INVALID);
-
-          moz_headless_scroll (headless, dx, dy);
+          ClutterMozEmbedCommandScroll body;
+
+          clutter_mozembed_command_scroll_receive (message, &body);
+          if (priv->overscan)
+            scroll_viewport (moz_headless,
+                             priv->viewport_x + body.dx,
+                             priv->viewport_y + body.dy,
+                             FALSE);
+          else
+            moz_headless_scroll (headless, body.dx, body.dy);
 
           send_sack (view);
 
@@ -907,14 +2121,13 @@ process_command (ClutterMozHeadlessView *view, ClutterMozEmbedCommand command)
         }
       case CME_COMMAND_SCROLL_TO :
         {
-          gint x, y;
+          ClutterMozEmbedCommandScrollTo body;
 
-          clutter_mozembed_comms_receive (view->input,
-                                          G_TYPE_INT, &x,
-                                          G_TYPE_INT, &y,
-                                          G_TYPE_INVALID);
-
-          moz_headless_set_scroll_pos (headless, x, y);
+          clutter_mozembed_command_scroll_to_receive (message, &body);
+          if (priv->overscan)
+            scroll_viewport (moz_headless, body.x, body.y, FALSE);
+          else
+            moz_headless_set_scroll_pos (headless, body.x, body.y);
 
           send_sack (view);
 
@@ -922,8 +2135,10 @@ process_command (ClutterMozHeadlessView *view, ClutterMozEmbedCommand command)
         }
       case CME_COMMAND_GET_CAN_GO_BACK :
         {
+          guint sequence = clutter_mozembed_comms_receive_uint (message);
           clutter_mozembed_comms_send (view->output,
-                                       CME_FEEDBACK_CAN_GO_BACK,
+                                       CME_FEEDBACK_REPLY,
+                                       G_TYPE_UINT, sequence,
                                        G_TYPE_BOOLEAN,
                                        moz_headless_can_go_back (headless),
                                        G_TYPE_INVALID);
@@ -931,10 +2146,12 @@ process_command (ClutterMozHeadlessView *view, ClutterMozEmbedCommand command)
         }
       case CME_COMMAND_GET_CAN_GO_FORWARD :
         {
+          guint sequence = clutter_mozembed_comms_receive_uint (message);
           clutter_mozembed_comms_send (view->output,
-                                       CME_FEEDBACK_CAN_GO_FORWARD,
+                                       CME_FEEDBACK_REPLY,
+                                       G_TYPE_UINT, sequence,
                                        G_TYPE_BOOLEAN,
-                                       moz_headless_can_go_back (headless),
+                                       moz_headless_can_go_forward (headless),
                                        G_TYPE_INVALID);
           break;
         }
@@ -977,14 +2194,14 @@ process_command (ClutterMozHeadlessView *view, ClutterMozEmbedCommand command)
         }
       case CME_COMMAND_SET_CHROME :
         {
-          gint chrome = clutter_mozembed_comms_receive_int (view->input);
+          gint chrome = clutter_mozembed_comms_receive_int (message);
           moz_headless_set_chrome_mask (headless, chrome);
           break;
         }
       case CME_COMMAND_TOGGLE_CHROME :
         {
           guint32 chrome = moz_headless_get_chrome_mask (headless);
-          chrome ^= clutter_mozembed_comms_receive_int (view->input);
+          chrome ^= clutter_mozembed_comms_receive_int (message);
           moz_headless_set_chrome_mask (headless, chrome);
           break;
         }
@@ -995,59 +2212,166 @@ process_command (ClutterMozHeadlessView *view, ClutterMozEmbedCommand command)
         }
       case CME_COMMAND_NEW_VIEW :
         {
+          gint fd;
+          guint id;
           gchar *input, *output;
+          GIOChannel *input_channel, *output_channel;
 
-          clutter_mozembed_comms_receive (view->input,
+          clutter_mozembed_comms_receive (message,
                                           G_TYPE_STRING, &input,
                                           G_TYPE_STRING, &output,
+                                          G_TYPE_UINT, &id,
                                           G_TYPE_INVALID);
 
           /* create_view takes ownership of the input and output strings */
-          clutter_mozheadless_create_view (moz_headless, input, output);
+          if (input && output)
+            {
+              clutter_mozheadless_create_view (moz_headless, input, output);
+              break;
+            }
+
+          g_free (input);
+          g_free (output);
+
+          if ((fd = claim_connection (id)) == -1)
+            break;
+
+          clutter_mozembed_comms_channels_new (fd, &input_channel,
+                                               &output_channel);
+          clutter_mozheadless_create_channel_view (moz_headless,
+                                                   input_channel,
+                                                   output_channel);
+          g_io_channel_unref (input_channel);
+          g_io_channel_unref (output_channel);
+
+          break;
+        }
+      case CME_COMMAND_ADD_VIEW :
+        {
+          ClutterMozEmbedCommandAddView body;
 
+          clutter_mozembed_command_add_view_receive (message, &body);
+          clutter_mozheadless_create_muxed_view (moz_headless,
+                                                 view->carrier ?
+                                                   view->carrier : view,
+                                                 body.view);
+          break;
+        }
+      case CME_COMMAND_REMOVE_VIEW :
+        {
+          if (view->carrier)
+            disconnect_view (view);
           break;
         }
       case CME_COMMAND_NEW_WINDOW :
         {
+          gint fd;
+          guint id;
           gchar *input, *output;
+          GIOChannel *input_channel, *output_channel;
 
-          clutter_mozembed_comms_receive (view->input,
+          clutter_mozembed_comms_receive (message,
                                           G_TYPE_STRING, &input,
                                           G_TYPE_STRING, &output,
+                                          G_TYPE_UINT, &id,
                                           G_TYPE_INVALID);
 
-          g_object_new (CLUTTER_TYPE_MOZHEADLESS,
-                        "input", input,
-                        "output", output,
-                        "private", priv->private,
-                        NULL);
+          if (input && output)
+            g_object_new (CLUTTER_TYPE_MOZHEADLESS,
+                          "input", input,
+                          "output", output,
+                          "private", priv->private,
+                          NULL);
+          else if ((fd = claim_connection (id)) != -1)
+            {
+              clutter_mozembed_comms_channels_new (fd, &input_channel,
+                                                   &output_channel);
+              g_object_new (CLUTTER_TYPE_MOZHEADLESS,
+                            "input-channel", input_channel,
+                            "output-channel", output_channel,
+                            "private", priv->private,
+                            NULL);
+              g_io_channel_unref (input_channel);
+              g_io_channel_unref (output_channel);
+            }
+
+          g_free (input);
+          g_free (output);
 
           break;
         }
       case CME_COMMAND_NEW_WINDOW_RESPONSE :
         {
-          if (clutter_mozembed_comms_receive_boolean (view->input))
+          gboolean expected;
+          guint sequence = clutter_mozembed_comms_receive_uint (message);
+
+          /* A late reply to a request that timed out is ignored, other than
+           * closing the connection it may have handed over.
+           */
+          expected = ((priv->sync_call == command) &&
+                      (priv->sync_sequence == sequence));
+          if (expected)
+            priv->sync_call = 0;
+
+          g_free (priv->new_input_file);
+          priv->new_input_file = NULL;
+          g_free (priv->new_output_file);
+          priv->new_output_file = NULL;
+          if (priv->new_fd != -1)
+            {
+              close (priv->new_fd);
+              priv->new_fd = -1;
+            }
+
+          if (clutter_mozembed_comms_receive_boolean (message))
             {
-              clutter_mozembed_comms_receive (view->input,
+              guint id;
+
+              clutter_mozembed_comms_receive (message,
                                               G_TYPE_STRING, &priv->new_input_file,
                                               G_TYPE_STRING, &priv->new_output_file,
+                                              G_TYPE_UINT, &id,
                                               G_TYPE_INVALID);
+
+              if (!priv->new_input_file || !priv->new_output_file)
+                priv->new_fd = claim_connection (id);
             }
-          else
+
+          if (!expected)
             {
               g_free (priv->new_input_file);
               priv->new_input_file = NULL;
               g_free (priv->new_output_file);
               priv->new_output_file = NULL;
+              if (priv->new_fd != -1)
+                {
+                  close (priv->new_fd);
+                  priv->new_fd = -1;
+                }
             }
           break;
         }
       case CME_COMMAND_FOCUS :
         {
-          gboolean focus = clutter_mozembed_comms_receive_boolean (view->input);
+          gboolean focus = clutter_mozembed_comms_receive_boolean (message);
           moz_headless_focus (MOZ_HEADLESS (moz_headless), focus);
           break;
         }
+      case CME_COMMAND_MAP :
+        {
+          view->mapped = clutter_mozembed_comms_receive_boolean (message);
+          clutter_moz_headless_update_suspended (moz_headless);
+          break;
+        }
+      case CME_COMMAND_RENDER_SCALE :
+        {
+          ClutterMozEmbedCommandRenderScale body;
+
+          clutter_mozembed_command_render_scale_receive (message, &body);
+          view->scale = body.scale;
+          clutter_moz_headless_update_render_scale (moz_headless);
+          break;
+        }
       case CME_COMMAND_PURGE_SESSION_HISTORY :
         {
           moz_headless_purge_session_history (MOZ_HEADLESS (moz_headless));
@@ -1055,7 +2379,7 @@ process_command (ClutterMozHeadlessView *view, ClutterMozEmbedCommand command)
         }
       case CME_COMMAND_DL_CANCEL :
         {
-          gint id = clutter_mozembed_comms_receive_int (view->input);
+          gint id = clutter_mozembed_comms_receive_int (message);
           g_signal_emit (view->parent, signals[CANCEL_DOWNLOAD], 0, id);
           break;
         }
@@ -1063,7 +2387,7 @@ process_command (ClutterMozHeadlessView *view, ClutterMozEmbedCommand command)
         {
           gchar *uri, *target;
 
-          clutter_mozembed_comms_receive (view->input,
+          clutter_mozembed_comms_receive (message,
                                           G_TYPE_STRING, &uri,
                                           G_TYPE_STRING, &target,
                                           G_TYPE_INVALID);
@@ -1078,7 +2402,7 @@ process_command (ClutterMozHeadlessView *view, ClutterMozEmbedCommand command)
 #ifdef SUPPORT_IM
       case CME_COMMAND_IM_COMMIT :
         {
-          gchar *str = clutter_mozembed_comms_receive_string (view->input);
+          gchar *str = clutter_mozembed_comms_receive_string (message);
 
           moz_headless_im_commit (MOZ_HEADLESS (moz_headless), str);
           g_free (str);
@@ -1090,7 +2414,7 @@ process_command (ClutterMozHeadlessView *view, ClutterMozEmbedCommand command)
           gchar *str;
           gint cursor_pos;
 
-          clutter_mozembed_comms_receive (view->input,
+          clutter_mozembed_comms_receive (message,
                                           G_TYPE_STRING, &str,
                                           G_TYPE_INT, &cursor_pos,
                                           G_TYPE_INVALID);
@@ -1104,7 +2428,7 @@ process_command (ClutterMozHeadlessView *view, ClutterMozEmbedCommand command)
 #endif
       case CME_COMMAND_SET_SEARCH_STRING :
         {
-          gchar *str = clutter_mozembed_comms_receive_string (view->input);
+          gchar *str = clutter_mozembed_comms_receive_string (message);
           moz_headless_find_set_string (MOZ_HEADLESS (moz_headless),
                                         str);
           g_free (str);
@@ -1120,6 +2444,37 @@ process_command (ClutterMozHeadlessView *view, ClutterMozEmbedCommand command)
           moz_headless_find_prev (MOZ_HEADLESS (moz_headless));
           break;
         }
+      case CME_COMMAND_SHM_FRAMES :
+        {
+          ClutterMozEmbedCommandShmFrames body;
+
+          clutter_mozembed_command_shm_frames_receive (message, &body);
+          view->shm_frames = body.enable;
+          if (!view->shm_frames)
+            break;
+
+          if (!priv->shm_frames)
+            {
+              /* Recreate the front buffers in shared memory */
+              priv->shm_frames = TRUE;
+              if (priv->buffers)
+                clutter_moz_headless_resize (moz_headless);
+            }
+          else if (priv->buffer_shm)
+            {
+              XRectangle area =
+                { 0, 0, priv->latest.frame_width, priv->latest.frame_height };
+
+              /* The view needs to read the whole frame again */
+              send_shm_surfaces (view);
+              add_view_damage (view, &area);
+              if (view->waiting_for_ack)
+                view->needs_update = TRUE;
+              else
+                send_view_update (view);
+            }
+          break;
+        }
       default :
         g_warning ("Unknown command (%d)", command);
     }
@@ -1128,15 +2483,24 @@ process_command (ClutterMozHeadlessView *view, ClutterMozEmbedCommand command)
 static void
 disconnect_view (ClutterMozHeadlessView *view)
 {
-  ClutterMozHeadlessPrivate *priv = view->parent->priv;
+  ClutterMozHeadless *moz_headless = view->parent;
+  ClutterMozHeadlessPrivate *priv = moz_headless->priv;
 
-  if (view->waiting_for_ack)
+  /* Views sharing our connection go with it */
+  while (view->muxed)
+    disconnect_view (view->muxed->data);
+  if (view->carrier)
+    view->carrier->muxed = g_list_remove (view->carrier->muxed, view);
+
+  if (view->damage)
     {
-      priv->waiting_for_ack --;
-      if (!priv->waiting_for_ack && priv->pending_resize)
-        clutter_moz_headless_resize (view->parent);
+      XDestroyRegion (view->damage);
+      view->damage = NULL;
     }
 
+  if (view->waiting_for_ack)
+    release_view_buffer (view);
+
   if (view->monitor)
     {
       g_file_monitor_cancel (view->monitor);
@@ -1162,6 +2526,19 @@ disconnect_view (ClutterMozHeadlessView *view)
       view->sack_source = 0;
     }
 
+  if (view->deferred_source)
+    {
+      g_source_remove (view->deferred_source);
+      view->deferred_source = 0;
+    }
+
+  while (!g_queue_is_empty (&view->deferred))
+    {
+      ClutterMozEmbedMessage *message = g_queue_pop_head (&view->deferred);
+      clutter_mozembed_comms_message_clear (message);
+      g_free (message);
+    }
+
   if (view->input)
     {
       GError *error = NULL;
@@ -1176,7 +2553,8 @@ disconnect_view (ClutterMozHeadlessView *view)
       g_io_channel_unref (view->input);
       view->input = NULL;
     }
-  g_remove (view->input_file);
+  if (view->input_file)
+    g_remove (view->input_file);
 
   if (view->output)
     {
@@ -1192,13 +2570,94 @@ disconnect_view (ClutterMozHeadlessView *view)
       g_io_channel_unref (view->output);
       view->output = NULL;
     }
-  g_remove (view->output_file);
+  if (view->output_file)
+    g_remove (view->output_file);
+
+  clutter_mozembed_comms_decoder_clear (&view->decoder);
+
+  if (view->state_page)
+    clutter_mozembed_state_close (view->state_page, view->state_name);
+  g_free (view->state_name);
 
   g_free (view->output_file);
   g_free (view->input_file);
   g_free (view);
 
   priv->views = g_list_remove (priv->views, view);
+  free_retired_buffers (moz_headless);
+  clutter_moz_headless_update_suspended (moz_headless);
+  clutter_moz_headless_update_render_scale (moz_headless);
+}
+
+static gboolean
+dispatch_commands (ClutterMozHeadlessView *view)
+{
+  GIOStatus status;
+  ClutterMozEmbedMessage message;
+  ClutterMozHeadlessPrivate *priv = view->parent->priv;
+
+  /* Commands held back while waiting for a reply go first */
+  while (!priv->sync_call && !g_queue_is_empty (&view->deferred))
+    {
+      ClutterMozHeadlessView *target;
+      ClutterMozEmbedMessage *deferred = g_queue_pop_head (&view->deferred);
+
+      if ((target = find_message_view (view, deferred)))
+        process_command (target, deferred);
+      clutter_mozembed_comms_message_clear (deferred);
+      g_free (deferred);
+    }
+
+  while ((status = clutter_mozembed_comms_decoder_pop (&view->decoder,
+                                                       &message)) ==
+         G_IO_STATUS_NORMAL)
+    {
+      ClutterMozHeadlessView *target;
+
+      /* While waiting for a reply, only the reply is processed. The caller
+       * is usually in the middle of a Gecko callback, so everything else
+       * waits until we're back in the main loop.
+       */
+      if (priv->sync_call && (message.id != priv->sync_call))
+        {
+          g_queue_push_tail (&view->deferred,
+                             g_memdup (&message, sizeof (message)));
+          continue;
+        }
+
+      /* Messages for views that have just gone are dropped */
+      if ((target = find_message_view (view, &message)))
+        process_command (target, &message);
+      clutter_mozembed_comms_message_clear (&message);
+    }
+
+  return (status != G_IO_STATUS_ERROR);
+}
+
+static gboolean
+read_commands (ClutterMozHeadlessView *view,
+               GIOChannel             *source)
+{
+  GIOStatus status;
+  GError *error = NULL;
+
+  status = clutter_mozembed_comms_decoder_feed (&view->decoder, source,
+                                                FALSE, &error);
+  if (status == G_IO_STATUS_ERROR)
+    {
+      g_warning ("Error reading from source: %s",
+                 error ? error->message : "Unknown error");
+      if (error)
+        g_error_free (error);
+      return FALSE;
+    }
+  else if (status == G_IO_STATUS_EOF)
+    {
+      g_warning ("End of file");
+      return FALSE;
+    }
+
+  return dispatch_commands (view);
 }
 
 static gboolean
@@ -1207,18 +2666,13 @@ input_io_func (GIOChannel              *source,
                ClutterMozHeadlessView  *view)
 {
   /* FYI: Maximum URL length in IE is 2083 characters */
-  ClutterMozEmbedCommand command;
-  gsize length;
-  GError *error = NULL;
   gboolean result = TRUE;
 
   ClutterMozHeadless *moz_headless = view->parent;
   ClutterMozHeadlessPrivate *priv = moz_headless->priv;
 
-  while (condition & (G_IO_PRI | G_IO_IN))
+  if (condition & (G_IO_PRI | G_IO_IN))
     {
-      GIOStatus status;
-
       /* We've received a connection, remove the disconnect timeout */
       if (priv->connect_timeout_source)
         {
@@ -1226,28 +2680,10 @@ input_io_func (GIOChannel              *source,
           priv->connect_timeout_source = 0;
         }
 
-      status = g_io_channel_read_chars (source,
-                                        (gchar *)(&command),
-                                        sizeof (command),
-                                        &length,
-                                        &error);
-      if (status == G_IO_STATUS_NORMAL)
-        {
-          process_command (view, command);
-        }
-      else if (status == G_IO_STATUS_ERROR)
-        {
-          g_warning ("Error reading from source: %s", error->message);
-          g_error_free (error);
-          result = FALSE;
-        }
-      else if (status == G_IO_STATUS_EOF)
-        {
-          g_warning ("End of file");
-          result = FALSE;
-        }
-
-      condition = g_io_channel_get_buffer_condition (source);
+      /* Only complete messages are dispatched, anything left over waits
+       * in the decoder until the rest of it arrives.
+       */
+      result = read_commands (view, source);
     }
 
   if (condition & G_IO_HUP)
@@ -1287,22 +2723,67 @@ input_io_func (GIOChannel              *source,
   return result;
 }
 
-static void
+static gboolean
+dispatch_deferred_cb (ClutterMozHeadlessView *view)
+{
+  view->deferred_source = 0;
+  dispatch_commands (view);
+  return FALSE;
+}
+
+/* Waits for the reply to a request sent to the primary view, for at most
+ * 'timeout' milliseconds.
+ */
+static gboolean
 block_until_command (ClutterMozHeadless     *moz_headless,
-                     ClutterMozEmbedCommand  command)
+                     ClutterMozEmbedCommand  command,
+                     guint                   sequence,
+                     gint                    timeout)
 {
+  GTimer *timer;
   ClutterMozHeadlessPrivate *priv = moz_headless->priv;
   ClutterMozHeadlessView *view = priv->views->data;
 
   priv->sync_call = command;
+  priv->sync_sequence = sequence;
 
-  /* FIXME: There needs to be a time limit here, or we can hang if the front-end
-   *        hangs. Here or in input_io_func anyway...
-   */
-  while (input_io_func (view->input, G_IO_IN, view) && priv->sync_call);
+  timer = g_timer_new ();
+  while (dispatch_commands (view) && priv->sync_call)
+    {
+      gint remaining;
+      GIOStatus status;
+      GError *error = NULL;
+
+      remaining = timeout - (gint)(g_timer_elapsed (timer, NULL) * 1000);
+      if ((remaining <= 0) ||
+          !clutter_mozembed_comms_poll (view->input, remaining))
+        break;
+
+      status = clutter_mozembed_comms_decoder_feed (&view->decoder,
+                                                    view->input,
+                                                    FALSE,
+                                                    &error);
+      if ((status == G_IO_STATUS_ERROR) || (status == G_IO_STATUS_EOF))
+        {
+          if (error)
+            g_error_free (error);
+          break;
+        }
+    }
+  g_timer_destroy (timer);
+
+  if (!g_queue_is_empty (&view->deferred) && !view->deferred_source)
+    view->deferred_source =
+      g_idle_add ((GSourceFunc)dispatch_deferred_cb, view);
 
   if (priv->sync_call)
-    g_warning ("Error making synchronous call to backend");
+    {
+      g_warning ("No reply from the front-end");
+      priv->sync_call = 0;
+      return FALSE;
+    }
+
+  return TRUE;
 }
 
 static void
@@ -1328,6 +2809,14 @@ clutter_mozheadless_get_property (GObject *object, guint property_id,
     g_value_set_boolean (value, priv->private);
     break;
 
+  case PROP_INPUT_CHANNEL :
+    g_value_set_boxed (value, priv->input_channel);
+    break;
+
+  case PROP_OUTPUT_CHANNEL :
+    g_value_set_boxed (value, priv->output_channel);
+    break;
+
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
   }
@@ -1356,6 +2845,14 @@ clutter_mozheadless_set_property (GObject *object, guint property_id,
     priv->private = g_value_get_boolean (value);
     break;
 
+  case PROP_INPUT_CHANNEL :
+    priv->input_channel = g_value_dup_boxed (value);
+    break;
+
+  case PROP_OUTPUT_CHANNEL :
+    priv->output_channel = g_value_dup_boxed (value);
+    break;
+
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
   }
@@ -1372,6 +2869,14 @@ clutter_mozheadless_dispose (GObject *object)
       priv->connect_timeout_source = 0;
     }
 
+  if (priv->state_source)
+    {
+      g_source_remove (priv->state_source);
+      priv->state_source = 0;
+    }
+
+  discard_damage (CLUTTER_MOZHEADLESS (object));
+
   while (priv->views)
     {
       ClutterMozHeadlessView *view = priv->views->data;
@@ -1386,19 +2891,25 @@ clutter_mozheadless_finalize (GObject *object)
 {
   ClutterMozHeadlessPrivate *priv = CLUTTER_MOZHEADLESS (object)->priv;
 
-  if (priv->buffer[0])
-    XFreePixmap (clutter_moz_headless_get_default_display (),
-                 priv->buffer[0]);
-  if (priv->buffer[1])
-    XFreePixmap (clutter_moz_headless_get_default_display (),
-                 priv->buffer[1]);
-  if (priv->buffer_gc)
-    XFreeGC (clutter_moz_headless_get_default_display (),
-             priv->buffer_gc);
+  free_buffers (CLUTTER_MOZHEADLESS (object), FALSE);
+  while (priv->retired)
+    {
+      destroy_buffer (priv->retired->data);
+      g_slice_free (ClutterMozHeadlessBuffer, priv->retired->data);
+      priv->retired = g_list_delete_link (priv->retired, priv->retired);
+    }
 
   g_free (priv->input_file);
   g_free (priv->output_file);
 
+  if (priv->new_fd != -1)
+    close (priv->new_fd);
+
+  if (priv->input_channel)
+    g_io_channel_unref (priv->input_channel);
+  if (priv->output_channel)
+    g_io_channel_unref (priv->output_channel);
+
   spawned_heads --;
   if (spawned_heads <= 0)
     g_main_loop_quit (mainloop);
@@ -1422,9 +2933,14 @@ clutter_mozheadless_constructed (GObject *object)
   if (G_OBJECT_CLASS (clutter_mozheadless_parent_class)->constructed)
     G_OBJECT_CLASS (clutter_mozheadless_parent_class)->constructed (object);
 
-  clutter_mozheadless_create_view (self,
-                                   g_strdup (priv->input_file),
-                                   g_strdup (priv->output_file));
+  if (priv->input_channel && priv->output_channel)
+    clutter_mozheadless_create_channel_view (self,
+                                             priv->input_channel,
+                                             priv->output_channel);
+  else
+    clutter_mozheadless_create_view (self,
+                                     g_strdup (priv->input_file),
+                                     g_strdup (priv->output_file));
 
   g_signal_connect (object, "location",
                     G_CALLBACK (location_cb), NULL);
@@ -1481,7 +2997,8 @@ clutter_mozheadless_constructed (GObject *object)
 
   spawned_heads ++;
 
-  if (priv->connect_timeout)
+  /* Channels passed in at construction are already connected */
+  if (priv->connect_timeout && !priv->input_channel)
     priv->connect_timeout_source =
       g_timeout_add (priv->connect_timeout,
                      (GSourceFunc)connect_timeout_cb,
@@ -1565,6 +3082,34 @@ clutter_mozheadless_class_init (ClutterMozHeadlessClass *klass)
                                                          G_PARAM_STATIC_BLURB |
                                                          G_PARAM_CONSTRUCT_ONLY));
 
+  g_object_class_install_property (object_class,
+                                   PROP_INPUT_CHANNEL,
+                                   g_param_spec_boxed ("input-channel",
+                                                       "Input channel",
+                                                       "Connected channel to "
+                                                       "use for input, "
+                                                       "instead of a pipe.",
+                                                       G_TYPE_IO_CHANNEL,
+                                                       G_PARAM_READWRITE |
+                                                       G_PARAM_STATIC_NAME |
+                                                       G_PARAM_STATIC_NICK |
+                                                       G_PARAM_STATIC_BLURB |
+                                                       G_PARAM_CONSTRUCT_ONLY));
+
+  g_object_class_install_property (object_class,
+                                   PROP_OUTPUT_CHANNEL,
+                                   g_param_spec_boxed ("output-channel",
+                                                       "Output channel",
+                                                       "Connected channel to "
+                                                       "use for output, "
+                                                       "instead of a pipe.",
+                                                       G_TYPE_IO_CHANNEL,
+                                                       G_PARAM_READWRITE |
+                                                       G_PARAM_STATIC_NAME |
+                                                       G_PARAM_STATIC_NICK |
+                                                       G_PARAM_STATIC_BLURB |
+                                                       G_PARAM_CONSTRUCT_ONLY));
+
   signals[CANCEL_DOWNLOAD] =
     g_signal_new ("cancel-download",
                   G_TYPE_FROM_CLASS (klass),
@@ -1589,6 +3134,9 @@ clutter_mozheadless_init (ClutterMozHeadless *self)
 {
   ClutterMozHeadlessPrivate *priv = self->priv = MOZHEADLESS_PRIVATE (self);
   priv->connect_timeout = 10000;
+  priv->new_fd = -1;
+  priv->render_scale = 1.0;
+  priv->request_timeout = CME_REQUEST_TIMEOUT;
 }
 
 ClutterMozHeadless *
@@ -1597,6 +3145,50 @@ clutter_mozheadless_new (void)
   return g_object_new (CLUTTER_TYPE_MOZHEADLESS, NULL);
 }
 
+/* Runs as a zygote. Each descriptor passed over 'fd' is the control
+ * socket of a new renderer, which is forked off to use it, with an id of
+ * 1 if it's for private browsing. Returns the control socket in the new
+ * renderer, or -1 in the zygote once the front-end has gone away.
+ */
+static gint
+fork_renderers (gint fd, gboolean *private)
+{
+  GIOChannel *channel = g_io_channel_unix_new (fd);
+
+  g_io_channel_set_encoding (channel, NULL, NULL);
+  g_io_channel_set_buffered (channel, FALSE);
+  g_io_channel_set_close_on_unref (channel, TRUE);
+
+  /* Have the children reaped for us */
+  signal (SIGCHLD, SIG_IGN);
+
+  while (TRUE)
+    {
+      guint id;
+      pid_t pid;
+      gint control_fd = clutter_mozembed_comms_receive_fd (channel, &id);
+
+      if (control_fd == -1)
+        break;
+
+      pid = fork ();
+      if (pid == 0)
+        {
+          signal (SIGCHLD, SIG_DFL);
+          g_io_channel_unref (channel);
+          *private = (id == 1);
+          return control_fd;
+        }
+
+      if (pid == -1)
+        g_warning ("Error forking renderer: %s", g_strerror (errno));
+      close (control_fd);
+    }
+
+  g_io_channel_unref (channel);
+  return -1;
+}
+
 #ifdef BREAK_ON_EXIT
 static void
 atexit_func ()
@@ -1609,16 +3201,25 @@ int
 main (int argc, char **argv)
 {
   ClutterMozHeadless *moz_headless;
-  const gchar *paths, *dirs;
-  gboolean private;
+  const gchar *paths, *dirs, *ring, *socket, *buffers;
+  gboolean private, zygote;
+  gint control_fd = -1;
+  GIOChannel *input = NULL, *output = NULL;
+
+  /* A zygote's children each need their own X connection, so they only
+   * initialise GTK once they've been forked.
+   */
+  zygote = (argc > 3) && (*argv[3] == 'z');
+  private = (argc > 3) && (*argv[3] == 'p');
 
 #ifdef SUPPORT_PLUGINS
-  gtk_init (&argc, &argv);
+  if (!zygote)
+    gtk_init (&argc, &argv);
 #endif
 
   if ((argc != 3) && (argc != 4))
     {
-      printf ("Usage: %s <output pipe> <input pipe> [p]\n", argv[0]);
+      printf ("Usage: %s <output pipe> <input pipe> [p|z]\n", argv[0]);
       return 1;
     }
 
@@ -1634,6 +3235,9 @@ main (int argc, char **argv)
   moz_headless_set_directory (NS_APP_USER_MIMETYPES_50_FILE,
                               PKGDATADIR "/mimeTypes.rdf");
 
+  if ((buffers = g_getenv ("CLUTTER_MOZEMBED_BUFFERS")))
+    n_front_buffers = MAX (2, atoi (buffers)) - 1;
+
   if ((paths = g_getenv ("CLUTTER_MOZEMBED_COMP_PATHS")))
     {
       gchar **pathsv = g_strsplit (paths, ":", -1), **p;
@@ -1669,9 +3273,69 @@ main (int argc, char **argv)
       g_strfreev (dir_pairs);
     }
 
-  moz_headless_push_startup ();
+  /* Use shared memory comms if the front-end has set them up for us */
+  if ((ring = g_getenv ("CLUTTER_MOZEMBED_RING")))
+    {
+      ClutterMozEmbedRingFds fds;
+      GError *error = NULL;
+
+      if (!clutter_mozembed_ring_fds_from_string (ring, &fds))
+        {
+          g_warning ("Invalid shared memory descriptors '%s'", ring);
+          return 1;
+        }
+
+      if (!clutter_mozembed_ring_open (&fds, FALSE, &input, &output, &error))
+        {
+          g_warning ("Error opening shared memory comms: %s",
+                     error->message);
+          g_error_free (error);
+          return 1;
+        }
+
+      g_unsetenv ("CLUTTER_MOZEMBED_RING");
+    }
+
+  /* If we were spawned, we have a control socket that connections are
+   * passed over. A zygote's socket is used to ask it for new renderers
+   * instead, and each of those is passed its own control socket.
+   */
+  if ((socket = g_getenv ("CLUTTER_MOZEMBED_SOCKET")))
+    {
+      control_fd = atoi (socket);
+      fcntl (control_fd, F_SETFD, FD_CLOEXEC);
+      g_unsetenv ("CLUTTER_MOZEMBED_SOCKET");
+    }
+
+  /* The zygote forks before starting Mozilla up, as that starts threads
+   * that a forked child wouldn't have. Its children share the libraries
+   * it has loaded and relocated, and the set-up above.
+   */
+  if (zygote)
+    {
+      if ((control_fd == -1) || input)
+        {
+          g_warning ("A zygote needs a control socket");
+          return 1;
+        }
 
-  private = (argc > 3) ? (*argv[3] == 'p') : FALSE;
+      if ((control_fd = fork_renderers (control_fd, &private)) == -1)
+        return 0;
+
+#ifdef SUPPORT_PLUGINS
+      gtk_init (&argc, &argv);
+#endif
+    }
+
+  if (control_fd != -1)
+    {
+      control_channel = g_io_channel_unix_new (control_fd);
+      g_io_channel_set_encoding (control_channel, NULL, NULL);
+      g_io_channel_set_buffered (control_channel, FALSE);
+      g_io_channel_set_close_on_unref (control_channel, TRUE);
+    }
+
+  moz_headless_push_startup ();
 
   clutter_mozheadless_prefs_init ();
   clutter_mozheadless_certs_init ();
@@ -1685,12 +3349,34 @@ main (int argc, char **argv)
       clutter_mozheadless_permission_manager_init ();
     }
 
+  /* Unless shared memory comms are being used, the first connection
+   * passed over the control socket is to our first window. It's only
+   * waited for now, so that a renderer spawned ahead of time has already
+   * started up when it arrives. If the front-end goes away first, the
+   * socket is closed and we exit.
+   */
+  if (control_channel && !input)
+    {
+      gint fd;
+
+      if ((fd = claim_connection (0)) == -1)
+        return 1;
+      clutter_mozembed_comms_channels_new (fd, &input, &output);
+    }
+
   moz_headless = g_object_new (CLUTTER_TYPE_MOZHEADLESS,
                                "output", argv[1],
                                "input", argv[2],
                                "private", private,
+                               "input-channel", input,
+                               "output-channel", output,
                                NULL);
 
+  if (input)
+    g_io_channel_unref (input);
+  if (output)
+    g_io_channel_unref (output);
+
   clutter_mozheadless_downloads_init (moz_headless);
 
   /* If private mode is requested then also start Mozilla's private
@@ -1722,5 +3408,8 @@ main (int argc, char **argv)
       clutter_mozheadless_permission_manager_deinit ();
     }
 
+  if (control_channel)
+    g_io_channel_unref (control_channel);
+
   return 0;
 }
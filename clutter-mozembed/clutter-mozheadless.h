@@ -24,7 +24,10 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 #include <moz-headless.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
 #include "clutter-mozembed-comms.h"
+#include "clutter-mozembed-state.h"
 
 G_BEGIN_DECLS
 
@@ -58,19 +61,55 @@ typedef struct {
   ClutterMozHeadlessPrivate *priv;
 } ClutterMozHeadless;
 
-typedef struct
+typedef struct _ClutterMozHeadlessView
 {
   ClutterMozHeadless *parent;
 
+  /* Views created by the front-end after the first share the connection of
+   * the view they were created from, the carrier, which reads their
+   * commands for them. 'id' is the view's id in the message headers, and
+   * 'muxed' lists the views sharing a carrier's connection.
+   */
+  guint            id;
+  struct _ClutterMozHeadlessView *carrier;
+  GList           *muxed;
+
   gchar           *input_file;
   gchar           *output_file;
   GIOChannel      *input;
   GIOChannel      *output;
   guint            watch_id;
   GFileMonitor    *monitor;
-  gint             waiting_for_ack;
   guint            mack_source;
   guint            sack_source;
+  ClutterMozEmbedDecoder decoder;
+
+  /* Updates are sent one at a time. 'buffer' and 'generation' identify the
+   * front buffer of the last one, and 'damage' is what has changed since
+   * then.
+   */
+  gint             waiting_for_ack;
+  gint             buffer;
+  guint            generation;
+  gboolean         needs_update;
+  Region           damage;
+
+  /* Whether the view reads frames from shared memory */
+  gboolean         shm_frames;
+
+  /* Whether the view is on screen */
+  gboolean         mapped;
+
+  /* Scale the view is shown at, frames needn't be any more detailed */
+  gdouble          scale;
+
+  /* Shared page the view reads the simple page properties from */
+  ClutterMozEmbedStatePage *state_page;
+  gchar           *state_name;
+
+  /* Commands that arrived while waiting for a reply */
+  GQueue           deferred;
+  guint            deferred_source;
 } ClutterMozHeadlessView;
 
 typedef struct {
@@ -0,0 +1,191 @@
+/* Compares the throughput and latency of the pipe, socket and shared memory
+ * comms transports, using motion-event sized messages.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <clutter-mozembed-comms.h>
+#include <clutter-mozembed-comms-stubs.h>
+#include <clutter-mozembed-ring.h>
+
+#define N_MESSAGES 500000
+#define N_ROUND_TRIPS 50000
+
+static GIOChannel *
+pipe_channel_new (gint fd)
+{
+  GIOChannel *channel = g_io_channel_unix_new (fd);
+  g_io_channel_set_encoding (channel, NULL, NULL);
+  g_io_channel_set_buffered (channel, FALSE);
+  g_io_channel_set_close_on_unref (channel, TRUE);
+  return channel;
+}
+
+/* Each process only ever reads from one channel at a time */
+static ClutterMozEmbedDecoder decoder;
+
+static void
+read_one (GIOChannel *channel, gint id)
+{
+  GIOStatus status;
+  ClutterMozEmbedMessage message;
+
+  GError *error = NULL;
+
+  while ((status = clutter_mozembed_comms_decoder_pop (&decoder, &message)) ==
+         G_IO_STATUS_AGAIN)
+    {
+      status = clutter_mozembed_comms_decoder_feed (&decoder, channel, TRUE,
+                                                    &error);
+      if ((status == G_IO_STATUS_ERROR) || (status == G_IO_STATUS_EOF))
+        break;
+    }
+
+  if (status != G_IO_STATUS_NORMAL)
+    g_error ("Error reading message: %s",
+             error ? error->message : "Invalid message");
+
+  if (message.id != id)
+    g_error ("Unexpected message (%d)", message.id);
+
+  clutter_mozembed_comms_message_clear (&message);
+}
+
+static void
+send_motion (GIOChannel *channel, gint i)
+{
+  clutter_mozembed_command_motion_send (channel, i, i, 0);
+}
+
+static void
+run_child (GIOChannel *input, GIOChannel *output)
+{
+  gint i;
+
+  for (i = 0; i < N_MESSAGES; i++)
+    read_one (input, CME_COMMAND_MOTION);
+  clutter_mozembed_feedback_motion_ack_send (output);
+
+  for (i = 0; i < N_ROUND_TRIPS; i++)
+    {
+      read_one (input, CME_COMMAND_MOTION);
+      clutter_mozembed_feedback_motion_ack_send (output);
+    }
+
+  exit (0);
+}
+
+static void
+run_parent (const gchar *name, GIOChannel *input, GIOChannel *output)
+{
+  gint i;
+  gdouble throughput, latency;
+  GTimer *timer = g_timer_new ();
+
+  for (i = 0; i < N_MESSAGES; i++)
+    send_motion (output, i);
+  read_one (input, CME_FEEDBACK_MOTION_ACK);
+  throughput = N_MESSAGES / g_timer_elapsed (timer, NULL);
+
+  g_timer_start (timer);
+  for (i = 0; i < N_ROUND_TRIPS; i++)
+    {
+      send_motion (output, i);
+      read_one (input, CME_FEEDBACK_MOTION_ACK);
+    }
+  latency = (g_timer_elapsed (timer, NULL) * 1000000.0) / N_ROUND_TRIPS;
+
+  g_timer_destroy (timer);
+  clutter_mozembed_comms_decoder_clear (&decoder);
+  wait (NULL);
+
+  printf ("%-6s %12.0f messages/s %10.2f us/round-trip\n",
+          name, throughput, latency);
+}
+
+static void
+bench_pipes (void)
+{
+  gint to_child[2], to_parent[2];
+
+  if ((pipe (to_child) == -1) || (pipe (to_parent) == -1))
+    g_error ("Error creating pipes");
+
+  if (fork () == 0)
+    {
+      close (to_child[1]);
+      close (to_parent[0]);
+      run_child (pipe_channel_new (to_child[0]),
+                 pipe_channel_new (to_parent[1]));
+    }
+
+  close (to_child[0]);
+  close (to_parent[1]);
+  run_parent ("pipe",
+              pipe_channel_new (to_parent[0]),
+              pipe_channel_new (to_child[1]));
+}
+
+static void
+bench_socket (void)
+{
+  gint local, remote;
+  GIOChannel *input, *output;
+
+  if (!clutter_mozembed_comms_socketpair (&local, &remote))
+    g_error ("Error creating sockets");
+
+  if (fork () == 0)
+    {
+      close (local);
+      clutter_mozembed_comms_channels_new (remote, &input, &output);
+      run_child (input, output);
+    }
+
+  close (remote);
+  clutter_mozembed_comms_channels_new (local, &input, &output);
+  run_parent ("socket", input, output);
+}
+
+static void
+bench_ring (void)
+{
+  GIOChannel *input, *output;
+  ClutterMozEmbedRingFds local, remote;
+
+  GError *error = NULL;
+
+  if (!clutter_mozembed_ring_create (&local, &remote, &error))
+    g_error ("Error creating ring: %s", error->message);
+
+  if (fork () == 0)
+    {
+      close (local.hup_fd);
+      if (!clutter_mozembed_ring_open (&remote, FALSE, &input, &output,
+                                       &error))
+        g_error ("Error opening ring: %s", error->message);
+
+      run_child (input, output);
+    }
+
+  close (remote.hup_fd);
+  if (!clutter_mozembed_ring_open (&local, TRUE, &input, &output, &error))
+    g_error ("Error opening ring: %s", error->message);
+
+  run_parent ("shm", input, output);
+}
+
+int
+main (int argc, char **argv)
+{
+  printf ("%d messages, %d round-trips\n", N_MESSAGES, N_ROUND_TRIPS);
+
+  bench_pipes ();
+  bench_socket ();
+  bench_ring ();
+
+  return 0;
+}
@@ -0,0 +1,121 @@
+/* Compares completing back-to-front buffer copies with XSync, as
+ * clutter-mozheadless does, against carrying on and waiting for their
+ * NoExpose event instead. Each frame does some busy work, standing in for
+ * script and layout, then paints and copies a small area. Run it against
+ * the X server being measured, e.g. under Xvfb.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <X11/Xlib.h>
+
+#define N_FRAMES 5000
+#define WIDTH 1024
+#define HEIGHT 768
+#define WORK_US 200
+
+static void
+busy_work (void)
+{
+  GTimer *timer = g_timer_new ();
+  while (g_timer_elapsed (timer, NULL) * 1000000.0 < WORK_US);
+  g_timer_destroy (timer);
+}
+
+/* Handles any copies that have completed, returns how many there were */
+static gint
+drain_events (Display *display, gboolean block)
+{
+  XEvent event;
+  gint done = 0;
+
+  while (block || XPending (display))
+    {
+      XNextEvent (display, &event);
+      if (event.type == NoExpose)
+        {
+          done ++;
+          block = FALSE;
+        }
+    }
+
+  return done;
+}
+
+static void
+bench (Display *display, gboolean sync_copy)
+{
+  gint i, in_flight;
+  Pixmap back, front;
+  XGCValues values;
+  GC gc;
+  gdouble elapsed;
+
+  GTimer *timer = g_timer_new ();
+  Window root = DefaultRootWindow (display);
+  gint depth = DefaultDepth (display, DefaultScreen (display));
+
+  back = XCreatePixmap (display, root, WIDTH, HEIGHT, depth);
+  front = XCreatePixmap (display, root, WIDTH, HEIGHT, depth);
+  values.graphics_exposures = !sync_copy;
+  gc = XCreateGC (display, front, GCGraphicsExposures, &values);
+  XSync (display, False);
+
+  in_flight = 0;
+  g_timer_start (timer);
+  for (i = 0; i < N_FRAMES; i++)
+    {
+      gint x = (i * 13) % (WIDTH - 64);
+      gint y = (i * 7) % (HEIGHT - 64);
+
+      busy_work ();
+
+      XSetForeground (display, gc, i);
+      XFillRectangle (display, back, gc, x, y, 64, 64);
+      XCopyArea (display, back, front, gc, x, y, 64, 64, x, y);
+
+      if (sync_copy)
+        XSync (display, False);
+      else
+        {
+          XFlush (display);
+          in_flight ++;
+          in_flight -= drain_events (display, FALSE);
+        }
+    }
+
+  while (in_flight > 0)
+    in_flight -= drain_events (display, TRUE);
+  elapsed = g_timer_elapsed (timer, NULL);
+
+  printf ("%-6s %10.0f frames/s %10.2f us/frame\n",
+          sync_copy ? "xsync" : "async",
+          N_FRAMES / elapsed,
+          (elapsed * 1000000.0) / N_FRAMES);
+
+  XFreeGC (display, gc);
+  XFreePixmap (display, back);
+  XFreePixmap (display, front);
+  g_timer_destroy (timer);
+}
+
+int
+main (int argc, char **argv)
+{
+  Display *display = XOpenDisplay (NULL);
+
+  if (!display)
+    {
+      fprintf (stderr, "Unable to open display\n");
+      return 1;
+    }
+
+  printf ("%d frames, %d us of work per frame\n", N_FRAMES, WORK_US);
+
+  bench (display, TRUE);
+  bench (display, FALSE);
+
+  XCloseDisplay (display);
+
+  return 0;
+}
@@ -0,0 +1,104 @@
+/* Checks that messages made by the generated stubs come out of the decoder
+ * as they went in, including ones whose body is more strictly aligned than
+ * the header, and that the stream stays in step after them.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <clutter-mozembed-comms.h>
+#include <clutter-mozembed-comms-stubs.h>
+
+static ClutterMozEmbedDecoder decoder;
+
+static void
+read_message (GIOChannel *channel, ClutterMozEmbedMessage *message, gint id)
+{
+  GIOStatus status;
+  GError *error = NULL;
+
+  while ((status = clutter_mozembed_comms_decoder_pop (&decoder, message)) ==
+         G_IO_STATUS_AGAIN)
+    {
+      status = clutter_mozembed_comms_decoder_feed (&decoder, channel, TRUE,
+                                                    &error);
+      if ((status == G_IO_STATUS_ERROR) || (status == G_IO_STATUS_EOF))
+        break;
+    }
+
+  if (status != G_IO_STATUS_NORMAL)
+    g_error ("Error reading message: %s",
+             error ? error->message : "Invalid message");
+
+  if (message->id != id)
+    g_error ("Expected message %d, got %d", id, message->id);
+}
+
+int
+main (int argc, char **argv)
+{
+  gint fds[2];
+  GIOChannel *input, *output;
+  ClutterMozEmbedMessage message;
+  ClutterMozEmbedFeedbackUpdate update;
+  ClutterMozEmbedCommandRenderScale render_scale;
+  ClutterMozEmbedCommandScrollTo scroll_to;
+  ClutterMozEmbedFeedbackUpdateMessage packed;
+
+  /* The body follows the header directly, and the length covers it all */
+  clutter_mozembed_feedback_update_pack (&packed, G_MAXULONG,
+                                         1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                         11, 12, 13, 14, 15, 16);
+  g_assert (G_STRUCT_OFFSET (ClutterMozEmbedFeedbackUpdateMessage, body) ==
+            sizeof (ClutterMozEmbedHeader));
+  g_assert (packed.header.length == sizeof (ClutterMozEmbedFeedbackUpdate));
+  g_assert (CME_MESSAGE_SIZE (&packed) ==
+            sizeof (ClutterMozEmbedHeader) +
+            sizeof (ClutterMozEmbedFeedbackUpdate));
+
+  if (pipe (fds) == -1)
+    g_error ("Error creating pipe");
+
+  input = g_io_channel_unix_new (fds[0]);
+  output = g_io_channel_unix_new (fds[1]);
+  g_io_channel_set_encoding (input, NULL, NULL);
+  g_io_channel_set_encoding (output, NULL, NULL);
+  g_io_channel_set_buffered (output, FALSE);
+
+  clutter_mozembed_feedback_update_send (output, G_MAXULONG,
+                                         1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                         11, 12, 13, 14, 15, 16);
+  clutter_mozembed_command_render_scale_send (output, 0.375);
+  clutter_mozembed_command_scroll_to_send (output, -42, 42);
+
+  read_message (input, &message, CME_FEEDBACK_UPDATE);
+  g_assert (clutter_mozembed_feedback_update_receive (&message, &update));
+  g_assert (update.surface == G_MAXULONG);
+  g_assert (update.surface_width == 1);
+  g_assert (update.scroll_x == 7);
+  g_assert (update.frame_height == 16);
+  clutter_mozembed_comms_message_clear (&message);
+
+  read_message (input, &message, CME_COMMAND_RENDER_SCALE);
+  g_assert (clutter_mozembed_command_render_scale_receive (&message,
+                                                           &render_scale));
+  g_assert (render_scale.scale == 0.375);
+  clutter_mozembed_comms_message_clear (&message);
+
+  read_message (input, &message, CME_COMMAND_SCROLL_TO);
+  g_assert (clutter_mozembed_command_scroll_to_receive (&message,
+                                                        &scroll_to));
+  g_assert (scroll_to.x == -42);
+  g_assert (scroll_to.y == 42);
+  clutter_mozembed_comms_message_clear (&message);
+
+  clutter_mozembed_comms_decoder_clear (&decoder);
+  g_io_channel_unref (input);
+  g_io_channel_unref (output);
+  close (fds[0]);
+  close (fds[1]);
+
+  printf ("Comms stubs OK\n");
+
+  return 0;
+}